@@ -32,10 +32,17 @@
 #include <string.h>
 
 #include <xcb/xcb.h>
+/* xcbext.h declares an xcb_popcount() that xcb_bitops.h
+   defines differently; only xcb_send_request() is wanted. */
+#define xcb_popcount xcbext_popcount
+#include <xcb/xcbext.h>
+#undef xcb_popcount
 #include <xcb/shm.h>
 #include <xcb/xcb_aux.h>
 #include "xcb_bitops.h"
 #include "xcb_image.h"
+#include "xcb_kernels.h"
+#include "xcb_parallel.h"
 #define BUILD
 #include "xcb_pixel.h"
 
@@ -52,6 +59,134 @@ find_format_by_depth (const xcb_setup_t *setup, uint8_t depth)
 }
 
 
+/* Channel masks (red, green, blue, alpha) of the truecolor
+   layouts we know how to change depth between: 8888, 888,
+   10-10-10 (deep color), 565 and 555. */
+static int
+truecolor_masks (uint8_t depth, uint32_t *masks)
+{
+  switch (depth) {
+  case 30:
+      masks[0] = 0x3ff00000;
+      masks[1] = 0x000ffc00;
+      masks[2] = 0x000003ff;
+      masks[3] = 0;
+      return 1;
+  case 32:
+  case 24:
+      masks[0] = 0xff0000;
+      masks[1] = 0x00ff00;
+      masks[2] = 0x0000ff;
+      masks[3] = depth == 32 ? 0xff000000 : 0;
+      return 1;
+  case 16:
+      masks[0] = 0xf800;
+      masks[1] = 0x07e0;
+      masks[2] = 0x001f;
+      masks[3] = 0;
+      return 1;
+  case 15:
+      masks[0] = 0x7c00;
+      masks[1] = 0x03e0;
+      masks[2] = 0x001f;
+      masks[3] = 0;
+      return 1;
+  }
+  return 0;
+}
+
+
+static int
+truecolor_class (uint8_t class)
+{
+  return class == XCB_VISUAL_CLASS_TRUE_COLOR ||
+      class == XCB_VISUAL_CLASS_DIRECT_COLOR;
+}
+
+
+/* Pick the truecolor visual to convert depths to: the root
+   visual of the first screen that has one, else the deepest
+   truecolor visual with a pixmap format. */
+static xcb_visualtype_t *
+find_truecolor_visual (const xcb_setup_t *setup, uint8_t *depthp)
+{
+  xcb_screen_iterator_t  screens;
+  xcb_visualtype_t *     best = 0;
+  uint8_t                best_depth = 0;
+
+  for (screens = xcb_setup_roots_iterator(setup);
+       screens.rem;
+       xcb_screen_next(&screens)) {
+      xcb_depth_iterator_t  depths;
+
+      for (depths = xcb_screen_allowed_depths_iterator(screens.data);
+	   depths.rem;
+	   xcb_depth_next(&depths)) {
+	  xcb_visualtype_iterator_t  visuals;
+
+	  if (!find_format_by_depth(setup, depths.data->depth))
+	      continue;
+	  for (visuals = xcb_depth_visuals_iterator(depths.data);
+	       visuals.rem;
+	       xcb_visualtype_next(&visuals)) {
+	      if (!truecolor_class(visuals.data->_class))
+		  continue;
+	      if (visuals.data->visual_id == screens.data->root_visual) {
+		  *depthp = depths.data->depth;
+		  return visuals.data;
+	      }
+	      if (depths.data->depth > best_depth) {
+		  best = visuals.data;
+		  best_depth = depths.data->depth;
+	      }
+	  }
+      }
+  }
+  *depthp = best_depth;
+  return best;
+}
+
+
+/* The depth of the given visual, or 0 if no screen has it. */
+static uint8_t
+find_visual_depth (const xcb_setup_t *setup, xcb_visualid_t visual_id)
+{
+  xcb_screen_iterator_t  screens;
+
+  for (screens = xcb_setup_roots_iterator(setup);
+       screens.rem;
+       xcb_screen_next(&screens)) {
+      xcb_depth_iterator_t  depths;
+
+      for (depths = xcb_screen_allowed_depths_iterator(screens.data);
+	   depths.rem;
+	   xcb_depth_next(&depths)) {
+	  xcb_visualtype_iterator_t  visuals;
+
+	  for (visuals = xcb_depth_visuals_iterator(depths.data);
+	       visuals.rem;
+	       xcb_visualtype_next(&visuals))
+	      if (visuals.data->visual_id == visual_id)
+		  return depths.data->depth;
+      }
+  }
+  return 0;
+}
+
+
+/* Channel masks of a truecolor visual; whatever bits of the
+   depth the color channels leave over are taken as alpha. */
+static void
+visual_masks (const xcb_visualtype_t *visual, uint8_t depth, uint32_t *masks)
+{
+  masks[0] = visual->red_mask;
+  masks[1] = visual->green_mask;
+  masks[2] = visual->blue_mask;
+  masks[3] = xcb_mask(depth) &
+      ~(visual->red_mask | visual->green_mask | visual->blue_mask);
+}
+
+
 static xcb_image_format_t
 effective_format(xcb_image_format_t format, uint8_t bpp)
 {
@@ -123,24 +258,218 @@ image_format_valid (xcb_image_t *image) {
 }
 
 
+/* Per-layout pixel access for xcb_image_annotate().  The
+ * xcb_pixel.h routines are wrapped to a common signature;
+ * layouts they don't cover get the generic routines. */
+#define PIXEL_FUNCS(F, mask)						\
+static uint32_t								\
+get_pixel_##F (xcb_image_t *image, uint32_t x, uint32_t y)		\
+{									\
+  return xcb_image_get_pixel_##F(image, x, y);				\
+}									\
+									\
+static void								\
+put_pixel_##F (xcb_image_t *image, uint32_t x, uint32_t y,		\
+	       uint32_t pixel)						\
+{									\
+  xcb_image_put_pixel_##F(image, x, y, pixel & (mask));		\
+}
+
+PIXEL_FUNCS(XY8M, 1)
+PIXEL_FUNCS(XY8L, 1)
+PIXEL_FUNCS(XY16M, 1)
+PIXEL_FUNCS(XY32M, 1)
+PIXEL_FUNCS(Z4M, 0xf)
+PIXEL_FUNCS(Z4L, 0xf)
+PIXEL_FUNCS(Z8, 0xff)
+PIXEL_FUNCS(Z16M, 0xffff)
+PIXEL_FUNCS(Z16L, 0xffff)
+PIXEL_FUNCS(Z24M, 0xffffff)
+PIXEL_FUNCS(Z24L, 0xffffff)
+PIXEL_FUNCS(Z32M, 0xffffffff)
+PIXEL_FUNCS(Z32L, 0xffffffff)
+
+#undef PIXEL_FUNCS
+
+/* Host order pixels, through memcpy since the image data
+ * needn't be aligned. */
+static uint32_t
+get_pixel_Z16H (xcb_image_t *image, uint32_t x, uint32_t y)
+{
+  uint16_t  pixel;
+  memcpy(&pixel, image->data + y * image->stride +
+	 ((image->x_offset + x) << 1), sizeof(pixel));
+  return pixel;
+}
+
+static void
+put_pixel_Z16H (xcb_image_t *image, uint32_t x, uint32_t y, uint32_t pixel)
+{
+  uint16_t  p = pixel;
+  memcpy(image->data + y * image->stride +
+	 ((image->x_offset + x) << 1), &p, sizeof(p));
+}
+
+static uint32_t
+get_pixel_Z32H (xcb_image_t *image, uint32_t x, uint32_t y)
+{
+  uint32_t  pixel;
+  memcpy(&pixel, image->data + y * image->stride +
+	 ((image->x_offset + x) << 2), sizeof(pixel));
+  return pixel;
+}
+
+static void
+put_pixel_Z32H (xcb_image_t *image, uint32_t x, uint32_t y, uint32_t pixel)
+{
+  memcpy(image->data + y * image->stride +
+	 ((image->x_offset + x) << 2), &pixel, sizeof(pixel));
+}
+
+static void
+annotate_funcs (xcb_image_t *image)
+{
+  int  msb = image->byte_order == XCB_IMAGE_ORDER_MSB_FIRST;
+  int  host = image->byte_order == xcb_host_byte_order();
+
+#define SET_PIXEL_FUNCS(F)			\
+  do {						\
+    image->get_pixel_func = get_pixel_##F;	\
+    image->put_pixel_func = put_pixel_##F;	\
+  } while (0)
+
+  image->get_pixel_func = xcb_image_get_pixel;
+  image->put_pixel_func = xcb_image_put_pixel;
+  switch (effective_format(image->format, image->bpp)) {
+  case XCB_IMAGE_FORMAT_XY_PIXMAP:
+      /* Bitmaps only.  With no bytes swapped within a
+	 unit, the unit makes no difference. */
+      if (image->depth != 1 || !(image->plane_mask & 1))
+	  break;
+      if (image->byte_order == image->bit_order || image->unit == 8) {
+	  if (image->bit_order == XCB_IMAGE_ORDER_MSB_FIRST)
+	      SET_PIXEL_FUNCS(XY8M);
+	  else
+	      SET_PIXEL_FUNCS(XY8L);
+      } else if (image->bit_order == XCB_IMAGE_ORDER_MSB_FIRST) {
+	  if (image->unit == 16)
+	      SET_PIXEL_FUNCS(XY16M);
+	  else
+	      SET_PIXEL_FUNCS(XY32M);
+      }
+      break;
+  case XCB_IMAGE_FORMAT_Z_PIXMAP:
+      switch (image->bpp) {
+      case 4:
+	  if (msb)
+	      SET_PIXEL_FUNCS(Z4M);
+	  else
+	      SET_PIXEL_FUNCS(Z4L);
+	  break;
+      case 8:
+	  SET_PIXEL_FUNCS(Z8);
+	  break;
+      case 16:
+	  if (host)
+	      SET_PIXEL_FUNCS(Z16H);
+	  else if (msb)
+	      SET_PIXEL_FUNCS(Z16M);
+	  else
+	      SET_PIXEL_FUNCS(Z16L);
+	  break;
+      case 24:
+	  if (msb)
+	      SET_PIXEL_FUNCS(Z24M);
+	  else
+	      SET_PIXEL_FUNCS(Z24L);
+	  break;
+      case 32:
+	  if (host)
+	      SET_PIXEL_FUNCS(Z32H);
+	  else if (msb)
+	      SET_PIXEL_FUNCS(Z32M);
+	  else
+	      SET_PIXEL_FUNCS(Z32L);
+	  break;
+      }
+      break;
+  default:
+      break;
+  }
+
+#undef SET_PIXEL_FUNCS
+
+  image->get_row_func = _xcb_image_unpacker(image);
+  image->put_row_func = _xcb_image_packer(image);
+  image->fill_row_func = _xcb_image_filler(image);
+}
+
 void
 xcb_image_annotate (xcb_image_t *image)
 {
   xcb_image_format_t  ef = effective_format(image->format, image->bpp);
+  uint32_t            stride = 0;
+  uint32_t            planes = 1;
+
   switch (ef) {
   case XCB_IMAGE_FORMAT_XY_PIXMAP:
-      image->stride = xcb_roundup(image->width, image->scanline_pad) >> 3;
-      image->size = image->height * image->stride * image->depth;
+      stride = xcb_roundup(image->width, image->scanline_pad) >> 3;
+      planes = image->depth;
       break;
   case XCB_IMAGE_FORMAT_Z_PIXMAP:
-      image->stride = xcb_roundup((uint32_t)image->width *
-				  (uint32_t)image->bpp,
-				  image->scanline_pad) >> 3;
-      image->size = image->height * image->stride;
+      stride = xcb_roundup((uint32_t)image->width *
+			   (uint32_t)image->bpp,
+			   image->scanline_pad) >> 3;
       break;
   default:
       assert(0);
   }
+  /* A view keeps the stride of its parent, which is as wide
+     as the parent's scanlines rather than its own. */
+  if (image->x_offset == 0 && (image->base || image->stride <= stride))
+      image->stride = stride;
+  image->size = image->height * image->stride * planes;
+  annotate_funcs(image);
+}
+
+/* Bits a pixel takes in a scanline: one per plane for xy. */
+static uint32_t
+pixel_bits (xcb_image_t *image)
+{
+  if (effective_format(image->format, image->bpp) == XCB_IMAGE_FORMAT_Z_PIXMAP)
+      return image->bpp;
+  return 1;
+}
+
+/* Whether image is laid out as xcb_image_create() would lay
+ * it out, rather than being a view into a wider image.  Only
+ * then can whole scanlines be copied or rewritten. */
+static int
+image_packed (xcb_image_t *image)
+{
+  return image->x_offset == 0 &&
+      image->stride == xcb_roundup((uint32_t) image->width * pixel_bits(image),
+				   image->scanline_pad) >> 3;
+}
+
+/* Whether writing whole scanlines of image could clobber
+ * something: an image that doesn't own its storage may be a
+ * view, whose scanline pad holds pixels of its parent. */
+static int
+keep_scanline_pad (xcb_image_t *image)
+{
+  return !image->base &&
+      (uint32_t) image->width * pixel_bits(image) < image->stride * 8;
+}
+
+/* Whether a rectangle lies within image, without the sums
+ * that could wrap. */
+static int
+span_inside (xcb_image_t *image, uint32_t x, uint32_t y,
+	     uint32_t width, uint32_t height)
+{
+  return width <= image->width && x <= image->width - width &&
+	 height <= image->height && y <= image->height - height;
 }
 
 
@@ -245,6 +574,8 @@ xcb_image_create (uint16_t           width,
   image->plane_mask = xcb_mask(depth);
   image->byte_order = byte_order;
   image->bit_order = bit_order;
+  image->x_offset = 0;
+  image->stride = 0;
   xcb_image_annotate(image);
 
   /*
@@ -312,20 +643,54 @@ xcb_image_get (xcb_connection_t *  conn,
 	       uint32_t            plane_mask,
 	       xcb_image_format_t  format)
 {
-  xcb_get_image_cookie_t   image_cookie;
-  xcb_get_image_reply_t *  imrep;
+  return xcb_image_get_finish(conn,
+			      xcb_image_get_start(conn, draw, x, y,
+						  width, height,
+						  plane_mask, format));
+}
+
+
+xcb_image_get_cookie_t
+xcb_image_get_start (xcb_connection_t *  conn,
+		     xcb_drawable_t      draw,
+		     int16_t             x,
+		     int16_t             y,
+		     uint16_t            width,
+		     uint16_t            height,
+		     uint32_t            plane_mask,
+		     xcb_image_format_t  format)
+{
+  xcb_image_get_cookie_t  cookie;
+
+  cookie.cookie = xcb_get_image(conn, format, draw, x, y,
+				width, height, plane_mask);
+  cookie.width = width;
+  cookie.height = height;
+  cookie.plane_mask = plane_mask;
+  cookie.format = format;
+  return cookie;
+}
+
+
+/* Turn a GetImage reply into the image asked for by
+ * cookie, using the reply as its backing store unless
+ * planes were masked out.  Frees the reply on failure.
+ */
+static xcb_image_t *
+image_from_reply (xcb_connection_t *       conn,
+		  xcb_image_get_cookie_t   cookie,
+		  xcb_get_image_reply_t *  imrep)
+{
   xcb_image_t *            image = 0;
+  uint32_t                 plane_mask = cookie.plane_mask;
   uint32_t                 bytes;
   uint8_t *                data;
 
-  image_cookie = xcb_get_image(conn, format, draw, x, y,
-			       width, height, plane_mask);
-  imrep = xcb_get_image_reply(conn, image_cookie, 0);
   if (!imrep)
       return 0;
   bytes = xcb_get_image_data_length(imrep);
   data = xcb_get_image_data(imrep);
-  switch (format) {
+  switch (cookie.format) {
   case XCB_IMAGE_FORMAT_XY_PIXMAP:
       plane_mask &= xcb_mask(imrep->depth);
       if (plane_mask != xcb_mask(imrep->depth)) {
@@ -335,13 +700,15 @@ xcb_image_get (xcb_connection_t *  conn,
 	  uint8_t        *src_plane = data;
 	  uint8_t        *dst_plane;
 
-          image = xcb_image_create_native(conn, width, height, format,
-                                          imrep->depth, 0, 0, 0);
+          image = xcb_image_create_native(conn, cookie.width, cookie.height,
+                                          cookie.format, imrep->depth,
+                                          0, 0, 0);
           if (!image) {
               free(imrep);
               return 0;
           }
           image->plane_mask = plane_mask;
+          xcb_image_annotate(image);
           size = image->height * image->stride;
           dst_plane = image->data;
 	  for (i = imrep->depth - 1; i >= 0; --i) {
@@ -358,8 +725,9 @@ xcb_image_get (xcb_connection_t *  conn,
       }
       /* fall through */
   case XCB_IMAGE_FORMAT_Z_PIXMAP:
-      image = xcb_image_create_native(conn, width, height, format,
-				  imrep->depth, imrep, bytes, data);
+      image = xcb_image_create_native(conn, cookie.width, cookie.height,
+				      cookie.format, imrep->depth,
+				      imrep, bytes, data);
       if (!image) {
           free(imrep);
           return 0;
@@ -374,9 +742,377 @@ xcb_image_get (xcb_connection_t *  conn,
 
 
 xcb_image_t *
-xcb_image_native (xcb_connection_t *  c,
+xcb_image_get_finish (xcb_connection_t *      conn,
+		      xcb_image_get_cookie_t  cookie)
+{
+  return image_from_reply(conn, cookie,
+			  xcb_get_image_reply(conn, cookie.cookie, 0));
+}
+
+
+int
+xcb_image_get_poll (xcb_connection_t *      conn,
+		    xcb_image_get_cookie_t  cookie,
+		    xcb_image_t **          image)
+{
+  void *                 reply = 0;
+  xcb_generic_error_t *  error = 0;
+
+  if (!xcb_poll_for_reply(conn, cookie.cookie.sequence, &reply, &error))
+      return 0;
+  free(error);
+  *image = image_from_reply(conn, cookie, reply);
+  return 1;
+}
+
+
+/* The default band size of xcb_image_get_tiled(). */
+#define GET_BAND_BYTES (256 * 1024)
+
+xcb_image_t *
+xcb_image_get_tiled (xcb_connection_t *  conn,
+		     xcb_drawable_t      draw,
+		     int16_t             x,
+		     int16_t             y,
+		     uint16_t            width,
+		     uint16_t            height,
+		     uint32_t            plane_mask,
+		     xcb_image_format_t  format,
+		     uint32_t            band_bytes)
+{
+  xcb_get_image_cookie_t * cookies;
+  xcb_get_image_reply_t *  imrep;
+  xcb_image_t *            image = 0;
+  uint32_t                 row_max;
+  uint32_t                 rows;
+  uint32_t                 bands;
+  uint32_t                 band;
+  uint32_t                 planes = 1;
+  uint32_t                 plane_size = 0;
+  int                      i;
+
+  if (width == 0 || height == 0)
+      return xcb_image_get(conn, draw, x, y, width, height,
+			   plane_mask, format);
+  if (band_bytes == 0)
+      band_bytes = GET_BAND_BYTES;
+  /* The depth, and so the stride, is only known once the
+     first reply is in, so size the bands for the longest
+     scanline any depth can have: 32 planes of bits, or
+     32-bit pixels, padded to 32 bits. */
+  row_max = ((width + 31) >> 5) * 128;
+  rows = band_bytes / row_max;
+  if (rows == 0)
+      rows = 1;
+  if (rows >= height)
+      return xcb_image_get(conn, draw, x, y, width, height,
+			   plane_mask, format);
+  bands = (height + rows - 1) / rows;
+  cookies = malloc(bands * sizeof(*cookies));
+  if (!cookies)
+      return 0;
+  for (band = 0; band < bands; band++) {
+      uint32_t  y0 = band * rows;
+
+      cookies[band] = xcb_get_image(conn, format, draw, x, y + y0, width,
+				    height - y0 < rows ? height - y0 : rows,
+				    plane_mask);
+  }
+  for (band = 0; band < bands; band++) {
+      uint32_t   y0 = band * rows;
+      uint32_t   n = height - y0 < rows ? height - y0 : rows;
+      uint32_t   size;
+      uint8_t *  src;
+      uint8_t *  dst;
+
+      imrep = xcb_get_image_reply(conn, cookies[band], 0);
+      if (!imrep)
+	  break;
+      if (!image) {
+	  image = xcb_image_create_native(conn, width, height, format,
+					  imrep->depth, 0, 0, 0);
+	  if (!image) {
+	      free(imrep);
+	      break;
+	  }
+	  if (format == XCB_IMAGE_FORMAT_XY_PIXMAP) {
+	      plane_mask &= xcb_mask(imrep->depth);
+	      image->plane_mask = plane_mask;
+	      xcb_image_annotate(image);
+	      planes = xcb_popcount(plane_mask);
+	      plane_size = image->height * image->stride;
+	      dst = image->data;
+	      for (i = image->depth - 1; i >= 0; --i) {
+		  if (!(plane_mask & (1u << i)))
+		      memset(dst, 0, plane_size);
+		  dst += plane_size;
+	      }
+	  }
+      }
+      size = n * image->stride;
+      if (imrep->depth != image->depth ||
+	  xcb_get_image_data_length(imrep) != planes * size) {
+	  free(imrep);
+	  break;
+      }
+      /* Each reply holds its rows of every plane asked for,
+	 one plane after the other; copy them straight into
+	 place. */
+      src = xcb_get_image_data(imrep);
+      dst = image->data + y0 * image->stride;
+      if (format == XCB_IMAGE_FORMAT_XY_PIXMAP) {
+	  for (i = image->depth - 1; i >= 0; --i) {
+	      if (plane_mask & (1u << i)) {
+		  memcpy(dst, src, size);
+		  src += size;
+	      }
+	      dst += plane_size;
+	  }
+      } else {
+	  memcpy(dst, src, size);
+      }
+      free(imrep);
+  }
+  if (band < bands) {
+      while (++band < bands)
+	  xcb_discard_reply(conn, cookies[band].sequence);
+      if (image)
+	  xcb_image_destroy(image);
+      image = 0;
+  }
+  free(cookies);
+  return image;
+}
+
+
+/* A copy between two images, cut into rows so that
+ * _xcb_image_parallel can hand bands of them to threads.
+ * Which fields matter depends on the band function.
+ */
+typedef struct {
+  xcb_image_t *              src;
+  xcb_image_t *              dst;
+  uint32_t                   x;
+  uint32_t                   y;
+  uint32_t                   width;
+  const xcb_image_remap_t *  remap;
+  uint32_t                   byteswap;
+  int                        bitswap;
+  int                        nibbleswap;
+  xcb_image_unpack_func_t    unpack;
+  xcb_image_pack_func_t      pack;
+  const xcb_image_dither_t * dither;
+} rows_job_t;
+
+
+static int
+copy_band (void *    closure,
+	   uint32_t  start,
+	   uint32_t  end)
+{
+  rows_job_t *  job = closure;
+  uint32_t *    row;
+  uint32_t      j;
+
+  row = malloc(job->width * sizeof(*row));
+  if (!row)
+      return 0;
+  for (j = start; j < end; j++) {
+      job->unpack(job->src, job->x, job->y + j, job->width, row);
+      if (job->remap)
+	  _xcb_image_remap_row(row, job->width, job->remap);
+      if (job->dither)
+	  _xcb_image_dither_row(row, job->width, j, job->dither);
+      job->pack(job->dst, 0, j, job->width, row);
+  }
+  free(row);
+  return 1;
+}
+
+/* Between images of one layout no pixel values are needed:
+ * a scanline of whole-byte pixels is a memcpy, and one of
+ * smaller pixels, or of an xy plane, a run of bits shifted
+ * into place in the destination scanline.  Bits outside the
+ * block are left as they are, as put_pixel would. */
+static int
+bits_band (void *    closure,
+	   uint32_t  start,
+	   uint32_t  end)
+{
+  rows_job_t *        job = closure;
+  xcb_image_t *       src = job->src;
+  xcb_image_t *       dst = job->dst;
+  xcb_image_format_t  ef = effective_format(src->format, src->bpp);
+  uint32_t            planes = 1;
+  uint32_t            bpp = src->bpp;
+  int                 msb_first;
+  uint32_t            swap = 0;
+  uint32_t            src_x = job->x + src->x_offset;
+  uint32_t            i, j;
+
+  if (ef == XCB_IMAGE_FORMAT_Z_PIXMAP) {
+      /* get_pixel's nibble order. */
+      msb_first = src->byte_order != XCB_IMAGE_ORDER_MSB_FIRST;
+  } else {
+      planes = src->depth;
+      bpp = 1;
+      msb_first = src->bit_order == XCB_IMAGE_ORDER_MSB_FIRST;
+      if (src->byte_order != src->bit_order)
+	  swap = (src->unit >> 3) - 1;
+  }
+  for (i = 0; i < planes; i++) {
+      uint8_t *  src_plane = src->data + i * src->stride * src->height;
+      uint8_t *  dst_plane = dst->data + i * dst->stride * dst->height;
+
+      if (ef != XCB_IMAGE_FORMAT_Z_PIXMAP &&
+	  !((dst->plane_mask >> (planes - 1 - i)) & 1))
+	  continue;
+      for (j = start; j < end; j++) {
+	  const uint8_t *  s = src_plane + (job->y + j) * src->stride;
+	  uint8_t *        d = dst_plane + j * dst->stride;
+
+	  if (bpp >= 8)
+	      memcpy(d + dst->x_offset * (bpp >> 3), s + src_x * (bpp >> 3),
+		     job->width * (bpp >> 3));
+	  else
+	      _xcb_image_copy_bits(s, src_x * bpp, d, dst->x_offset * bpp,
+				   job->width * bpp, msb_first, swap);
+      }
+  }
+  return 1;
+}
+
+/* Whether bits_band can stand in for copy_band.  Planes the
+ * source lacks read as zero, so those must not be wanted. */
+static int
+bits_compatible (xcb_image_t *  src,
+		 xcb_image_t *  dst)
+{
+  xcb_image_format_t  ef = effective_format(src->format, src->bpp);
+
+  if (ef != effective_format(dst->format, dst->bpp) ||
+      src->bpp != dst->bpp || src->depth != dst->depth ||
+      src->byte_order != dst->byte_order)
+      return 0;
+  if (ef == XCB_IMAGE_FORMAT_Z_PIXMAP)
+      return 1;
+  return src->unit == dst->unit && src->bit_order == dst->bit_order &&
+      !(dst->plane_mask & ~src->plane_mask & xcb_mask(src->depth));
+}
+
+/* Copy a width x height block at (x, y) of src to the
+ * origin of dst, a scanline at a time through a buffer of
+ * pixel values, remapping truecolor channels on the way if
+ * remap is non-null.  Returns 0 if the buffer can't be had.
+ */
+static int
+copy_rows (xcb_image_t *              src,
+	   uint32_t                   x,
+	   uint32_t                   y,
+	   xcb_image_t *              dst,
+	   uint32_t                   width,
+	   uint32_t                   height,
+	   const xcb_image_remap_t *  remap)
+{
+  rows_job_t  job = { src, dst, x, y, width, remap, 0, 0, 0, 0, 0, 0 };
+
+  if (width == 0)
+      return 1;
+  if (!remap && bits_compatible(src, dst))
+      return _xcb_image_parallel(height, dst->size, bits_band, &job);
+  job.unpack = _xcb_image_unpacker(src);
+  job.pack = _xcb_image_packer(dst);
+  return _xcb_image_parallel(height, dst->size, copy_band, &job);
+}
+
+
+static int
+convert_remap (xcb_image_t *              src,
+	       xcb_image_t *              dst,
+	       const xcb_image_remap_t *  remap);
+
+
+/* Fill in tmp_image, made by xcb_image_create() without
+ * storage, by converting image into it.  In place, image's
+ * storage is reused when every scanline lands at the same
+ * offset in both layouts, and image then takes over the new
+ * description; otherwise storage is allocated.  tmp_image
+ * is consumed either way.
+ */
+static xcb_image_t *
+native_convert (xcb_image_t *              image,
+		xcb_image_t *              tmp_image,
+		int                        inplace,
+		const xcb_image_remap_t *  remap)
+{
+  xcb_image_format_t  ef = effective_format(image->format, image->bpp);
+  int                 ok;
+
+  if (inplace && image->x_offset == 0 &&
+      ef == effective_format(tmp_image->format, tmp_image->bpp) &&
+      image->stride == tmp_image->stride &&
+      (ef == XCB_IMAGE_FORMAT_XY_PIXMAP || image->bpp == tmp_image->bpp)) {
+      tmp_image->base = image->base;
+      tmp_image->data = image->data;
+      ok = remap ? convert_remap(image, tmp_image, remap) :
+	  xcb_image_convert(image, tmp_image) != 0;
+      if (ok) {
+	  tmp_image->plane_mask = image->plane_mask & tmp_image->plane_mask;
+	  xcb_image_annotate(tmp_image);
+	  *image = *tmp_image;
+      }
+      free(tmp_image);
+      return ok ? image : 0;
+  }
+  tmp_image->base = malloc(tmp_image->size);
+  tmp_image->data = tmp_image->base;
+  if (!tmp_image->data) {
+      free(tmp_image);
+      return 0;
+  }
+  ok = remap ? convert_remap(image, tmp_image, remap) :
+      xcb_image_convert(image, tmp_image) != 0;
+  if (!ok) {
+      xcb_image_destroy(tmp_image);
+      return 0;
+  }
+  return tmp_image;
+}
+
+
+static xcb_image_t *
+native_truecolor (xcb_connection_t *  c,
 		  xcb_image_t *       image,
-		  int                 convert)
+		  int                 inplace)
+{
+  const xcb_setup_t *  setup = xcb_get_setup(c);
+  xcb_visualtype_t *   visual;
+  xcb_image_t *        tmp_image;
+  xcb_image_remap_t    remap;
+  uint32_t             src_masks[4];
+  uint32_t             dst_masks[4];
+  uint8_t              depth;
+
+  if (!truecolor_masks(image->depth, src_masks))
+      return 0;
+  visual = find_truecolor_visual(setup, &depth);
+  if (!visual)
+      return 0;
+  visual_masks(visual, depth, dst_masks);
+  tmp_image = xcb_image_create_native(c, image->width, image->height,
+				      image->format, depth, 0, ~0, 0);
+  if (!tmp_image)
+      return 0;
+  _xcb_image_remap_init(&remap, src_masks, dst_masks);
+  return native_convert(image, tmp_image, inplace, &remap);
+}
+
+
+static xcb_image_t *
+native_image (xcb_connection_t *  c,
+	      xcb_image_t *       image,
+	      int                 convert,
+	      int                 inplace)
 {
   xcb_image_t *        tmp_image = 0;
   const xcb_setup_t *  setup = xcb_get_setup(c);
@@ -386,10 +1122,13 @@ xcb_image_native (xcb_connection_t *  c,
 
   if (image->depth > 1 || ef == XCB_IMAGE_FORMAT_Z_PIXMAP) {
       fmt = find_format_by_depth(setup, image->depth);
-      /* XXX For now, we don't do depth conversions, even
-	 for xy-pixmaps */
-      if (!fmt)
-	  return 0;
+      /* The server has no such depth: truecolor images
+	 can still be converted to one it does have. */
+      if (!fmt) {
+	  if (!convert)
+	      return 0;
+	  return native_truecolor(c, image, inplace);
+      }
       bpp = fmt->bits_per_pixel;
   }
   switch (ef) {
@@ -408,7 +1147,7 @@ xcb_image_native (xcb_connection_t *  c,
 			       setup->bitmap_format_scanline_unit,
 			       setup->image_byte_order,
 			       setup->bitmap_format_bit_order,
-			       0, 0, 0);
+			       0, ~0, 0);
 	  if (!tmp_image)
 	      return 0;
       }
@@ -425,7 +1164,7 @@ xcb_image_native (xcb_connection_t *  c,
 			       image->depth, bpp, 0,
 			       setup->image_byte_order,
 			       XCB_IMAGE_ORDER_MSB_FIRST,
-			       0, 0, 0);
+			       0, ~0, 0);
 	  if (!tmp_image)
 	      return 0;
       }
@@ -433,17 +1172,297 @@ xcb_image_native (xcb_connection_t *  c,
   default:
       assert(0);
   }
-  if (tmp_image) {
-      if (!xcb_image_convert(image, tmp_image)) {
-	  xcb_image_destroy(tmp_image);
-	  return 0;
-      }
-      image = tmp_image;
+  if (tmp_image)
+      return native_convert(image, tmp_image, inplace, 0);
+  return image;
+}
+
+
+xcb_image_t *
+xcb_image_native (xcb_connection_t *  c,
+		  xcb_image_t *       image,
+		  int                 convert)
+{
+  return native_image(c, image, convert, 0);
+}
+
+
+xcb_image_t *
+xcb_image_native_inplace (xcb_connection_t *  c,
+			  xcb_image_t *       image)
+{
+  return native_image(c, image, 1, 1);
+}
+
+
+xcb_image_t *
+xcb_image_create_from_rgba (xcb_connection_t *        c,
+			    const xcb_visualtype_t *  visual,
+			    uint16_t                  width,
+			    uint16_t                  height,
+			    xcb_image_rgba_order_t    order,
+			    const uint8_t *           pixels,
+			    uint32_t                  stride)
+{
+  xcb_image_t *      src;
+  xcb_image_t *      image;
+  xcb_image_remap_t  remap;
+  uint32_t           src_masks[4];
+  uint32_t           dst_masks[4];
+  uint8_t            depth;
+
+  if (!truecolor_class(visual->_class))
+      return 0;
+  depth = find_visual_depth(xcb_get_setup(c), visual->visual_id);
+  if (!depth)
+      return 0;
+  if (stride == 0)
+      stride = (uint32_t) width << 2;
+  if (stride < ((uint32_t) width << 2))
+      return 0;
+
+  /* The buffer, described as an LSB first 32 bpp image. */
+  src = xcb_image_create(width, height, XCB_IMAGE_FORMAT_Z_PIXMAP, 32,
+			 32, 32, 32, XCB_IMAGE_ORDER_LSB_FIRST,
+			 XCB_IMAGE_ORDER_LSB_FIRST, 0, ~0, 0);
+  if (!src)
+      return 0;
+  src->stride = stride;
+  src->size = stride * height;
+  src->data = (uint8_t *) pixels;	/* only read */
+
+  image = xcb_image_create_native(c, width, height, XCB_IMAGE_FORMAT_Z_PIXMAP,
+				  depth, 0, 0, 0);
+  if (!image) {
+      xcb_image_destroy(src);
+      return 0;
+  }
+  src_masks[0] = order == XCB_IMAGE_RGBA_ORDER_RGBA ? 0x000000ff : 0x00ff0000;
+  src_masks[1] = 0x0000ff00;
+  src_masks[2] = order == XCB_IMAGE_RGBA_ORDER_RGBA ? 0x00ff0000 : 0x000000ff;
+  src_masks[3] = 0xff000000;
+  visual_masks(visual, depth, dst_masks);
+  _xcb_image_remap_init(&remap, src_masks, dst_masks);
+  if (!convert_remap(src, image, &remap)) {
+      xcb_image_destroy(image);
+      image = 0;
   }
+  xcb_image_destroy(src);
   return image;
 }
 
 
+/* Data iovecs per PutImage request, which keeps well under
+ * IOV_MAX however many scanlines a rectangle has. */
+#define PUT_RECT_IOVECS 256
+
+/* Image data per PutImage request.  Below the connection's
+ * maximum request length, bands this size keep the server
+ * busy drawing one while the next is still being written. */
+#define PUT_BAND_BYTES (256 * 1024)
+
+/* The most image data to send in one PutImage when there
+ * are bytes in all.  The BIG-REQUESTS maximum is only asked
+ * for when the core one is too small, as asking may cost a
+ * round trip.
+ */
+static uint32_t
+put_band_bytes (xcb_connection_t *  conn,
+		uint64_t            bytes)
+{
+  const xcb_setup_t *  setup = xcb_get_setup(conn);
+  uint64_t             max;
+
+  /* No setup, or a zero maximum, if the connection has
+     failed; then nothing gets sent anyway. */
+  if (!setup)
+      return PUT_BAND_BYTES;
+  if (bytes > PUT_BAND_BYTES)
+      bytes = PUT_BAND_BYTES;
+  max = (uint64_t) setup->maximum_request_length << 2;
+  if (max < bytes + sizeof(xcb_put_image_request_t))
+      max = (uint64_t) xcb_get_maximum_request_length(conn) << 2;
+  if (max == 0 || max > PUT_BAND_BYTES + sizeof(xcb_put_image_request_t))
+      return PUT_BAND_BYTES;
+  return max - sizeof(xcb_put_image_request_t);
+}
+
+static const uint8_t zero_pad[4];
+
+/* Send one PutImage of rows [y, y + height) of a rectangle
+ * starting start bytes into the scanlines of image, rows
+ * being row_len bytes long once padded and holding bytes of
+ * image data.  A non-null stage holds the rows already
+ * packed instead.  Each scanline goes out as its own iovec,
+ * followed by zero pad bytes where it would otherwise run
+ * off the end of an image scanline, unless the rows are
+ * whole scanlines and can go out a plane at a time. */
+static xcb_void_cookie_t
+put_rect_request (xcb_connection_t *        conn,
+		  xcb_put_image_request_t * req,
+		  xcb_image_t *             image,
+		  uint32_t                  start,
+		  uint32_t                  y,
+		  uint32_t                  height,
+		  uint32_t                  row_len,
+		  uint32_t                  bytes,
+		  uint32_t                  planes,
+		  const uint8_t *           stage)
+{
+  static const xcb_protocol_request_t  put_image = {
+      0, 0, XCB_PUT_IMAGE, 1
+  };
+  xcb_protocol_request_t  proto = put_image;
+  struct iovec            iov[PUT_RECT_IOVECS + 4];
+  struct iovec *          v = iov + 2;
+  xcb_void_cookie_t       cookie;
+  uint32_t                len = 0;
+  uint32_t                p, r;
+
+  req->height = height;
+  v->iov_base = (char *) req;
+  v++->iov_len = sizeof(*req);
+  if (stage) {
+      len = row_len * height * planes;
+      v->iov_base = (char *) stage;
+      v++->iov_len = len;
+  } else if (start == 0 && row_len == image->stride) {
+      for (p = 0; p < planes; p++) {
+	  v->iov_base = (char *) image->data +
+	      (p * image->height + y) * image->stride;
+	  v++->iov_len = row_len * height;
+      }
+      len = row_len * height * planes;
+  } else {
+      for (p = 0; p < planes; p++)
+	  for (r = 0; r < height; r++) {
+	      uint32_t  n = row_len;
+
+	      if (start + n > image->stride)
+		  n = bytes;
+	      v->iov_base = (char *) image->data + start +
+		  (p * image->height + y + r) * image->stride;
+	      v++->iov_len = n;
+	      if (n < row_len) {
+		  v->iov_base = (char *) zero_pad;
+		  v++->iov_len = row_len - n;
+	      }
+	      len += row_len;
+	  }
+  }
+  v->iov_base = (char *) zero_pad;
+  v++->iov_len = -len & 3;
+  proto.count = v - (iov + 2);
+  cookie.sequence = xcb_send_request(conn, 0, iov + 2, &proto);
+  return cookie;
+}
+
+xcb_void_cookie_t
+xcb_image_put_rect (xcb_connection_t *  conn,
+		    xcb_drawable_t      draw,
+		    xcb_gcontext_t      gc,
+		    xcb_image_t *       image,
+		    uint32_t            x,
+		    uint32_t            y,
+		    uint32_t            width,
+		    uint32_t            height,
+		    int16_t             dst_x,
+		    int16_t             dst_y)
+{
+  xcb_image_format_t       ef = effective_format(image->format, image->bpp);
+  xcb_put_image_request_t  req;
+  xcb_void_cookie_t        cookie = { 0 };
+  uint32_t                 bits = pixel_bits(image);
+  uint32_t                 pad = image->scanline_pad;
+  uint32_t                 first, left_pad, start, row_len, bytes;
+  uint32_t                 planes = 1;
+  uint32_t                 rows, max_rows, r;
+  int                      staged;
+  uint8_t *                stage = 0;
+
+  if (!span_inside(image, x, y, width, height))
+      return cookie;
+  if (width == 0 || height == 0)
+      return cookie;
+  memset(&req, 0, sizeof(req));
+  req.format = image->format;
+  req.drawable = draw;
+  req.gc = gc;
+  req.width = width;
+  req.dst_x = dst_x;
+  req.dst_y = dst_y;
+  req.depth = image->depth;
+
+  /* Scanlines start at the pad unit holding the first pixel
+     of an xy image, the rest going in the left pad; a depth
+     1 z-pixmap is laid out the same way but must be sent as
+     an xy-pixmap to have a left pad.  A 4 bpp z-pixmap
+     starting mid-byte has to be repacked. */
+  first = (image->x_offset + x) * bits;
+  if (ef == XCB_IMAGE_FORMAT_XY_PIXMAP) {
+      planes = image->depth;
+      left_pad = first % pad;
+      if (left_pad && req.format == XCB_IMAGE_FORMAT_Z_PIXMAP)
+	  req.format = XCB_IMAGE_FORMAT_XY_PIXMAP;
+  } else {
+      left_pad = first & 7;
+  }
+  start = (first - left_pad) >> 3;
+  row_len = xcb_roundup(left_pad + width * bits, pad) >> 3;
+  bytes = (left_pad + width * bits + 7) >> 3;
+  staged = ef == XCB_IMAGE_FORMAT_Z_PIXMAP && left_pad;
+  if (staged)
+      row_len = xcb_roundup(width * bits, pad) >> 3;
+  else
+      req.left_pad = left_pad;
+
+  /* Bands of rows, every plane of them in one request,
+     within the request size and the iovec budget.  A row
+     too long for any request is sent in two halves. */
+  max_rows = put_band_bytes(conn, (uint64_t) row_len * planes * height) /
+      (row_len * planes);
+  if (max_rows == 0) {
+      uint32_t  half = width >> 1;
+
+      if (half == 0)
+	  return cookie;
+      xcb_image_put_rect(conn, draw, gc, image, x, y, half, height,
+			 dst_x, dst_y);
+      return xcb_image_put_rect(conn, draw, gc, image, x + half, y,
+				width - half, height, dst_x + half, dst_y);
+  }
+  rows = PUT_RECT_IOVECS / (2 * planes);
+  if (staged || (start == 0 && row_len == image->stride))
+      rows = height;
+  if (rows > max_rows)
+      rows = max_rows;
+  if (staged) {
+      stage = calloc(row_len, rows < height ? rows : height);
+      if (!stage)
+	  return cookie;
+  }
+
+  for (r = 0; r < height; r += rows) {
+      uint32_t  n = height - r < rows ? height - r : rows;
+
+      if (stage) {
+	  uint32_t  i;
+
+	  for (i = 0; i < n; i++)
+	      _xcb_image_copy_bits(image->data + (y + r + i) * image->stride,
+				   first, stage + i * row_len, 0,
+				   width * bits,
+				   image->byte_order != XCB_IMAGE_ORDER_MSB_FIRST,
+				   0);
+      }
+      req.dst_y = dst_y + r;
+      cookie = put_rect_request(conn, &req, image, start, y + r, n,
+				row_len, bytes, planes, stage);
+  }
+  free(stage);
+  return cookie;
+}
+
 xcb_void_cookie_t
 xcb_image_put (xcb_connection_t *  conn,
 	       xcb_drawable_t      draw,
@@ -453,12 +1472,28 @@ xcb_image_put (xcb_connection_t *  conn,
 	       int16_t             y,
 	       uint8_t             left_pad)
 {
-  return xcb_put_image(conn, image->format, draw, gc,
-		       image->width, image->height,
-		       x, y, left_pad,
-		       image->depth,
-		       image->size,
-		       image->data);
+  xcb_image_t        view;
+  xcb_void_cookie_t  cookie = { 0 };
+
+  if (left_pad == 0 && image_packed(image) &&
+      image->size <= put_band_bytes(conn, image->size))
+      return xcb_put_image(conn, image->format, draw, gc,
+			   image->width, image->height,
+			   x, y, 0,
+			   image->depth,
+			   image->size,
+			   image->data);
+  /* A view, whose scanlines run on into its parent's, an
+     image too big for one request, or one with pixels to
+     skip, which xcb_image_put_rect() skips the same way
+     however the image is cut up. */
+  if (((uint64_t) image->x_offset + left_pad + image->width) *
+      pixel_bits(image) > (uint64_t) image->stride * 8)
+      return cookie;
+  view = *image;
+  view.x_offset += left_pad;
+  return xcb_image_put_rect(conn, draw, gc, &view,
+			    0, 0, image->width, image->height, x, y);
 }
 
 
@@ -481,13 +1516,19 @@ xcb_image_shm_put (xcb_connection_t *      conn,
 		   uint16_t                src_height,
 		   uint8_t                 send_event)
 {
+  uint32_t  total_width = image->width;
+
   if (!xcb_image_native(conn, image, 0))
       return 0;
   if (!shminfo.shmaddr)
       return 0;
+  /* A view is a rectangle of its parent's scanlines: give
+     the server a width that pads out to the same stride. */
+  if (!image_packed(image))
+      total_width = image->stride * 8 / pixel_bits(image);
   xcb_shm_put_image(conn, draw, gc,
-		    image->width, image->height,
-		    src_x, src_y, src_width, src_height,
+		    total_width, image->height,
+		    src_x + image->x_offset, src_y, src_width, src_height,
 		    dest_x, dest_y,
 		    image->depth, image->format,
 		    send_event, 
@@ -573,6 +1614,7 @@ xcb_image_put_pixel (xcb_image_t *image,
   if (x > image->width || y > image->height)
       return;
   row = image->data + (y * image->stride);
+  x += image->x_offset;
   switch (effective_format(image->format, image->bpp)) {
   case XCB_IMAGE_FORMAT_XY_BITMAP:
   case XCB_IMAGE_FORMAT_XY_PIXMAP:
@@ -584,7 +1626,7 @@ xcb_image_put_pixel (xcb_image_t *image,
 	  uint32_t   bit = xy_image_bit(image,x);
 	  uint8_t    mask = 1 << bit;
 
-	  for (p = image->bpp - 1; p >= 0; p--) {
+	  for (p = image->depth - 1; p >= 0; p--) {
 	      if ((plane_mask >> p) & 1) {
 		  uint8_t *  bp = plane + byte;
 		  uint8_t    this_bit = ((pixel >> p) & 1) << bit;
@@ -675,6 +1717,7 @@ xcb_image_get_pixel (xcb_image_t *image,
 
   assert(x < image->width && y < image->height);
   row = image->data + (y * image->stride);
+  x += image->x_offset;
   switch (effective_format(image->format, image->bpp)) {
   case XCB_IMAGE_FORMAT_XY_BITMAP:
   case XCB_IMAGE_FORMAT_XY_PIXMAP:
@@ -685,7 +1728,7 @@ xcb_image_get_pixel (xcb_image_t *image,
 	  uint32_t   byte = xy_image_byte(image, x);
 	  uint32_t   bit = xy_image_bit(image,x);
 
-	  for (p = image->bpp - 1; p >= 0; p--) {
+	  for (p = image->depth - 1; p >= 0; p--) {
 	      pixel <<= 1;
 	      if ((plane_mask >> p) & 1) {
 		  uint8_t *  bp = plane + byte;
@@ -755,6 +1798,65 @@ xcb_image_get_pixel (xcb_image_t *image,
   return 0;
 }
 
+void
+xcb_image_get_row (xcb_image_t *  image,
+		   uint32_t       x,
+		   uint32_t       y,
+		   uint32_t       width,
+		   uint32_t *     pixels)
+{
+  xcb_image_get_rows(image, x, y, width, 1, pixels, width);
+}
+
+void
+xcb_image_put_row (xcb_image_t *     image,
+		   uint32_t          x,
+		   uint32_t          y,
+		   uint32_t          width,
+		   const uint32_t *  pixels)
+{
+  xcb_image_put_rows(image, x, y, width, 1, pixels, width);
+}
+
+void
+xcb_image_get_rows (xcb_image_t *  image,
+		    uint32_t       x,
+		    uint32_t       y,
+		    uint32_t       width,
+		    uint32_t       height,
+		    uint32_t *     pixels,
+		    uint32_t       pitch)
+{
+  xcb_image_unpack_func_t  unpack;
+  uint32_t                 i;
+
+  assert(span_inside(image, x, y, width, height));
+  if (!width)
+      return;
+  unpack = _xcb_image_unpacker(image);
+  for (i = 0; i < height; i++, pixels += pitch)
+      unpack(image, x, y + i, width, pixels);
+}
+
+void
+xcb_image_put_rows (xcb_image_t *     image,
+		    uint32_t          x,
+		    uint32_t          y,
+		    uint32_t          width,
+		    uint32_t          height,
+		    const uint32_t *  pixels,
+		    uint32_t          pitch)
+{
+  xcb_image_pack_func_t  pack;
+  uint32_t               i;
+
+  if (!span_inside(image, x, y, width, height) || !width)
+      return;
+  pack = _xcb_image_packer(image);
+  for (i = 0; i < height; i++, pixels += pitch)
+      pack(image, x, y + i, width, pixels);
+}
+
 
 xcb_image_t *
 xcb_image_create_from_bitmap_data (uint8_t *           data,
@@ -831,7 +1933,45 @@ xcb_create_pixmap_from_bitmap_data (xcb_connection_t *  display,
 }
 
 
-/* Thanks to Keith Packard <keithp@keithp.com> for this code */
+/* Thanks to Keith Packard <keithp@keithp.com> for this code.
+ * This is the reference version of the swap; swap_image()
+ * below hands all whole swap groups to a vectorized kernel
+ * and uses this only for what's left at the end of a row. */
+static void
+swap_bytes(uint8_t *	     src,
+	   uint32_t 	     src_stride,
+	   uint8_t *	     dst,
+	   uint32_t 	     dst_stride,
+	   uint32_t	     start,
+	   uint32_t	     byteswap,
+	   int		     bitswap,
+	   int               nibbleswap)
+{
+  uint8_t     tail[4];
+  uint32_t    s;
+
+  /* In place, what's left is less than one swap group;
+     read it from a copy so no byte is overwritten first. */
+  if (src == dst) {
+      assert(src_stride - start <= sizeof(tail));
+      memcpy(tail, src + start, src_stride - start);
+  }
+  for (s = start; s < src_stride; s++) {
+      uint8_t   b;
+      uint32_t  d = s ^ byteswap;
+
+      if (d >= dst_stride)
+	  continue;
+
+      b = src == dst ? tail[s - start] : src[s];
+      if (bitswap)
+	  b = _xcb_image_bit_reverse_table[b];
+      if (nibbleswap)
+	  b = (b << 4) | (b >> 4);
+      dst[d] = b;
+  }
+}
+
 static void 
 swap_image(uint8_t *	     src,
            uint32_t 	     src_stride,
@@ -842,26 +1982,137 @@ swap_image(uint8_t *	     src,
 	   int		     bitswap,
 	   int               nibbleswap)
 {
+  uint32_t  group = byteswap > 1 ? 4 : byteswap + 1;
+  uint32_t  bytes = src_stride < dst_stride ? src_stride : dst_stride;
+
+  bytes = xcb_rounddown_2(bytes, group);
   while (height--) {
-      uint32_t    s;
+      _xcb_image_swap_row(src, dst, bytes, byteswap, bitswap, nibbleswap);
+      swap_bytes(src, src_stride, dst, dst_stride, bytes,
+		 byteswap, bitswap, nibbleswap);
+      src += src_stride;
+      dst += dst_stride;
+  }
+}
 
-      for (s = 0; s < src_stride; s++) {
-	  uint8_t   b;
-	  uint32_t  d = s ^ byteswap;
+/* Bands of the convert cases below.  For the copies and
+ * swaps, rows are scanlines of image data, so an XY image
+ * has height times depth of them. */
+static int
+memcpy_band (void *    closure,
+	     uint32_t  start,
+	     uint32_t  end)
+{
+  rows_job_t *  job = closure;
+  uint32_t      stride = job->src->stride;
 
-	  if (d > dst_stride)
-	      continue;
+  memcpy(job->dst->data + start * stride, job->src->data + start * stride,
+	 (end - start) * stride);
+  return 1;
+}
 
-	  b = src[s];
-	  if (bitswap)
-	      b = xcb_bit_reverse(b, 8);
-	  if (nibbleswap)
-	      b = (b << 4) | (b >> 4);
-	  dst[d] = b;
-      }
-      src += src_stride;
-      dst += dst_stride;
+/* Same layout but for the scanline pad: copy what both
+   scanlines have room for, which includes every pixel. */
+static int
+row_copy_band (void *    closure,
+	       uint32_t  start,
+	       uint32_t  end)
+{
+  rows_job_t *  job = closure;
+  uint32_t      src_stride = job->src->stride;
+  uint32_t      dst_stride = job->dst->stride;
+  uint32_t      bytes = src_stride < dst_stride ? src_stride : dst_stride;
+  uint32_t      y;
+
+  for (y = start; y < end; y++)
+      memcpy(job->dst->data + y * dst_stride,
+	     job->src->data + y * src_stride, bytes);
+  return 1;
+}
+
+static int
+swap_band (void *    closure,
+	   uint32_t  start,
+	   uint32_t  end)
+{
+  rows_job_t *  job = closure;
+
+  swap_image(job->src->data + start * job->src->stride, job->src->stride,
+	     job->dst->data + start * job->dst->stride, job->dst->stride,
+	     end - start, job->byteswap, job->bitswap, job->nibbleswap);
+  return 1;
+}
+
+/* The first pixel of a scanline of a z image of whole-byte
+   pixels, whether or not it is a view. */
+static uint8_t *
+scanline (xcb_image_t *  image,
+	  uint32_t       y)
+{
+  return image->data + y * image->stride +
+      image->x_offset * (image->bpp >> 3);
+}
+
+static int
+z24_swap_band (void *    closure,
+	       uint32_t  start,
+	       uint32_t  end)
+{
+  rows_job_t *  job = closure;
+  uint8_t *     s = scanline(job->src, start);
+  uint8_t *     d = scanline(job->dst, start);
+  uint32_t      y;
+
+  for (y = start; y < end; y++) {
+      _xcb_image_z24_swap(s, d, job->width);
+      s += job->src->stride;
+      d += job->dst->stride;
   }
+  return 1;
+}
+
+static int
+z24_z32_band (void *    closure,
+	      uint32_t  start,
+	      uint32_t  end)
+{
+  rows_job_t *   job = closure;
+  xcb_image_t *  src = job->src;
+  xcb_image_t *  dst = job->dst;
+  uint8_t *      s = scanline(src, start);
+  uint8_t *      d = scanline(dst, start);
+  uint32_t       y;
+
+  for (y = start; y < end; y++) {
+      if (src->bpp == 24)
+	  _xcb_image_z24_to_z32(s, src->byte_order,
+				d, dst->byte_order, job->width);
+      else
+	  _xcb_image_z32_to_z24(s, src->byte_order,
+				d, dst->byte_order, job->width);
+      s += src->stride;
+      d += dst->stride;
+  }
+  return 1;
+}
+
+static int
+remap_z32_band (void *    closure,
+		uint32_t  start,
+		uint32_t  end)
+{
+  rows_job_t *  job = closure;
+  uint8_t *     s = scanline(job->src, start);
+  uint8_t *     d = scanline(job->dst, start);
+  uint32_t      y;
+
+  for (y = start; y < end; y++) {
+      _xcb_image_remap_z32(s, job->src->byte_order, d, job->dst->byte_order,
+			   job->width, job->remap);
+      s += job->src->stride;
+      d += job->dst->stride;
+  }
+  return 1;
 }
 
 /* Which order are bytes in (low two bits), given
@@ -916,11 +2167,69 @@ conversion_byte_swap(xcb_image_t *src, xcb_image_t *dst)
     }
 }
 
-xcb_image_t *
-xcb_image_convert (xcb_image_t *  src,
-		   xcb_image_t *  dst)
+/* Pixel values can't just be copied between a deep color
+   (depth 30) image and another truecolor depth: the
+   channels have to be rescaled. */
+static int
+deep_color_remap (xcb_image_t *        src,
+		  xcb_image_t *        dst,
+		  xcb_image_remap_t *  remap)
+{
+  uint32_t  src_masks[4];
+  uint32_t  dst_masks[4];
+
+  if (src->depth == dst->depth ||
+      (src->depth != 30 && dst->depth != 30))
+      return 0;
+  if (!truecolor_masks(src->depth, src_masks) ||
+      !truecolor_masks(dst->depth, dst_masks))
+      return 0;
+  _xcb_image_remap_init(remap, src_masks, dst_masks);
+  return 1;
+}
+
+struct xcb_image_convert_plan_t {
+  xcb_image_convert_path_t  path;
+  xcb_image_band_func_t     band;
+  uint32_t                  rows;
+  rows_job_t                job;	/* images are filled in per run */
+  xcb_image_remap_t         remap;
+  xcb_image_t               src;	/* the layouts planned for */
+  xcb_image_t               dst;
+  int                       keep_pad;	/* dst pad must be kept */
+};
+
+static int
+same_layout (const xcb_image_t *  a,
+	     const xcb_image_t *  b)
+{
+  return a->width == b->width &&
+      a->height == b->height &&
+      a->format == b->format &&
+      a->scanline_pad == b->scanline_pad &&
+      a->depth == b->depth &&
+      a->bpp == b->bpp &&
+      a->unit == b->unit &&
+      a->byte_order == b->byte_order &&
+      a->bit_order == b->bit_order &&
+      a->stride == b->stride &&
+      a->plane_mask == b->plane_mask &&
+      !a->x_offset == !b->x_offset;
+}
+
+/* Work out how to convert src to dst, and which band
+ * function does it.  A non-null remap rescales truecolor
+ * channels on the way; otherwise pixel values are copied,
+ * except between deep color and other truecolor depths.
+ */
+static int
+plan_init (xcb_image_convert_plan_t *  plan,
+	   xcb_image_t *               src,
+	   xcb_image_t *               dst,
+	   const xcb_image_remap_t *   remap)
 {
   xcb_image_format_t  ef = effective_format(src->format, src->bpp);
+  xcb_image_format_t  dst_ef = effective_format(dst->format, dst->bpp);
 
   /* Things will go horribly wrong here if a bad
      image is passed in, so we check some things
@@ -935,46 +2244,214 @@ xcb_image_convert (xcb_image_t *  src,
       src->height != dst->height)
       return 0;
 
-  if (ef == effective_format(dst->format, dst->bpp) &&
-      src->bpp == dst->bpp)
-  {
-    if (src->unit == dst->unit &&
-	src->scanline_pad == dst->scanline_pad &&
-	src->byte_order == dst->byte_order &&
-	(ef == XCB_IMAGE_FORMAT_Z_PIXMAP ||
-	 src->bit_order == dst->bit_order)) {
-      memcpy(dst->data, src->data, src->size);
-    } else {
-      int	bitswap = 0;
-      int	nibbleswap = 0;
-      uint32_t	byteswap = conversion_byte_swap(src, dst);
-      uint32_t	height = src->height;;
-
+  memset(plan, 0, sizeof(*plan));
+  plan->src = *src;
+  plan->dst = *dst;
+  plan->rows = src->height;
+  plan->job.width = src->width;
+  plan->keep_pad = keep_scanline_pad(dst);
+  if (remap)
+      plan->remap = *remap;
+  else if (deep_color_remap(src, dst, &plan->remap))
+      remap = &plan->remap;
+
+  if (remap) {
+      plan->job.remap = &plan->remap;
+      if (ef == XCB_IMAGE_FORMAT_Z_PIXMAP && dst_ef == ef &&
+	  src->bpp == 32 && dst->bpp == 32) {
+	  plan->path = XCB_IMAGE_CONVERT_PATH_REMAP;
+	  plan->band = remap_z32_band;
+	  return 1;
+      }
+  } else if (ef == dst_ef && src->bpp == dst->bpp) {
+      plan->job.byteswap = conversion_byte_swap(src, dst);
       if (ef == XCB_IMAGE_FORMAT_Z_PIXMAP) {
-	if (src->bpp == 4 && src->byte_order != dst->byte_order)
-	  nibbleswap = 1;
+	  if (src->bpp == 24 && src->byte_order != dst->byte_order) {
+	      /* Three-byte pixels can't be swapped by flipping
+		 index bits; reverse each pixel instead. */
+	      plan->path = XCB_IMAGE_CONVERT_PATH_SWAP;
+	      plan->band = z24_swap_band;
+	      return 1;
+	  }
+	  if (src->bpp == 4 && src->byte_order != dst->byte_order)
+	      plan->job.nibbleswap = 1;
       } else {
-	if (src->bit_order != dst->bit_order)
-	  bitswap = 1;
-	height *= src->depth;
+	  if (src->bit_order != dst->bit_order)
+	      plan->job.bitswap = 1;
+	  plan->rows *= src->depth;
       }
-      swap_image (src->data, src->stride, dst->data, dst->stride,
-		  height, byteswap, bitswap, nibbleswap);
-    }
+      if (!image_packed(src) || !image_packed(dst) || plan->keep_pad) {
+	  /* A view shares its scanlines with pixels outside
+	     it, so only its own pixels may be touched. */
+	  plan->rows = src->height;
+	  if (!plan->job.byteswap && !plan->job.bitswap &&
+	      !plan->job.nibbleswap && bits_compatible(src, dst)) {
+	      plan->path = XCB_IMAGE_CONVERT_PATH_ROW_COPY;
+	      plan->band = bits_band;
+	      return 1;
+	  }
+      } else {
+	  if (plan->job.byteswap || plan->job.bitswap ||
+	      plan->job.nibbleswap) {
+	      plan->path = XCB_IMAGE_CONVERT_PATH_SWAP;
+	      plan->band = swap_band;
+	  } else if (src->stride == dst->stride) {
+	      plan->path = XCB_IMAGE_CONVERT_PATH_COPY;
+	      plan->band = memcpy_band;
+	  } else {
+	      plan->path = XCB_IMAGE_CONVERT_PATH_ROW_COPY;
+	      plan->band = row_copy_band;
+	  }
+	  return 1;
+      }
+  } else if (ef == XCB_IMAGE_FORMAT_Z_PIXMAP && dst_ef == ef &&
+	     ((src->bpp == 24 && dst->bpp == 32) ||
+	      (src->bpp == 32 && dst->bpp == 24))) {
+      /* Z24<->Z32 of either endianness: scanline kernels */
+      plan->path = XCB_IMAGE_CONVERT_PATH_Z24_Z32;
+      plan->band = z24_z32_band;
+      return 1;
   }
-  else
-  {
-    uint32_t            x;
-    uint32_t            y;
-    /* General case: Slow pixel copy. Should we optimize
-       Z24<->Z32 copies of either endianness? */
-    for (y = 0; y < src->height; y++) {
-	for (x = 0; x < src->width; x++) {
-	    uint32_t  pixel = xcb_image_get_pixel(src, x, y);
-	    xcb_image_put_pixel(dst, x, y, pixel);
-	}
-    }
+  /* General case: unpack each scanline to pixel values
+     and pack it back in the destination layout. */
+  plan->path = XCB_IMAGE_CONVERT_PATH_GENERAL;
+  plan->band = copy_band;
+  plan->job.unpack = _xcb_image_unpacker(src);
+  plan->job.pack = _xcb_image_packer(dst);
+  return 1;
+}
+
+static xcb_image_t *
+plan_run (const xcb_image_convert_plan_t *  plan,
+	  xcb_image_t *                     src,
+	  xcb_image_t *                     dst)
+{
+  rows_job_t  job = plan->job;
+
+  if (src->width == 0)
+      return dst;
+  job.src = src;
+  job.dst = dst;
+  if (!_xcb_image_parallel(plan->rows, dst->size, plan->band, &job))
+      return 0;
+  return dst;
+}
+
+/* Copy src to dst, remapping truecolor channels. */
+static int
+convert_remap (xcb_image_t *              src,
+	       xcb_image_t *              dst,
+	       const xcb_image_remap_t *  remap)
+{
+  xcb_image_convert_plan_t  plan;
+
+  if (!plan_init(&plan, src, dst, remap))
+      return 0;
+  return plan_run(&plan, src, dst) != 0;
+}
+
+xcb_image_t *
+xcb_image_convert (xcb_image_t *  src,
+		   xcb_image_t *  dst)
+{
+  xcb_image_convert_plan_t  plan;
+
+  if (!plan_init(&plan, src, dst, 0))
+      return 0;
+  return plan_run(&plan, src, dst);
+}
+
+xcb_image_convert_plan_t *
+xcb_image_convert_plan_create (xcb_image_t *  src,
+			       xcb_image_t *  dst)
+{
+  xcb_image_convert_plan_t *  plan = malloc(sizeof(*plan));
+
+  if (!plan)
+      return 0;
+  if (!plan_init(plan, src, dst, 0)) {
+      free(plan);
+      return 0;
+  }
+  plan->src.base = plan->src.data = 0;
+  plan->dst.base = plan->dst.data = 0;
+  return plan;
+}
+
+xcb_image_convert_path_t
+xcb_image_convert_plan_path (const xcb_image_convert_plan_t *  plan)
+{
+  return plan->path;
+}
+
+xcb_image_t *
+xcb_image_convert_plan_run (const xcb_image_convert_plan_t *  plan,
+			    xcb_image_t *                     src,
+			    xcb_image_t *                     dst)
+{
+  if (!same_layout(src, &plan->src) || !same_layout(dst, &plan->dst))
+      return 0;
+  if (keep_scanline_pad(dst) && !plan->keep_pad)
+      return 0;
+  return plan_run(plan, src, dst);
+}
+
+void
+xcb_image_convert_plan_destroy (xcb_image_convert_plan_t *  plan)
+{
+  free(plan);
+}
+
+xcb_image_t *
+xcb_image_convert_alpha (xcb_image_t *         src,
+			 xcb_image_t *         dst,
+			 xcb_image_alpha_op_t  op)
+{
+  xcb_image_remap_t  remap;
+  uint32_t           masks[4];
+
+  if (src->depth != 32 || dst->depth != 32)
+      return 0;
+  truecolor_masks(32, masks);
+  _xcb_image_remap_init(&remap, masks, masks);
+  remap.alpha = op;
+  return convert_remap(src, dst, &remap) ? dst : 0;
+}
+
+xcb_image_t *
+xcb_image_dither (xcb_image_t *             src,
+		  xcb_image_t *             dst,
+		  const xcb_visualtype_t *  visual)
+{
+  xcb_image_dither_t  dither;
+  uint32_t            masks[4];
+  rows_job_t          job;
+
+  assert(image_format_valid(src));
+  assert(image_format_valid(dst));
+  if (src->width != dst->width ||
+      src->height != dst->height)
+      return 0;
+  if (effective_format(src->format, src->bpp) != XCB_IMAGE_FORMAT_Z_PIXMAP ||
+      src->bpp != 32 || dst->depth > 8)
+      return 0;
+  if (visual && truecolor_class(visual->_class)) {
+      visual_masks(visual, dst->depth, masks);
+      _xcb_image_dither_init(&dither, masks, dst->depth);
+  } else {
+      _xcb_image_dither_init(&dither, 0, dst->depth);
   }
+  if (src->width == 0)
+      return dst;
+  memset(&job, 0, sizeof(job));
+  job.src = src;
+  job.dst = dst;
+  job.width = src->width;
+  job.unpack = _xcb_image_unpacker(src);
+  job.pack = _xcb_image_packer(dst);
+  job.dither = &dither;
+  if (!_xcb_image_parallel(src->height, dst->size, copy_band, &job))
+      return 0;
   return dst;
 }
 
@@ -988,12 +2465,9 @@ xcb_image_subimage(xcb_image_t *  image,
 		   uint32_t       bytes,
 		   uint8_t *      data)
 {
-    int                 i, j;
     xcb_image_t *       result;
     
-    if (x + width > image->width)
-	return 0;
-    if (y + height > image->height)
+    if (!span_inside(image, x, y, width, height))
 	return 0;
     result = xcb_image_create(width, height, image->format,
 			      image->scanline_pad, image->depth,
@@ -1002,12 +2476,37 @@ xcb_image_subimage(xcb_image_t *  image,
 			      base, bytes, data);
     if (!result)
 	return 0;
-    /* XXX FIXME  For now, lose on performance. Sorry. */
-    for (j = 0; j < height; j++) {
-	for (i = 0; i < width; i++) {
-	    uint32_t pixel = xcb_image_get_pixel(image, x + i, y + j);
-	    xcb_image_put_pixel(result, i, j, pixel);
-	}
+    if (!copy_rows(image, x, y, result, width, height, 0)) {
+	xcb_image_destroy(result);
+	return 0;
     }
     return result;
 }
+
+xcb_image_t *
+xcb_image_view (xcb_image_t *  image,
+		uint32_t       x,
+		uint32_t       y,
+		uint32_t       width,
+		uint32_t       height,
+		xcb_image_t *  view)
+{
+  uint32_t  planes = 1;
+
+  if (!span_inside(image, x, y, width, height))
+      return 0;
+  if (effective_format(image->format, image->bpp) ==
+      XCB_IMAGE_FORMAT_XY_PIXMAP) {
+      planes = image->depth;
+      if (planes > 1 && height != image->height)
+	  return 0;
+  }
+  *view = *image;
+  view->width = width;
+  view->height = height;
+  view->x_offset = image->x_offset + x;
+  view->data = image->data + y * image->stride;
+  view->size = height * image->stride * planes;
+  view->base = 0;
+  return view;
+}
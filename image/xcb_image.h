@@ -85,6 +85,39 @@ extern "C" {
 
 typedef struct xcb_image_t xcb_image_t;
 
+/**
+ * Pixel access routines specialized for one image layout.
+ * Set by @ref xcb_image_annotate(); see the @c _fast
+ * wrappers in xcb_pixel.h.
+ * @ingroup xcb__image_t
+ */
+typedef uint32_t (*xcb_image_get_pixel_func_t) (xcb_image_t *  image,
+						uint32_t       x,
+						uint32_t       y);
+
+typedef void (*xcb_image_put_pixel_func_t) (xcb_image_t *  image,
+					    uint32_t       x,
+					    uint32_t       y,
+					    uint32_t       pixel);
+
+typedef void (*xcb_image_get_row_func_t) (xcb_image_t *  image,
+					  uint32_t       x,
+					  uint32_t       y,
+					  uint32_t       width,
+					  uint32_t *     pixels);
+
+typedef void (*xcb_image_put_row_func_t) (xcb_image_t *     image,
+					  uint32_t          x,
+					  uint32_t          y,
+					  uint32_t          width,
+					  const uint32_t *  pixels);
+
+typedef void (*xcb_image_fill_row_func_t) (xcb_image_t *  image,
+					   uint32_t       x,
+					   uint32_t       y,
+					   uint32_t       width,
+					   uint32_t       pixel);
+
 /**
  * @struct xcb_image_t
  * A structure that describes an xcb_image_t.
@@ -152,6 +185,20 @@ struct xcb_image_t
 			      *   @ref xcb_image_destroy() if non-null.
 			      */
   uint8_t *          data;   /**< The actual image. */
+  uint16_t           x_offset;   /**< Pixels to skip at the
+				  *   start of each scanline.
+				  *   Zero except in views made
+				  *   by @ref xcb_image_view().
+				  */
+  xcb_image_get_pixel_func_t  get_pixel_func;   /**< Routines
+						 *   for this layout,
+						 *   set by
+						 *   @ref xcb_image_annotate().
+						 */
+  xcb_image_put_pixel_func_t  put_pixel_func;
+  xcb_image_get_row_func_t    get_row_func;
+  xcb_image_put_row_func_t    put_row_func;
+  xcb_image_fill_row_func_t   fill_row_func;
 };
 
 typedef struct xcb_shm_segment_info_t xcb_shm_segment_info_t;
@@ -168,6 +215,23 @@ struct xcb_shm_segment_info_t
   uint8_t     *shmaddr;
 };
 
+typedef struct xcb_image_get_cookie_t xcb_image_get_cookie_t;
+
+/**
+ * @struct xcb_image_get_cookie_t
+ * A GetImage request in flight, as started by
+ * @ref xcb_image_get_start().  It remembers what the reply
+ * needs to become an image.
+ */
+struct xcb_image_get_cookie_t
+{
+  xcb_get_image_cookie_t  cookie;      /**< The GetImage request. */
+  uint16_t                width;       /**< Width in pixels. */
+  uint16_t                height;      /**< Height in pixels. */
+  uint32_t                plane_mask;  /**< The plane mask asked for. */
+  xcb_image_format_t      format;      /**< The format asked for. */
+};
+
 
 /**
  * Update the cached data of an image.
@@ -176,6 +240,24 @@ struct xcb_shm_segment_info_t
  * An image's size and stride, among other things, are
  * cached in its structure.  This function recomputes those
  * cached values for the given image.
+ *
+ * It also picks the pixel access routines for the image's
+ * exact layout, which the @c _fast wrappers in xcb_pixel.h
+ * call.  Call it again after changing the format, depth,
+ * bpp, unit, byte or bit order or plane mask of an image.
+ * The routines depend only on the layout, not on where the
+ * data lies: 16 and 32 bits-per-pixel images in the host's
+ * byte order get whole-pixel copies that work at any
+ * alignment, so the data may be moved freely.
+ *
+ * The stride is recomputed from the width unless the image
+ * is a view: one with an @c x_offset, or one that doesn't
+ * own its storage and whose stride is already wider than
+ * its width needs.  A view keeps its parent's stride.  An
+ * image built by hand rather than by @ref xcb_image_create()
+ * must have @c x_offset and @c stride zeroed before it is
+ * first annotated; zeroing the stride again has it
+ * recomputed after a layout change.
  * @ingroup xcb__image_t
  */
 void
@@ -314,6 +396,119 @@ xcb_image_get (xcb_connection_t *  conn,
 	       xcb_image_format_t  format);
 
 
+/**
+ * Start getting an image from the X server.
+ * @param conn The connection to the X server.
+ * @param draw The drawable to get the image from.
+ * @param x The x coordinate in pixels, relative to the origin of the
+ * drawable and defining the upper-left corner of the rectangle.
+ * @param y The y coordinate in pixels, relative to the origin of the
+ * drawable and defining the upper-left corner of the rectangle.
+ * @param width The width of the subimage in pixels.
+ * @param height The height of the subimage in pixels.
+ * @param plane_mask The plane mask.  See the protocol document for details.
+ * @param format The format of the image.
+ * @return A cookie for the request.
+ *
+ * This function sends the GetImage request of xcb_image_get()
+ * without waiting for the reply, so that many gets can be
+ * in flight at once.  Pass the cookie to xcb_image_get_finish()
+ * or xcb_image_get_poll() for the image; every cookie must be
+ * finished, polled to completion or discarded with
+ * xcb_discard_reply() on its cookie.sequence.
+ * @ingroup xcb__image_t
+ */
+xcb_image_get_cookie_t
+xcb_image_get_start (xcb_connection_t *  conn,
+		     xcb_drawable_t      draw,
+		     int16_t             x,
+		     int16_t             y,
+		     uint16_t            width,
+		     uint16_t            height,
+		     uint32_t            plane_mask,
+		     xcb_image_format_t  format);
+
+
+/**
+ * Finish getting an image from the X server.
+ * @param conn The connection to the X server.
+ * @param cookie The cookie from xcb_image_get_start().
+ * @return The image asked for.
+ *
+ * This function waits for the reply to @p cookie and returns
+ * it as an image, just as xcb_image_get() would have.
+ *
+ * If a problem occurs, the function returns null.
+ * @ingroup xcb__image_t
+ */
+xcb_image_t *
+xcb_image_get_finish (xcb_connection_t *      conn,
+		      xcb_image_get_cookie_t  cookie);
+
+
+/**
+ * Check whether an image from the X server has arrived.
+ * @param conn The connection to the X server.
+ * @param cookie The cookie from xcb_image_get_start().
+ * @param image Where to store the image.
+ * @return 1 once the request is done, 0 if the reply is not in yet.
+ *
+ * This function is xcb_image_get_finish() without the wait.
+ * When it returns 1, *@p image is the image, or null if a
+ * problem occurred, and @p cookie must not be used again.
+ * When it returns 0, *@p image is left alone.  It never
+ * blocks; see xcb_poll_for_reply().
+ * @ingroup xcb__image_t
+ */
+int
+xcb_image_get_poll (xcb_connection_t *      conn,
+		    xcb_image_get_cookie_t  cookie,
+		    xcb_image_t **          image);
+
+
+/**
+ * Get a large image from the X server in bands.
+ * @param conn The connection to the X server.
+ * @param draw The drawable to get the image from.
+ * @param x The x coordinate in pixels, relative to the origin of the
+ * drawable and defining the upper-left corner of the rectangle.
+ * @param y The y coordinate in pixels, relative to the origin of the
+ * drawable and defining the upper-left corner of the rectangle.
+ * @param width The width of the subimage in pixels.
+ * @param height The height of the subimage in pixels.
+ * @param plane_mask The plane mask.  See the protocol document for details.
+ * @param format The format of the image.
+ * @param band_bytes The most image data to ask for in one request,
+ * or 0 for a default of 256 KiB.
+ * @return The subimage of @p draw defined by @p x, @p y, @p w, @p h.
+ *
+ * This function returns the same image as xcb_image_get(),
+ * but cuts the rectangle into bands of whole scanlines and
+ * sends a GetImage request for every band before waiting for
+ * any reply.  The server can then encode later bands while the
+ * earlier replies are being read, and only one band's reply is
+ * held at a time: each is copied straight into its rows of the
+ * returned image and then freed.
+ * Bands are sized before the depth of @p draw is known, so for
+ * shallow drawables they hold less than @p band_bytes.  If
+ * the whole rectangle fits in one band, this function is
+ * xcb_image_get().
+ *
+ * If a problem occurs, the function returns null.
+ * @ingroup xcb__image_t
+ */
+xcb_image_t *
+xcb_image_get_tiled (xcb_connection_t *  conn,
+		     xcb_drawable_t      draw,
+		     int16_t             x,
+		     int16_t             y,
+		     uint16_t            width,
+		     uint16_t            height,
+		     uint32_t            plane_mask,
+		     xcb_image_format_t  format,
+		     uint32_t            band_bytes);
+
+
 /**
  * Put an image onto the X server.
  * @param conn The connection to the X server.
@@ -326,10 +521,11 @@ xcb_image_get (xcb_connection_t *  conn,
  * @param y The y coordinate, which is relative to the origin of the
  * drawable and defines the x coordinate of the upper-left corner of
  * the rectangle.
- * @param left_pad Notionally shift an xy-bitmap or xy-pixmap image
- * to the right some small amount, for some reason.  XXX Not clear
- * this is currently supported correctly.
- * @return The cookie returned by xcb_put_image().
+ * @param left_pad Pixels to skip at the start of each scanline
+ * of @p image, on top of a view's own offset.  The image's
+ * width in pixels after them is drawn, so they must fit
+ * within its stride; nothing is sent otherwise.
+ * @return The cookie of the last request sent.
  *
  * This function combines an image with a rectangle of the
  * specified drawable @p draw. The image must be in native
@@ -341,6 +537,13 @@ xcb_image_get (xcb_connection_t *  conn,
  * z-pixmap formats, the depth of the image must match the
  * depth of the drawable; the gc is ignored.
  *
+ * An image too big for a single request, by the
+ * connection's maximum request length, or bigger than
+ * 256 KiB, is sent in bands of rows (all planes of them,
+ * for xy-pixmaps) one after the other, as by @ref
+ * xcb_image_put_rect(), so the server can draw each band
+ * while the next one is on its way.
+ *
  * @ingroup xcb__image_t
  */
 xcb_void_cookie_t
@@ -353,6 +556,51 @@ xcb_image_put (xcb_connection_t *  conn,
 	       uint8_t             left_pad);
 
 
+/**
+ * Put a rectangle of an image onto the X server.
+ * @param conn The connection to the X server.
+ * @param draw The drawable to draw into.
+ * @param gc The graphic context.
+ * @param image The image the rectangle is taken from.
+ * @param x X coordinate of the rectangle in the image.
+ * @param y Y coordinate of the rectangle in the image.
+ * @param width Width of the rectangle.
+ * @param height Height of the rectangle.
+ * @param dst_x X coordinate to draw the rectangle at.
+ * @param dst_y Y coordinate to draw the rectangle at.
+ * @return The cookie of the last request sent, or one with a
+ * zero sequence number if nothing was sent.
+ *
+ * This is @ref xcb_image_put() of the given rectangle of @p
+ * image, without a call to @ref xcb_image_subimage() first.
+ * The request data is gathered straight from the image's
+ * scanlines, so only the rows of the rectangle, and of each
+ * row only the scanline pad units it touches, are sent.  For
+ * xy formats the pixels ahead of the rectangle in its first
+ * pad unit are skipped with the request's left pad; a 4 bpp
+ * z-pixmap rectangle starting mid-byte, which the protocol
+ * can't express that way, is shifted into a small buffer
+ * instead.  Large rectangles go out as several requests, each
+ * drawing a band of rows of at most 256 KiB, or less if the
+ * connection's maximum request length is smaller; a row too
+ * long even for that is split in two.  The image must be in
+ * native format for the connection, and nothing is sent if
+ * the rectangle doesn't fit in it.
+ * @ingroup xcb__image_t
+ */
+xcb_void_cookie_t
+xcb_image_put_rect (xcb_connection_t *  conn,
+		    xcb_drawable_t      draw,
+		    xcb_gcontext_t      gc,
+		    xcb_image_t *       image,
+		    uint32_t            x,
+		    uint32_t            y,
+		    uint32_t            width,
+		    uint32_t            height,
+		    int16_t             dst_x,
+		    int16_t             dst_y);
+
+
 /**
  * Check image for or convert image to native format.
  * @param c The connection to the X server.
@@ -373,6 +621,15 @@ xcb_image_put (xcb_connection_t *  conn,
  * will be returned.  The image passed in will be unharmed in this
  * case; it is the caller's responsibility to check that the returned
  * pointer is different and to dispose of the old image if desired.
+ *
+ * If the server has no pixmap format for the depth of @p image
+ * and the image holds truecolor pixels of depth 32 (ARGB 8888),
+ * 30 (RGB 10-10-10), 24 (RGB 888), 16 (RGB 565) or 15 (RGB 555),
+ * conversion will also change its depth.  The target is the
+ * root visual of the first screen with a TrueColor or
+ * DirectColor one (else the deepest such visual), and the
+ * channels are rescaled to that visual's masks.  Check the
+ * depth of the returned image before putting it.
  * @ingroup xcb__image_t
  */
 xcb_image_t *
@@ -381,6 +638,80 @@ xcb_image_native (xcb_connection_t *  c,
 		  int                 convert);
 
 
+/**
+ * Convert an image to native format, reusing its storage.
+ * @param c The connection to the X server.
+ * @param image The image.
+ * @return Null if the image is not in native format and can not
+ * be converted.  Otherwise, the native format image.
+ *
+ * This is @ref xcb_image_native() with @p convert true, except
+ * that when the native layout puts every scanline at the same
+ * offset as the current one, as it does when only the byte or
+ * bit order, the scanline unit or the XY bits-per-pixel differ,
+ * the data of @p image is rewritten in place and @p image itself
+ * is updated to describe it and returned.  No second buffer is
+ * allocated.  The image data must be writable.
+ *
+ * When the size of the data changes, a new image is allocated
+ * and returned just as @ref xcb_image_native() would, and @p
+ * image is unharmed.  If the in-place conversion fails, which
+ * can only happen when a scanline buffer can't be allocated,
+ * null is returned and the contents of @p image are undefined.
+ * @ingroup xcb__image_t
+ */
+xcb_image_t *
+xcb_image_native_inplace (xcb_connection_t *  c,
+			  xcb_image_t *       image);
+
+
+/**
+ * Byte order of 8-bit-per-channel client pixels.
+ */
+typedef enum xcb_image_rgba_order_t {
+  XCB_IMAGE_RGBA_ORDER_RGBA,	/**< Bytes R, G, B, A in memory. */
+  XCB_IMAGE_RGBA_ORDER_BGRA	/**< Bytes B, G, R, A in memory, as in
+				 *   little-endian ARGB32 buffers. */
+} xcb_image_rgba_order_t;
+
+/**
+ * Create a native image for a visual from RGBA pixels.
+ * @param c The connection to the X server.
+ * @param visual A TrueColor or DirectColor visual of the server.
+ * @param width Width in pixels.
+ * @param height Height in pixels.
+ * @param order Order of the channel bytes of each pixel.
+ * @param pixels The client pixels, four bytes each.
+ * @param stride Bytes from one row of @p pixels to the next,
+ *   or 0 for @p width times 4.
+ * @return The new image, or null on error.
+ *
+ * This function makes a Z-pixmap image in native format for
+ * the depth of @p visual, ready for @ref xcb_image_put() or
+ * @ref xcb_image_shm_put() to a drawable of that visual, and
+ * fills it from @p pixels.  Each 8-bit channel is scaled to
+ * the width of the visual's @p red_mask, @p green_mask and @p
+ * blue_mask, by truncation or bit replication, and shifted
+ * into place.  Bits of the depth that none of the masks cover
+ * are alpha, and take the alpha channel; otherwise alpha is
+ * dropped.  Color values are copied as they are, so
+ * premultiplied pixels stay premultiplied.
+ *
+ * The shifts and widths are worked out once per call, and
+ * for 32 bits-per-pixel visuals the packing is a single
+ * vectorized pass over each row.
+ * @ingroup xcb__image_t
+ */
+xcb_image_t *
+xcb_image_create_from_rgba (xcb_connection_t *        c,
+			    const xcb_visualtype_t *  visual,
+			    uint16_t                  width,
+			    uint16_t                  height,
+			    xcb_image_rgba_order_t    order,
+			    const uint8_t *           pixels,
+			    uint32_t                  stride);
+
+
 /**
  * Put a pixel to an image.
  * @param image The image.
@@ -419,6 +750,99 @@ xcb_image_get_pixel (xcb_image_t *image,
 		     uint32_t y);
 
 
+/**
+ * Get a span of pixels from a scanline of an image.
+ * @param image The image.
+ * @param x The x coordinate of the first pixel.
+ * @param y The scanline.
+ * @param width The number of pixels.
+ * @param pixels Where to store the pixel values.
+ *
+ * This function stores the same values as @p width calls
+ * of @ref xcb_image_get_pixel() would, but looks up the
+ * image layout once for the whole span and converts it
+ * with the library's scanline routines.  The span must lie
+ * within the image.
+ * @ingroup xcb__image_t
+ */
+void
+xcb_image_get_row (xcb_image_t *  image,
+		   uint32_t       x,
+		   uint32_t       y,
+		   uint32_t       width,
+		   uint32_t *     pixels);
+
+/**
+ * Put a span of pixels to a scanline of an image.
+ * @param image The image.
+ * @param x The x coordinate of the first pixel.
+ * @param y The scanline.
+ * @param width The number of pixels.
+ * @param pixels The new pixel values.
+ *
+ * This is the counterpart of @ref xcb_image_get_row(), for
+ * @ref xcb_image_put_pixel().  Pixels outside the span are
+ * left alone, and the plane-mask is honored for xy-pixmap
+ * images.  A span that does not lie within the image is
+ * ignored.
+ * @ingroup xcb__image_t
+ */
+void
+xcb_image_put_row (xcb_image_t *     image,
+		   uint32_t          x,
+		   uint32_t          y,
+		   uint32_t          width,
+		   const uint32_t *  pixels);
+
+/**
+ * Get a rectangle of pixels from an image.
+ * @param image The image.
+ * @param x The x coordinate of the rectangle.
+ * @param y The y coordinate of the rectangle.
+ * @param width The width of the rectangle.
+ * @param height The height of the rectangle.
+ * @param pixels Where to store the pixel values.
+ * @param pitch The distance, in pixels, between successive
+ * rows of @p pixels.
+ *
+ * This function is @ref xcb_image_get_row() for each of
+ * the @p height scanlines starting at @p y.
+ * @ingroup xcb__image_t
+ */
+void
+xcb_image_get_rows (xcb_image_t *  image,
+		    uint32_t       x,
+		    uint32_t       y,
+		    uint32_t       width,
+		    uint32_t       height,
+		    uint32_t *     pixels,
+		    uint32_t       pitch);
+
+/**
+ * Put a rectangle of pixels to an image.
+ * @param image The image.
+ * @param x The x coordinate of the rectangle.
+ * @param y The y coordinate of the rectangle.
+ * @param width The width of the rectangle.
+ * @param height The height of the rectangle.
+ * @param pixels The new pixel values.
+ * @param pitch The distance, in pixels, between successive
+ * rows of @p pixels.
+ *
+ * This function is @ref xcb_image_put_row() for each of
+ * the @p height scanlines starting at @p y.
+ * @ingroup xcb__image_t
+ */
+void
+xcb_image_put_rows (xcb_image_t *     image,
+		    uint32_t          x,
+		    uint32_t          y,
+		    uint32_t          width,
+		    uint32_t          height,
+		    const uint32_t *  pixels,
+		    uint32_t          pitch);
+
+
 /**
  * Convert an image to a new format.
  * @param src Source image.
@@ -429,13 +853,25 @@ xcb_image_get_pixel (xcb_image_t *image,
  * src image to the format implied by the @p dst image,
  * overwriting the current destination image data.
  * The source and destination must have the same
- * width, height, and depth.  When the source and destination
+ * width, height, and depth, with one exception: between a
+ * depth 30 (10 bits per channel) truecolor image and one of
+ * depth 32 (ARGB 8888), 24 (RGB 888), 16 (RGB 565) or 15
+ * (RGB 555), the color channels are rescaled rather than the
+ * pixel values copied.  When the source and destination
  * are already the same format, a simple copy is done.  Otherwise,
  * when the destination has the same bits-per-pixel/scanline-unit
  * as the source, an optimized copy routine (thanks to Keith Packard)
- * is used for the conversion.  Otherwise, the copy is done the
- * slow, slow way with @ref xcb_image_get_pixel() and
- * @ref xcb_image_put_pixel() calls.
+ * is used for the conversion.  Z-pixmap copies between 24 and
+ * 32 bits-per-pixel, in any combination of byte orders, use
+ * dedicated scanline routines (SIMD where the CPU supports it).
+ * Otherwise, each scanline is unpacked into an array of
+ * pixel values and packed again in the destination layout,
+ * giving the same result as copying with
+ * @ref xcb_image_get_pixel() and @ref xcb_image_put_pixel().
+ * Large images may be converted in bands on several threads;
+ * see @ref xcb_image_set_threads().  Programs converting many
+ * images of the same layouts can skip the analysis each time
+ * with @ref xcb_image_convert_plan_create().
  * @ingroup xcb__image_t
  */
 xcb_image_t *
@@ -443,6 +879,199 @@ xcb_image_convert (xcb_image_t *  src,
 		   xcb_image_t *  dst);
 
 
+/**
+ * @struct xcb_image_convert_plan_t
+ * A conversion between two image layouts, worked out once
+ * by @ref xcb_image_convert_plan_create().
+ */
+typedef struct xcb_image_convert_plan_t xcb_image_convert_plan_t;
+
+/**
+ * How a @ref xcb_image_convert_plan_t converts, from fastest
+ * to slowest.
+ */
+typedef enum xcb_image_convert_path_t {
+  XCB_IMAGE_CONVERT_PATH_COPY,		/**< One copy of all the data. */
+  XCB_IMAGE_CONVERT_PATH_ROW_COPY,	/**< A copy per scanline; only
+					 *   the scanline pad differs. */
+  XCB_IMAGE_CONVERT_PATH_SWAP,		/**< Byte, bit or nibble swaps
+					 *   of each scanline. */
+  XCB_IMAGE_CONVERT_PATH_Z24_Z32,	/**< Z-pixmap 24 to 32
+					 *   bits-per-pixel or back. */
+  XCB_IMAGE_CONVERT_PATH_REMAP,		/**< 32 bits-per-pixel deep color
+					 *   channel rescaling. */
+  XCB_IMAGE_CONVERT_PATH_GENERAL	/**< Unpack and repack each
+					 *   scanline of pixel values. */
+} xcb_image_convert_path_t;
+
+/**
+ * Plan conversions between two image layouts.
+ * @param src Source image.
+ * @param dst Destination image.
+ * @return A new plan, or null on error.
+ *
+ * This does the analysis behind @ref xcb_image_convert() once,
+ * for images laid out like @p src and @p dst: same width,
+ * height, format, depth, bits-per-pixel, scanline unit and pad,
+ * byte and bit orders, and plane mask, which decides whether
+ * planes can be copied as they are.  Only the layouts are kept, so the
+ * images themselves may be destroyed afterwards.  The plan
+ * may be used from several threads at once.
+ * @ingroup xcb__image_t
+ */
+xcb_image_convert_plan_t *
+xcb_image_convert_plan_create (xcb_image_t *  src,
+			       xcb_image_t *  dst);
+
+/**
+ * Report how a plan converts.
+ * @param plan The plan.
+ * @return The conversion path the plan uses.
+ *
+ * Anything from @ref XCB_IMAGE_CONVERT_PATH_SWAP onwards
+ * touches every byte; @ref XCB_IMAGE_CONVERT_PATH_GENERAL is
+ * the slow path, run a pixel at a time for some layouts.
+ * @ingroup xcb__image_t
+ */
+xcb_image_convert_path_t
+xcb_image_convert_plan_path (const xcb_image_convert_plan_t *  plan);
+
+/**
+ * Convert an image using a plan.
+ * @param plan The plan.
+ * @param src Source image.
+ * @param dst Destination image.
+ * @return The @p dst image, or null on error.
+ *
+ * This is @ref xcb_image_convert() without the analysis.
+ * @p src and @p dst must be laid out like the images the
+ * plan was made for; null is returned if not.  A plan made
+ * for a destination owning its storage also can't be run
+ * into one that doesn't, such as a view, whose scanline pad
+ * may hold other pixels.
+ * @ingroup xcb__image_t
+ */
+xcb_image_t *
+xcb_image_convert_plan_run (const xcb_image_convert_plan_t *  plan,
+			    xcb_image_t *                     src,
+			    xcb_image_t *                     dst);
+
+/**
+ * Destroy a conversion plan.
+ * @param plan The plan.
+ * @ingroup xcb__image_t
+ */
+void
+xcb_image_convert_plan_destroy (xcb_image_convert_plan_t *  plan);
+
+
+/**
+ * Convert a truecolor image to a low depth with ordered dithering.
+ * @param src Source image: Z-pixmap, 32 bits-per-pixel, with
+ *   pixels of the form 0x00rrggbb.
+ * @param dst Destination image, of depth 8 or less.
+ * @param visual Visual the destination is meant for, or null.
+ * @return The @p dst image, or null on error.
+ *
+ * Quantizes each pixel of @p src with an 8x8 Bayer matrix
+ * and stores it in @p dst, which may be a Z-pixmap of 4 or 8
+ * bits-per-pixel, an XY-bitmap or an XY-pixmap, in any byte
+ * and bit order.  The two images must be the same size.
+ *
+ * If @p visual is TrueColor or DirectColor, as for an RGB 332
+ * visual, each channel is dithered to the width of the
+ * visual's mask for it.  Otherwise the luminance is dithered
+ * to a gray ramp of 2^depth levels, and the pixel values are
+ * the levels: 0 to 1 for a bitmap, 0 to 255 at depth 8.
+ * The arithmetic and the per-row thresholds are vectorized,
+ * and large images are split over threads as in
+ * @ref xcb_image_convert().
+ * @ingroup xcb__image_t
+ */
+xcb_image_t *
+xcb_image_dither (xcb_image_t *             src,
+		  xcb_image_t *             dst,
+		  const xcb_visualtype_t *  visual);
+
+
+/**
+ * Alpha handling for @ref xcb_image_convert_alpha().
+ */
+typedef enum xcb_image_alpha_op_t {
+  XCB_IMAGE_ALPHA_NONE,		/**< Copy pixels as they are. */
+  XCB_IMAGE_ALPHA_PREMULTIPLY,	/**< Multiply colors by alpha. */
+  XCB_IMAGE_ALPHA_UNPREMULTIPLY	/**< Divide colors by alpha. */
+} xcb_image_alpha_op_t;
+
+/**
+ * Convert an ARGB image, premultiplying or unpremultiplying alpha.
+ * @param src Source image, of depth 32.
+ * @param dst Destination image, of depth 32.
+ * @param op What to do with alpha.
+ * @return The @p dst image, or null on error.
+ *
+ * Like @ref xcb_image_convert(), but the pixel values are
+ * taken as ARGB 8888, as on depth 32 visuals used for
+ * compositing, and the color channels are multiplied by alpha
+ * (rounding to nearest) or divided by it (clamping to 255; a
+ * zero alpha gives black) in the same pass that converts the
+ * layout.  For example, with a client ARGB32 buffer wrapped
+ * with @ref xcb_image_create() as @p src and an image from
+ * @ref xcb_image_create_native() as @p dst, a single pass
+ * gives a premultiplied image in the server's byte order.
+ * @p src and @p dst may be the same image.  Both directions
+ * are vectorized, unpremultiplying only where AVX2 is
+ * available.
+ * @ingroup xcb__image_t
+ */
+xcb_image_t *
+xcb_image_convert_alpha (xcb_image_t *         src,
+			 xcb_image_t *         dst,
+			 xcb_image_alpha_op_t  op);
+
+
+/**
+ * Reverse the bit order of each byte of a buffer.
+ * @param src Source bytes.
+ * @param dst Destination bytes; may be the same as @p src.
+ * @param bytes Number of bytes.
+ *
+ * This is xcb_bit_reverse(b, 8) applied to a whole buffer,
+ * for example to turn LSB-first bitmap data into MSB-first.
+ * It uses SIMD table lookups where the CPU supports them and
+ * a byte table otherwise.
+ * @ingroup xcb__image_t
+ */
+void
+xcb_bit_reverse_bytes (const uint8_t *  src,
+		       uint8_t *        dst,
+		       uint32_t         bytes);
+
+
+/**
+ * Set up parallel conversion.
+ * @param threads Number of threads to use, counting the caller;
+ *   0 means one per online processor.
+ * @param min_bytes Smallest amount of image data worth splitting.
+ *
+ * @ref xcb_image_convert() and @ref xcb_image_subimage() work
+ * row by row, and for images of at least @p min_bytes they
+ * split the rows into bands which are spread over a pool of
+ * worker threads, started on first use.  The default is a
+ * single thread, which keeps all work on the calling thread.
+ * Only one conversion at a time uses the pool; conversions
+ * started from other threads meanwhile run serially.  This
+ * setting is global to the library, and is ignored when it was
+ * built without thread support.  The workers are joined when
+ * the library is unloaded or the program exits, and a child
+ * of fork() starts with a single thread again.
+ * @ingroup xcb__image_t
+ */
+void
+xcb_image_set_threads (unsigned int  threads,
+		       uint32_t      min_bytes);
+
+
 /**
  * Extract a subimage of an image.
  * @param image Source image.
@@ -461,6 +1090,11 @@ xcb_image_convert (xcb_image_t *  src,
  * general image parameters as the source image.  The @p base, @p bytes,
  * and @p data arguments are passed to @ref xcb_create_image() unaltered
  * to create the destination image---see its documentation for details.
+ * Scanlines are copied as whole bytes, or as shifted runs of bits
+ * for pixels and planes narrower than a byte, rather than pixel by
+ * pixel; bits past the subimage in each destination scanline are
+ * left alone.  Like @ref xcb_image_convert(), large copies may be
+ * split over several threads.
  *
  * @ingroup xcb__image_t
  */
@@ -475,6 +1109,47 @@ xcb_image_subimage(xcb_image_t *  image,
 		   uint8_t *      data);
 
 
+/**
+ * Make a view of part of an image.
+ * @param image Parent image.
+ * @param x X coordinate of the view.
+ * @param y Y coordinate of the view.
+ * @param width Width of the view.
+ * @param height Height of the view.
+ * @param view Image structure to fill in.
+ * @return @p view, or null if the rectangle does not fit.
+ *
+ * This function describes the rectangle at the given
+ * coordinates of @p image as an image of its own, without
+ * allocating or copying anything.  The view shares the
+ * parent's data and stride, and skips @p x pixels at the
+ * start of each scanline through its @c x_offset field, so
+ * writes to either image show up in the other.  The view does
+ * not own any storage: it must not be passed to @ref
+ * xcb_image_destroy(), and must not outlive the parent's data.
+ *
+ * The pixel accessors, @ref xcb_image_convert(), @ref
+ * xcb_image_subimage(), @ref xcb_image_put() and @ref
+ * xcb_image_shm_put() work on views; @ref xcb_image_put()
+ * sends a view as @ref xcb_image_put_rect() would.
+ * Views can't be filled by @ref xcb_image_shm_get(), which
+ * would overwrite the parent's pixels beside them.  In an
+ * xy-pixmap of more than one plane, planes are found by the
+ * image height, so a view must span the parent's full height.
+ * A view may be passed to @ref xcb_image_annotate() after a
+ * change of plane mask or order; it keeps the parent's
+ * stride and @c x_offset.
+ * @ingroup xcb__image_t
+ */
+xcb_image_t *
+xcb_image_view (xcb_image_t *  image,
+		uint32_t       x,
+		uint32_t       y,
+		uint32_t       width,
+		uint32_t       height,
+		xcb_image_t *  view);
+
+
 /*
  * Shm stuff
  */
@@ -562,6 +1237,126 @@ int xcb_image_shm_get (xcb_connection_t *      conn,
 		       uint32_t                plane_mask);
 
 
+typedef struct xcb_image_shm_pool_t xcb_image_shm_pool_t;
+
+/**
+ * Flags for @ref xcb_image_shm_pool_create().
+ */
+typedef enum xcb_image_shm_pool_flags_t {
+  XCB_IMAGE_SHM_POOL_SYSV = 1 << 0,	/**< Only use SysV segments. */
+  XCB_IMAGE_SHM_POOL_POPULATE = 1 << 1,	/**< Fault in new segments
+					 *   up front. */
+  XCB_IMAGE_SHM_POOL_SEAL = 1 << 2	/**< Seal the size of new
+					 *   memfd segments. */
+} xcb_image_shm_pool_flags_t;
+
+/**
+ * Create a pool of shared memory segments.
+ * @param conn The connection to the X server.
+ * @param flags A combination of @ref xcb_image_shm_pool_flags_t.
+ * @return The new pool, or 0 if the server or the system
+ * has no MIT Shm support.
+ *
+ * A pool makes, attaches and recycles the segments behind
+ * shared memory images, so that callers of
+ * xcb_image_shm_put() and xcb_image_shm_get() need not
+ * manage @ref xcb_shm_segment_info_t structures themselves.
+ * A segment is only made when no idle one is big enough,
+ * which costs a round trip; otherwise handing out and
+ * releasing images makes no system calls and sends no
+ * requests.  A pool must only be used by one thread at a time.
+ *
+ * When the server has MIT Shm 1.2 and @p conn is a local
+ * socket, segments are memfds passed with AttachFd, or, where
+ * memfd_create() is missing, made by the server with
+ * CreateSegment.  These need no SysV ids and go away with the
+ * last process using them.  Their @ref xcb_shm_segment_info_t
+ * has an shmid of -1.  Otherwise, or with
+ * @ref XCB_IMAGE_SHM_POOL_SYSV, segments are SysV ones.
+ * Finding out the server's version makes creating a pool on
+ * a local socket cost a round trip, unless
+ * @ref XCB_IMAGE_SHM_POOL_SYSV is given.
+ * @ingroup xcb__image_t
+ */
+xcb_image_shm_pool_t *
+xcb_image_shm_pool_create (xcb_connection_t *  conn,
+			   uint32_t            flags);
+
+
+/**
+ * Destroy a pool of shared memory segments.
+ * @param pool The pool, or 0.
+ *
+ * This function detaches and frees every segment of
+ * @p pool, including those under images that have not been
+ * released; the data of such images must not be touched
+ * afterwards, though their structures still need
+ * xcb_image_destroy().
+ * @ingroup xcb__image_t
+ */
+void
+xcb_image_shm_pool_destroy (xcb_image_shm_pool_t *  pool);
+
+
+/**
+ * Free the idle segments of a pool.
+ * @param pool The pool.
+ *
+ * This function detaches and frees every segment of @p pool
+ * that is not under an image, for instance after the size
+ * of the images in use has dropped.
+ * @ingroup xcb__image_t
+ */
+void
+xcb_image_shm_pool_trim (xcb_image_shm_pool_t *  pool);
+
+
+/**
+ * Get a shared memory image from a pool.
+ * @param pool The pool.
+ * @param width The width of the image, in pixels.
+ * @param height The height of the image, in pixels.
+ * @param format The format of the image.
+ * @param depth The depth of the image.
+ * @param shminfo Where to store the segment of the image, or 0.
+ * @return The image, or 0 on error.
+ *
+ * This function returns an image of the connection's native
+ * layout whose data lies at the start of a segment of
+ * @p pool, and stores that segment in *@p shminfo for
+ * xcb_image_shm_put() and xcb_image_shm_get().  The data
+ * is left as the segment's last user left it.  Give the
+ * image back with xcb_image_shm_pool_release() rather than
+ * xcb_image_destroy().
+ * @ingroup xcb__image_t
+ */
+xcb_image_t *
+xcb_image_shm_pool_acquire (xcb_image_shm_pool_t *    pool,
+			    uint16_t                  width,
+			    uint16_t                  height,
+			    xcb_image_format_t        format,
+			    uint8_t                   depth,
+			    xcb_shm_segment_info_t *  shminfo);
+
+
+/**
+ * Return a shared memory image to its pool.
+ * @param pool The pool the image came from.
+ * @param image The image, or 0.
+ *
+ * This function destroys @p image and puts its segment on the
+ * free list of @p pool for the next xcb_image_shm_pool_acquire().
+ * The server must be done with the segment by then: wait for
+ * the completion event of an xcb_image_shm_put() with
+ * @p send_event set, or for the reply to a later request.
+ * Images that did not come from @p pool are left alone.
+ * @ingroup xcb__image_t
+ */
+void
+xcb_image_shm_pool_release (xcb_image_shm_pool_t *  pool,
+			    xcb_image_t *           image);
+
+
 /**
  * Create an image from user-supplied bitmap data.
  * @param data Image data in packed bitmap format.
@@ -0,0 +1,2406 @@
+/* Copyright © 2026 The xcb-util-image developers
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ * 
+ * Except as contained in this notice, the names of the authors or their
+ * institutions shall not be used in advertising or otherwise to promote the
+ * sale, use or other dealings in this Software without prior written
+ * authorization from the authors.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "xcb_kernels.h"
+#include "xcb_bitops.h"
+
+#if (defined(__x86_64__) || defined(__i386__)) && \
+    (defined(__GNUC__) || defined(__clang__))
+#define XCB_KERNELS_X86 1
+#include <immintrin.h>
+#endif
+
+/* GCC 12's avx512fintrin.h starts _mm512_undefined_*() from
+   an uninitialised __Y (GCC bug 105593), so every AVX-512
+   kernel that gets inlined warns about it.  The warnings
+   are about the header, not the kernels. */
+#if defined(XCB_KERNELS_X86) && defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wuninitialized"
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#endif
+
+
+/*
+ * CPU feature levels, probed once on first use.
+ *
+ * Every kernel below has a portable C version and, on x86,
+ * versions for some of these levels; the entry points pick
+ * the best one the level allows.  XCB_IMAGE_CPU may name a
+ * lower level (scalar, sse2, ssse3, avx2 or avx512) to use
+ * instead, for benchmarking and for bisecting a problem to
+ * one set of kernels.  Levels the CPU doesn't have are
+ * never used.
+ */
+
+enum {
+    LEVEL_SCALAR,
+    LEVEL_SSE2,
+    LEVEL_SSSE3,
+    LEVEL_AVX2,
+    LEVEL_AVX512
+};
+
+static const char * const level_names[] = {
+    "scalar", "sse2", "ssse3", "avx2", "avx512"
+};
+
+static int
+cpu_level (void)
+{
+    /* Threads racing through here all store the same value. */
+    static int  level = -1;
+
+    if (level < 0) {
+	int           l = LEVEL_SCALAR;
+	const char *  force = getenv("XCB_IMAGE_CPU");
+	int           i;
+
+#ifdef XCB_KERNELS_X86
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("sse2"))
+	    l = LEVEL_SSE2;
+	if (__builtin_cpu_supports("ssse3"))
+	    l = LEVEL_SSSE3;
+	if (__builtin_cpu_supports("avx2"))
+	    l = LEVEL_AVX2;
+	if (__builtin_cpu_supports("avx512f") &&
+	    __builtin_cpu_supports("avx512bw"))
+	    l = LEVEL_AVX512;
+#endif
+	if (force) {
+	    for (i = LEVEL_SCALAR; i <= LEVEL_AVX512; i++)
+		if (strcmp(force, level_names[i]) == 0 && i < l)
+		    l = i;
+	}
+	level = l;
+    }
+    return level;
+}
+
+
+/*
+ * Z24 <-> Z32
+ *
+ * The four byte order combinations are all plain byte
+ * permutations (plus a zero byte going up), so the SIMD
+ * versions are a single pshufb per block, driven by the
+ * tables below.  Tables are indexed by
+ * (src_msb << 1) | dst_msb.
+ */
+
+static inline uint32_t
+load24 (const uint8_t *p, int msb)
+{
+    if (msb)
+	return (p[0] << 16) | (p[1] << 8) | p[2];
+    return p[0] | (p[1] << 8) | (p[2] << 16);
+}
+
+static inline void
+store24 (uint8_t *p, uint32_t pixel, int msb)
+{
+    if (msb) {
+	p[0] = pixel >> 16;
+	p[1] = pixel >> 8;
+	p[2] = pixel;
+    } else {
+	p[0] = pixel;
+	p[1] = pixel >> 8;
+	p[2] = pixel >> 16;
+    }
+}
+
+static inline uint32_t
+load32 (const uint8_t *p, int msb)
+{
+    if (msb)
+	return ((uint32_t)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static inline void
+store32 (uint8_t *p, uint32_t pixel, int msb)
+{
+    if (msb) {
+	p[0] = pixel >> 24;
+	p[1] = pixel >> 16;
+	p[2] = pixel >> 8;
+	p[3] = pixel;
+    } else {
+	p[0] = pixel;
+	p[1] = pixel >> 8;
+	p[2] = pixel >> 16;
+	p[3] = pixel >> 24;
+    }
+}
+
+static inline void
+z24_to_z32_c (const uint8_t *src, uint8_t *dst, uint32_t width,
+	      int src_msb, int dst_msb)
+{
+    uint32_t  x;
+
+    for (x = 0; x < width; x++)
+	store32(dst + (x << 2), load24(src + x * 3, src_msb), dst_msb);
+}
+
+static inline void
+z32_to_z24_c (const uint8_t *src, uint8_t *dst, uint32_t width,
+	      int src_msb, int dst_msb)
+{
+    uint32_t  x;
+
+    for (x = 0; x < width; x++)
+	store24(dst + x * 3, load32(src + (x << 2), src_msb), dst_msb);
+}
+
+#ifdef XCB_KERNELS_X86
+
+#define Z   0x80
+#define S24(p, i)  ((i) == Z ? Z : 3 * (p) + (i))
+#define S32(p, i)  ((i) == Z ? Z : 4 * (p) + (i))
+
+#define Z24_TO_Z32_MASK(a, b, c, d)					\
+    { S24(0, a), S24(0, b), S24(0, c), S24(0, d),			\
+      S24(1, a), S24(1, b), S24(1, c), S24(1, d),			\
+      S24(2, a), S24(2, b), S24(2, c), S24(2, d),			\
+      S24(3, a), S24(3, b), S24(3, c), S24(3, d) }
+
+#define Z32_TO_Z24_MASK(a, b, c)					\
+    { S32(0, a), S32(0, b), S32(0, c),					\
+      S32(1, a), S32(1, b), S32(1, c),					\
+      S32(2, a), S32(2, b), S32(2, c),					\
+      S32(3, a), S32(3, b), S32(3, c),					\
+      Z, Z, Z, Z }
+
+static const uint8_t z24_to_z32_shuffle[4][16] __attribute__((aligned(16))) = {
+    Z24_TO_Z32_MASK(0, 1, 2, Z),	/* LSB -> LSB */
+    Z24_TO_Z32_MASK(Z, 2, 1, 0),	/* LSB -> MSB */
+    Z24_TO_Z32_MASK(2, 1, 0, Z),	/* MSB -> LSB */
+    Z24_TO_Z32_MASK(Z, 0, 1, 2),	/* MSB -> MSB */
+};
+
+static const uint8_t z32_to_z24_shuffle[4][16] __attribute__((aligned(16))) = {
+    Z32_TO_Z24_MASK(0, 1, 2),		/* LSB -> LSB */
+    Z32_TO_Z24_MASK(2, 1, 0),		/* LSB -> MSB */
+    Z32_TO_Z24_MASK(3, 2, 1),		/* MSB -> LSB */
+    Z32_TO_Z24_MASK(1, 2, 3),		/* MSB -> MSB */
+};
+
+#undef Z24_TO_Z32_MASK
+#undef Z32_TO_Z24_MASK
+#undef S24
+#undef S32
+#undef Z
+
+/* The SIMD kernels return the number of pixels done; the
+ * caller finishes the row with the scalar code.  Loads of
+ * packed 24 bpp data read a few bytes past the last pixel
+ * of a block, so the loop bounds keep them inside the row. */
+
+__attribute__((target("ssse3")))
+static uint32_t
+z24_to_z32_ssse3 (const uint8_t *src, uint8_t *dst, uint32_t width,
+		  const uint8_t *shuffle)
+{
+    __m128i   m = _mm_load_si128((const __m128i *) shuffle);
+    uint32_t  x = 0;
+
+    for (; x + 6 <= width; x += 4) {
+	__m128i  v = _mm_loadu_si128((const __m128i *) (src + x * 3));
+	_mm_storeu_si128((__m128i *) (dst + (x << 2)), _mm_shuffle_epi8(v, m));
+    }
+    return x;
+}
+
+__attribute__((target("ssse3")))
+static uint32_t
+z32_to_z24_ssse3 (const uint8_t *src, uint8_t *dst, uint32_t width,
+		  const uint8_t *shuffle)
+{
+    __m128i   m = _mm_load_si128((const __m128i *) shuffle);
+    uint32_t  x = 0;
+
+    for (; x + 4 <= width; x += 4) {
+	__m128i  v = _mm_loadu_si128((const __m128i *) (src + (x << 2)));
+	uint32_t last;
+
+	v = _mm_shuffle_epi8(v, m);
+	_mm_storel_epi64((__m128i *) (dst + x * 3), v);
+	last = _mm_cvtsi128_si32(_mm_srli_si128(v, 8));
+	memcpy(dst + x * 3 + 8, &last, 4);
+    }
+    return x;
+}
+
+__attribute__((target("avx2")))
+static uint32_t
+z24_to_z32_avx2 (const uint8_t *src, uint8_t *dst, uint32_t width,
+		 const uint8_t *shuffle)
+{
+    __m256i   m = _mm256_broadcastsi128_si256(
+	_mm_load_si128((const __m128i *) shuffle));
+    uint32_t  x = 0;
+
+    for (; x + 10 <= width; x += 8) {
+	const uint8_t *  s = src + x * 3;
+	__m256i  v = _mm256_castsi128_si256(
+	    _mm_loadu_si128((const __m128i *) s));
+	v = _mm256_inserti128_si256(v,
+	    _mm_loadu_si128((const __m128i *) (s + 12)), 1);
+	_mm256_storeu_si256((__m256i *) (dst + (x << 2)),
+			    _mm256_shuffle_epi8(v, m));
+    }
+    return x;
+}
+
+__attribute__((target("avx2")))
+static uint32_t
+z32_to_z24_avx2 (const uint8_t *src, uint8_t *dst, uint32_t width,
+		 const uint8_t *shuffle)
+{
+    __m256i   m = _mm256_broadcastsi128_si256(
+	_mm_load_si128((const __m128i *) shuffle));
+    __m256i   pack = _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 3, 7);
+    uint32_t  x = 0;
+
+    for (; x + 8 <= width; x += 8) {
+	__m256i  v = _mm256_loadu_si256((const __m256i *) (src + (x << 2)));
+	uint8_t *  d = dst + x * 3;
+
+	v = _mm256_permutevar8x32_epi32(_mm256_shuffle_epi8(v, m), pack);
+	_mm_storeu_si128((__m128i *) d, _mm256_castsi256_si128(v));
+	_mm_storel_epi64((__m128i *) (d + 16), _mm256_extracti128_si256(v, 1));
+    }
+    return x;
+}
+
+/* AVX-512 does whole rows: byte-masked loads and stores
+ * cover the last partial block without touching memory
+ * past the row. */
+
+__attribute__((target("avx512f,avx512bw")))
+static uint32_t
+z24_to_z32_avx512 (const uint8_t *src, uint8_t *dst, uint32_t width,
+		   const uint8_t *shuffle)
+{
+    /* Spread 16 packed pixels so each 128-bit lane holds
+       the 12 bytes (plus 4 spare) of four of them. */
+    __m512i   spread = _mm512_setr_epi32(0, 1, 2, 3, 3, 4, 5, 6,
+					 6, 7, 8, 9, 9, 10, 11, 12);
+    __m512i   m = _mm512_broadcast_i32x4(
+	_mm_load_si128((const __m128i *) shuffle));
+    uint32_t  x;
+
+    for (x = 0; x < width; x += 16) {
+	uint32_t   n = width - x < 16 ? width - x : 16;
+	__mmask64  in = ~UINT64_C(0) >> (64 - 3 * n);
+	__mmask64  out = ~UINT64_C(0) >> (64 - 4 * n);
+	__m512i    v = _mm512_maskz_loadu_epi8(in, src + x * 3);
+
+	v = _mm512_shuffle_epi8(_mm512_permutexvar_epi32(spread, v), m);
+	_mm512_mask_storeu_epi8(dst + (x << 2), out, v);
+    }
+    return width;
+}
+
+__attribute__((target("avx512f,avx512bw")))
+static uint32_t
+z32_to_z24_avx512 (const uint8_t *src, uint8_t *dst, uint32_t width,
+		   const uint8_t *shuffle)
+{
+    /* Gather the 12 useful bytes of each lane together. */
+    __m512i   pack = _mm512_setr_epi32(0, 1, 2, 4, 5, 6, 8, 9,
+				       10, 12, 13, 14, 3, 7, 11, 15);
+    __m512i   m = _mm512_broadcast_i32x4(
+	_mm_load_si128((const __m128i *) shuffle));
+    uint32_t  x;
+
+    for (x = 0; x < width; x += 16) {
+	uint32_t   n = width - x < 16 ? width - x : 16;
+	__mmask64  in = ~UINT64_C(0) >> (64 - 4 * n);
+	__mmask64  out = ~UINT64_C(0) >> (64 - 3 * n);
+	__m512i    v = _mm512_maskz_loadu_epi8(in, src + (x << 2));
+
+	v = _mm512_permutexvar_epi32(pack, _mm512_shuffle_epi8(v, m));
+	_mm512_mask_storeu_epi8(dst + x * 3, out, v);
+    }
+    return width;
+}
+
+#endif /* XCB_KERNELS_X86 */
+
+void
+_xcb_image_z24_to_z32 (const uint8_t *     src,
+		       xcb_image_order_t   src_order,
+		       uint8_t *           dst,
+		       xcb_image_order_t   dst_order,
+		       uint32_t            width)
+{
+    int       src_msb = src_order == XCB_IMAGE_ORDER_MSB_FIRST;
+    int       dst_msb = dst_order == XCB_IMAGE_ORDER_MSB_FIRST;
+    uint32_t  done = 0;
+
+#ifdef XCB_KERNELS_X86
+    const uint8_t *  shuffle = z24_to_z32_shuffle[(src_msb << 1) | dst_msb];
+
+    switch (cpu_level()) {
+    case LEVEL_AVX512:
+	done = z24_to_z32_avx512(src, dst, width, shuffle);
+	break;
+    case LEVEL_AVX2:
+	done = z24_to_z32_avx2(src, dst, width, shuffle);
+	break;
+    case LEVEL_SSSE3:
+	done = z24_to_z32_ssse3(src, dst, width, shuffle);
+	break;
+    }
+#endif
+    src += done * 3;
+    dst += done << 2;
+    width -= done;
+    /* Constant flags let the compiler specialize each case. */
+    switch ((src_msb << 1) | dst_msb) {
+    case 0: z24_to_z32_c(src, dst, width, 0, 0); break;
+    case 1: z24_to_z32_c(src, dst, width, 0, 1); break;
+    case 2: z24_to_z32_c(src, dst, width, 1, 0); break;
+    case 3: z24_to_z32_c(src, dst, width, 1, 1); break;
+    }
+}
+
+void
+_xcb_image_z32_to_z24 (const uint8_t *     src,
+		       xcb_image_order_t   src_order,
+		       uint8_t *           dst,
+		       xcb_image_order_t   dst_order,
+		       uint32_t            width)
+{
+    int       src_msb = src_order == XCB_IMAGE_ORDER_MSB_FIRST;
+    int       dst_msb = dst_order == XCB_IMAGE_ORDER_MSB_FIRST;
+    uint32_t  done = 0;
+
+#ifdef XCB_KERNELS_X86
+    const uint8_t *  shuffle = z32_to_z24_shuffle[(src_msb << 1) | dst_msb];
+
+    switch (cpu_level()) {
+    case LEVEL_AVX512:
+	done = z32_to_z24_avx512(src, dst, width, shuffle);
+	break;
+    case LEVEL_AVX2:
+	done = z32_to_z24_avx2(src, dst, width, shuffle);
+	break;
+    case LEVEL_SSSE3:
+	done = z32_to_z24_ssse3(src, dst, width, shuffle);
+	break;
+    }
+#endif
+    src += done << 2;
+    dst += done * 3;
+    width -= done;
+    switch ((src_msb << 1) | dst_msb) {
+    case 0: z32_to_z24_c(src, dst, width, 0, 0); break;
+    case 1: z32_to_z24_c(src, dst, width, 0, 1); break;
+    case 2: z32_to_z24_c(src, dst, width, 1, 0); break;
+    case 3: z32_to_z24_c(src, dst, width, 1, 1); break;
+    }
+}
+
+void
+_xcb_image_z24_swap (const uint8_t *  src,
+		     uint8_t *        dst,
+		     uint32_t         width)
+{
+    uint32_t  x;
+
+    for (x = 0; x < width; x++)
+	store24(dst + x * 3, load24(src + x * 3, 1), 0);
+}
+
+
+/*
+ * Bit reversal
+ */
+
+#define R2(n)  (n), (n) + 0x80, (n) + 0x40, (n) + 0xc0
+#define R4(n)  R2(n), R2((n) + 0x20), R2((n) + 0x10), R2((n) + 0x30)
+#define R6(n)  R4(n), R4((n) + 0x08), R4((n) + 0x04), R4((n) + 0x0c)
+
+const uint8_t _xcb_image_bit_reverse_table[256] = {
+    R6(0), R6(0x02), R6(0x01), R6(0x03)
+};
+
+#undef R2
+#undef R4
+#undef R6
+
+
+/*
+ * Byte, bit and nibble swaps
+ *
+ * The 64-bit SWAR fallback works on any host: every step
+ * permutes lanes of equal size inside a 16- or 32-bit
+ * group or inside a byte, which means the same thing in
+ * either host byte order.
+ */
+
+#define SWAR_BYTES(v, m, s)  ((((v) & (m)) << (s)) | (((v) >> (s)) & (m)))
+
+static inline uint64_t
+swap_swar (uint64_t v, uint32_t byteswap, int bitswap, int nibbleswap)
+{
+    if (byteswap & 1)
+	v = SWAR_BYTES(v, UINT64_C(0x00ff00ff00ff00ff), 8);
+    if (byteswap & 2)
+	v = SWAR_BYTES(v, UINT64_C(0x0000ffff0000ffff), 16);
+    /* A bit reverse starts with a nibble swap, so doing
+       both just skips that step. */
+    if (bitswap != nibbleswap)
+	v = SWAR_BYTES(v, UINT64_C(0x0f0f0f0f0f0f0f0f), 4);
+    if (bitswap) {
+	v = SWAR_BYTES(v, UINT64_C(0x3333333333333333), 2);
+	v = SWAR_BYTES(v, UINT64_C(0x5555555555555555), 1);
+    }
+    return v;
+}
+
+#undef SWAR_BYTES
+
+#ifdef XCB_KERNELS_X86
+
+#define XOR_SHUFFLE(k)							\
+    { 0 ^ (k), 1 ^ (k), 2 ^ (k), 3 ^ (k),				\
+      4 ^ (k), 5 ^ (k), 6 ^ (k), 7 ^ (k),				\
+      8 ^ (k), 9 ^ (k), 10 ^ (k), 11 ^ (k),				\
+      12 ^ (k), 13 ^ (k), 14 ^ (k), 15 ^ (k) }
+
+static const uint8_t byteswap_shuffle[4][16] __attribute__((aligned(16))) = {
+    XOR_SHUFFLE(0), XOR_SHUFFLE(1), XOR_SHUFFLE(2), XOR_SHUFFLE(3)
+};
+
+#undef XOR_SHUFFLE
+
+/* Bit reversal of a nibble, in either half of the byte. */
+static const uint8_t nibble_reverse_lo[16] __attribute__((aligned(16))) = {
+    0x0, 0x8, 0x4, 0xc, 0x2, 0xa, 0x6, 0xe,
+    0x1, 0x9, 0x5, 0xd, 0x3, 0xb, 0x7, 0xf
+};
+
+static const uint8_t nibble_reverse_hi[16] __attribute__((aligned(16))) = {
+    0x00, 0x80, 0x40, 0xc0, 0x20, 0xa0, 0x60, 0xe0,
+    0x10, 0x90, 0x50, 0xd0, 0x30, 0xb0, 0x70, 0xf0
+};
+
+__attribute__((target("ssse3")))
+static uint32_t
+swap_row_ssse3 (const uint8_t *src, uint8_t *dst, uint32_t bytes,
+		uint32_t byteswap, int bitswap, int nibbleswap)
+{
+    __m128i   perm = _mm_load_si128((const __m128i *) byteswap_shuffle[byteswap]);
+    __m128i   lo_tab = _mm_load_si128((const __m128i *) nibble_reverse_lo);
+    __m128i   hi_tab = _mm_load_si128((const __m128i *) nibble_reverse_hi);
+    __m128i   nibble = _mm_set1_epi8(0x0f);
+    uint32_t  i = 0;
+
+    /* Bit reverse with the nibbles left swapped is just
+       the two table lookups the other way round. */
+    if (bitswap && nibbleswap) {
+	__m128i  t = lo_tab;
+	lo_tab = hi_tab;
+	hi_tab = t;
+	nibbleswap = 0;
+    }
+    for (; i + 16 <= bytes; i += 16) {
+	__m128i  v = _mm_loadu_si128((const __m128i *) (src + i));
+	__m128i  lo, hi;
+
+	v = _mm_shuffle_epi8(v, perm);
+	lo = _mm_and_si128(v, nibble);
+	hi = _mm_and_si128(_mm_srli_epi16(v, 4), nibble);
+	if (bitswap)
+	    v = _mm_or_si128(_mm_shuffle_epi8(hi_tab, lo),
+			     _mm_shuffle_epi8(lo_tab, hi));
+	else if (nibbleswap)
+	    v = _mm_or_si128(_mm_slli_epi16(lo, 4), hi);
+	_mm_storeu_si128((__m128i *) (dst + i), v);
+    }
+    return i;
+}
+
+__attribute__((target("avx2")))
+static uint32_t
+swap_row_avx2 (const uint8_t *src, uint8_t *dst, uint32_t bytes,
+	       uint32_t byteswap, int bitswap, int nibbleswap)
+{
+    __m256i   perm = _mm256_broadcastsi128_si256(
+	_mm_load_si128((const __m128i *) byteswap_shuffle[byteswap]));
+    __m256i   lo_tab = _mm256_broadcastsi128_si256(
+	_mm_load_si128((const __m128i *) nibble_reverse_lo));
+    __m256i   hi_tab = _mm256_broadcastsi128_si256(
+	_mm_load_si128((const __m128i *) nibble_reverse_hi));
+    __m256i   nibble = _mm256_set1_epi8(0x0f);
+    uint32_t  i = 0;
+
+    if (bitswap && nibbleswap) {
+	__m256i  t = lo_tab;
+	lo_tab = hi_tab;
+	hi_tab = t;
+	nibbleswap = 0;
+    }
+    for (; i + 32 <= bytes; i += 32) {
+	__m256i  v = _mm256_loadu_si256((const __m256i *) (src + i));
+	__m256i  lo, hi;
+
+	v = _mm256_shuffle_epi8(v, perm);
+	lo = _mm256_and_si256(v, nibble);
+	hi = _mm256_and_si256(_mm256_srli_epi16(v, 4), nibble);
+	if (bitswap)
+	    v = _mm256_or_si256(_mm256_shuffle_epi8(hi_tab, lo),
+				_mm256_shuffle_epi8(lo_tab, hi));
+	else if (nibbleswap)
+	    v = _mm256_or_si256(_mm256_slli_epi16(lo, 4), hi);
+	_mm256_storeu_si256((__m256i *) (dst + i), v);
+    }
+    return i;
+}
+
+/* bytes is whole swap groups, so the masked last block
+   never splits one. */
+__attribute__((target("avx512f,avx512bw")))
+static uint32_t
+swap_row_avx512 (const uint8_t *src, uint8_t *dst, uint32_t bytes,
+		 uint32_t byteswap, int bitswap, int nibbleswap)
+{
+    __m512i   perm = _mm512_broadcast_i32x4(
+	_mm_load_si128((const __m128i *) byteswap_shuffle[byteswap]));
+    __m512i   lo_tab = _mm512_broadcast_i32x4(
+	_mm_load_si128((const __m128i *) nibble_reverse_lo));
+    __m512i   hi_tab = _mm512_broadcast_i32x4(
+	_mm_load_si128((const __m128i *) nibble_reverse_hi));
+    __m512i   nibble = _mm512_set1_epi8(0x0f);
+    uint32_t  i;
+
+    if (bitswap && nibbleswap) {
+	__m512i  t = lo_tab;
+	lo_tab = hi_tab;
+	hi_tab = t;
+	nibbleswap = 0;
+    }
+    for (i = 0; i < bytes; i += 64) {
+	__mmask64  k = bytes - i < 64 ?
+	    ~UINT64_C(0) >> (64 - (bytes - i)) : ~UINT64_C(0);
+	__m512i    v = _mm512_maskz_loadu_epi8(k, src + i);
+	__m512i    lo, hi;
+
+	v = _mm512_shuffle_epi8(v, perm);
+	lo = _mm512_and_si512(v, nibble);
+	hi = _mm512_and_si512(_mm512_srli_epi16(v, 4), nibble);
+	if (bitswap)
+	    v = _mm512_or_si512(_mm512_shuffle_epi8(hi_tab, lo),
+				_mm512_shuffle_epi8(lo_tab, hi));
+	else if (nibbleswap)
+	    v = _mm512_or_si512(_mm512_slli_epi16(lo, 4), hi);
+	_mm512_mask_storeu_epi8(dst + i, k, v);
+    }
+    return bytes;
+}
+
+#endif /* XCB_KERNELS_X86 */
+
+void
+_xcb_image_swap_row (const uint8_t *  src,
+		     uint8_t *        dst,
+		     uint32_t         bytes,
+		     uint32_t         byteswap,
+		     int              bitswap,
+		     int              nibbleswap)
+{
+    uint32_t  i = 0;
+
+#ifdef XCB_KERNELS_X86
+    switch (cpu_level()) {
+    case LEVEL_AVX512:
+	i = swap_row_avx512(src, dst, bytes, byteswap, bitswap, nibbleswap);
+	break;
+    case LEVEL_AVX2:
+	i = swap_row_avx2(src, dst, bytes, byteswap, bitswap, nibbleswap);
+	break;
+    case LEVEL_SSSE3:
+	i = swap_row_ssse3(src, dst, bytes, byteswap, bitswap, nibbleswap);
+	break;
+    }
+#endif
+    for (; i + 8 <= bytes; i += 8) {
+	uint64_t  v;
+	memcpy(&v, src + i, 8);
+	v = swap_swar(v, byteswap, bitswap, nibbleswap);
+	memcpy(dst + i, &v, 8);
+    }
+    /* Fewer than eight bytes, in whole swap groups, are left. */
+    if (i < bytes) {
+	uint64_t  v = 0;
+	memcpy(&v, src + i, bytes - i);
+	v = swap_swar(v, byteswap, bitswap, nibbleswap);
+	memcpy(dst + i, &v, bytes - i);
+    }
+}
+
+
+/* Eight bytes as one integer, the first byte most significant
+   for an msb_first bit order and least significant otherwise,
+   so that a shift moves bits along the scanline. */
+static inline uint64_t
+load_bits64 (const uint8_t *p, int msb_first)
+{
+    uint64_t  v = 0;
+    int       i;
+
+    for (i = 0; i < 8; i++)
+	v |= (uint64_t) p[i] << (msb_first ? 56 - 8 * i : 8 * i);
+    return v;
+}
+
+static inline void
+store_bits64 (uint8_t *p, uint64_t v, int msb_first)
+{
+    int  i;
+
+    for (i = 0; i < 8; i++)
+	p[i] = v >> (msb_first ? 56 - 8 * i : 8 * i);
+}
+
+/* Up to eight bits of a scanline from bit offset on, the
+   first where a byte's first bit goes.  No byte past the
+   last bit wanted is read. */
+static inline uint32_t
+get_bits8 (const uint8_t *  src,
+	   uint32_t         offset,
+	   uint32_t         n,
+	   int              msb_first,
+	   uint32_t         swap)
+{
+    uint32_t  q = offset >> 3;
+    uint32_t  r = offset & 7;
+    uint32_t  a = src[q ^ swap];
+    uint32_t  b = r + n > 8 ? src[(q + 1) ^ swap] : 0;
+
+    if (msb_first)
+	return ((a << r) | (b >> (8 - r))) & 0xff;
+    return ((a >> r) | (b << (8 - r))) & 0xff;
+}
+
+/* Store the first n bits of v at a bit offset, within one byte. */
+static inline void
+put_bits8 (uint8_t *  dst,
+	   uint32_t   offset,
+	   uint32_t   n,
+	   uint32_t   v,
+	   int        msb_first,
+	   uint32_t   swap)
+{
+    uint32_t  r = offset & 7;
+    uint8_t * bp = dst + ((offset >> 3) ^ swap);
+    uint8_t   mask;
+
+    if (msb_first) {
+	mask = ((0xff00 >> n) & 0xff) >> r;
+	v >>= r;
+    } else {
+	mask = ((1 << n) - 1) << r;
+	v <<= r;
+    }
+    *bp = (*bp & ~mask) | (v & mask);
+}
+
+void
+_xcb_image_copy_bits (const uint8_t *  src,
+		      uint32_t         src_offset,
+		      uint8_t *        dst,
+		      uint32_t         dst_offset,
+		      uint32_t         bits,
+		      int              msb_first,
+		      uint32_t         swap)
+{
+    uint32_t  q, r, d, n, k = 0;
+
+    /* Fill out the first destination byte. */
+    if (dst_offset & 7) {
+	uint32_t  head = 8 - (dst_offset & 7);
+
+	if (head > bits)
+	    head = bits;
+	put_bits8(dst, dst_offset, head,
+		  get_bits8(src, src_offset, head, msb_first, swap),
+		  msb_first, swap);
+	src_offset += head;
+	dst_offset += head;
+	bits -= head;
+    }
+    q = src_offset >> 3;
+    r = src_offset & 7;
+    d = dst_offset >> 3;
+    n = bits >> 3;
+    if (r == 0 && swap == 0) {
+	memcpy(dst + d, src + q, n);
+	k = n;
+    } else if (swap == 0) {
+	/* Whole bytes of output take r bits of the byte after
+	   their last, which lies inside the run since r > 0. */
+	for (; k + 8 <= n; k += 8) {
+	    uint64_t  v = load_bits64(src + q + k, msb_first);
+	    uint32_t  next = src[q + k + 8];
+
+	    if (msb_first)
+		v = (v << r) | (next >> (8 - r));
+	    else
+		v = (v >> r) | ((uint64_t) next << (64 - r));
+	    store_bits64(dst + d + k, v, msb_first);
+	}
+    }
+    for (; k < n; k++)
+	dst[(d + k) ^ swap] = get_bits8(src, src_offset + 8 * k, 8,
+					msb_first, swap);
+    if (bits & 7)
+	put_bits8(dst, dst_offset + 8 * n, bits & 7,
+		  get_bits8(src, src_offset + 8 * n, bits & 7,
+			    msb_first, swap),
+		  msb_first, swap);
+}
+
+/*
+ * Scanline unpack/pack
+ */
+
+static inline uint32_t
+load16 (const uint8_t *p, int msb)
+{
+    if (msb)
+	return (p[0] << 8) | p[1];
+    return p[0] | (p[1] << 8);
+}
+
+static inline void
+store16 (uint8_t *p, uint32_t pixel, int msb)
+{
+    if (msb) {
+	p[0] = pixel >> 8;
+	p[1] = pixel;
+    } else {
+	p[0] = pixel;
+	p[1] = pixel >> 8;
+    }
+}
+
+/* Index xor applied to byte offsets within an xy scanline
+   unit when the byte and bit orders differ. */
+static uint32_t
+xy_byte_swap (xcb_image_t *image)
+{
+    if (image->byte_order == image->bit_order)
+	return 0;
+    return (image->unit >> 3) - 1;
+}
+
+/* Bit k of the byte holding pixels 8n .. 8n + 7 of a plane,
+   in pixel order, is the one for pixel 8n + k when LSB
+   first and 8n + 7 - k when MSB first. */
+
+static void
+unpack_xy_planes (xcb_image_t *image, uint32_t x, uint32_t y,
+		  uint32_t width, uint32_t *pixels)
+{
+    uint32_t   swap = xy_byte_swap(image);
+    int        msb = image->bit_order == XCB_IMAGE_ORDER_MSB_FIRST;
+    uint32_t   plane_size = image->stride * image->height;
+    uint8_t *  plane = image->data + y * image->stride;
+    int        p;
+
+    memset(pixels, 0, width * sizeof(*pixels));
+    for (p = image->depth - 1; p >= 0; p--, plane += plane_size) {
+	uint32_t  i = 0;
+
+	if (!((image->plane_mask >> p) & 1))
+	    continue;
+	while (i < width) {
+	    uint32_t   xx = x + i;
+	    uint8_t    b = plane[(xx >> 3) ^ swap];
+	    uint32_t * px = pixels + i;
+	    int        k;
+
+	    if (msb)
+		b = _xcb_image_bit_reverse_table[b];
+	    if ((xx & 7) == 0 && i + 8 <= width) {
+		for (k = 0; k < 8; k++)
+		    px[k] |= (uint32_t)((b >> k) & 1) << p;
+		i += 8;
+		continue;
+	    }
+	    /* partial byte at either end of the span */
+	    do {
+		*px++ |= (uint32_t)((b >> (xx & 7)) & 1) << p;
+		i++;
+		xx++;
+	    } while (i < width && (xx & 7));
+	}
+    }
+}
+
+static void
+pack_xy_planes (xcb_image_t *image, uint32_t x, uint32_t y,
+		uint32_t width, const uint32_t *pixels)
+{
+    uint32_t   swap = xy_byte_swap(image);
+    int        msb = image->bit_order == XCB_IMAGE_ORDER_MSB_FIRST;
+    uint32_t   plane_size = image->stride * image->height;
+    uint8_t *  plane = image->data + y * image->stride;
+    int        p;
+
+    for (p = image->depth - 1; p >= 0; p--, plane += plane_size) {
+	uint32_t  i = 0;
+
+	if (!((image->plane_mask >> p) & 1))
+	    continue;
+	while (i < width) {
+	    uint32_t          xx = x + i;
+	    uint8_t *         bp = plane + ((xx >> 3) ^ swap);
+	    const uint32_t *  px = pixels + i;
+	    uint8_t           m = 0;
+	    uint8_t           v = 0;
+	    int               k;
+
+	    if ((xx & 7) == 0 && i + 8 <= width) {
+		for (k = 0; k < 8; k++)
+		    v |= ((px[k] >> p) & 1) << k;
+		*bp = msb ? _xcb_image_bit_reverse_table[v] : v;
+		i += 8;
+		continue;
+	    }
+	    /* partial byte: gather the bits, then merge them
+	       in with a single store */
+	    do {
+		m |= 1 << (xx & 7);
+		v |= ((*px++ >> p) & 1) << (xx & 7);
+		i++;
+		xx++;
+	    } while (i < width && (xx & 7));
+	    if (msb) {
+		m = _xcb_image_bit_reverse_table[m];
+		v = _xcb_image_bit_reverse_table[v];
+	    }
+	    *bp = (*bp & ~m) | v;
+	}
+    }
+}
+
+/*
+ * Planar <-> chunky by bit matrix transposition.
+ *
+ * The plane-at-a-time loops above touch every pixel once per
+ * plane.  For whole blocks of pixels it is much cheaper to
+ * load one chunk of every plane and transpose the bit matrix:
+ * 8x8 (in a uint64_t) for depths up to 8, and 32x32 beyond.
+ * Row p of the matrix holds bit p of each pixel, column k
+ * holds pixel k.  AVX2 hosts use movemask/compare kernels
+ * for blocks of 32 pixels instead, whatever the depth.
+ */
+
+/* Swap element (r, c) with element (c, r), where element
+   (r, c) is bit 8r + c. */
+static inline uint64_t
+transpose8 (uint64_t x)
+{
+    uint64_t  t;
+
+    t = (x ^ (x >> 7)) & UINT64_C(0x00aa00aa00aa00aa);
+    x ^= t ^ (t << 7);
+    t = (x ^ (x >> 14)) & UINT64_C(0x0000cccc0000cccc);
+    x ^= t ^ (t << 14);
+    t = (x ^ (x >> 28)) & UINT64_C(0x00000000f0f0f0f0);
+    x ^= t ^ (t << 28);
+    return x;
+}
+
+/* Swap element (r, c) with element (c, r), where element
+   (r, c) is bit c of a[r] (Hacker's Delight 7-3). */
+static inline void
+transpose32 (uint32_t *a)
+{
+    uint32_t  j, k, m, t;
+
+    for (j = 16, m = 0x0000ffff; j; j >>= 1, m ^= m << j) {
+	for (k = 0; k < 32; k = (k + j + 1) & ~j) {
+	    t = ((a[k] >> j) ^ a[k + j]) & m;
+	    a[k + j] ^= t;
+	    a[k] ^= t << j;
+	}
+    }
+}
+
+/* Plane byte n, with its bits in pixel order. */
+static inline uint8_t
+plane_byte (const uint8_t *plane, uint32_t n, uint32_t swap, int msb)
+{
+    uint8_t  b = plane[n ^ swap];
+    return msb ? _xcb_image_bit_reverse_table[b] : b;
+}
+
+static inline void
+set_plane_byte (uint8_t *plane, uint32_t n, uint32_t swap, int msb,
+		uint8_t b)
+{
+    plane[n ^ swap] = msb ? _xcb_image_bit_reverse_table[b] : b;
+}
+
+/* The block routines cover pixels 8 * byte onwards; width
+   is a multiple of 8 (depth <= 8) or 32 (otherwise). */
+
+static void
+unpack_xy_blocks (xcb_image_t *image, uint32_t byte, uint32_t y,
+		  uint32_t width, uint32_t *pixels)
+{
+    uint32_t   swap = xy_byte_swap(image);
+    int        msb = image->bit_order == XCB_IMAGE_ORDER_MSB_FIRST;
+    uint32_t   plane_size = image->stride * image->height;
+    uint8_t *  row = image->data + y * image->stride;
+    int        depth = image->depth;
+    uint32_t   pm = image->plane_mask & xcb_mask(depth);
+    uint32_t   i;
+
+    if (depth <= 8) {
+	for (i = 0; i < width; i += 8, byte++) {
+	    uint8_t *  plane = row;
+	    uint64_t   v = 0;
+	    int        p, k;
+
+	    for (p = depth - 1; p >= 0; p--, plane += plane_size)
+		if ((pm >> p) & 1)
+		    v |= (uint64_t) plane_byte(plane, byte, swap, msb) << (p << 3);
+	    v = transpose8(v);
+	    for (k = 0; k < 8; k++)
+		pixels[i + k] = (v >> (k << 3)) & 0xff;
+	}
+	return;
+    }
+    for (i = 0; i < width; i += 32, byte += 4) {
+	uint8_t *  plane = row;
+	uint32_t   a[32];
+	int        p;
+
+	memset(a, 0, sizeof(a));
+	for (p = depth - 1; p >= 0; p--, plane += plane_size)
+	    if ((pm >> p) & 1)
+		a[p] = plane_byte(plane, byte, swap, msb) |
+		    (plane_byte(plane, byte + 1, swap, msb) << 8) |
+		    (plane_byte(plane, byte + 2, swap, msb) << 16) |
+		    ((uint32_t) plane_byte(plane, byte + 3, swap, msb) << 24);
+	transpose32(a);
+	memcpy(pixels + i, a, sizeof(a));
+    }
+}
+
+static void
+pack_xy_blocks (xcb_image_t *image, uint32_t byte, uint32_t y,
+		uint32_t width, const uint32_t *pixels)
+{
+    uint32_t   swap = xy_byte_swap(image);
+    int        msb = image->bit_order == XCB_IMAGE_ORDER_MSB_FIRST;
+    uint32_t   plane_size = image->stride * image->height;
+    uint8_t *  row = image->data + y * image->stride;
+    int        depth = image->depth;
+    uint32_t   pm = image->plane_mask;
+    uint32_t   i;
+
+    if (depth <= 8) {
+	for (i = 0; i < width; i += 8, byte++) {
+	    uint8_t *  plane = row;
+	    uint64_t   v = 0;
+	    int        p, k;
+
+	    for (k = 0; k < 8; k++)
+		v |= (uint64_t) (pixels[i + k] & 0xff) << (k << 3);
+	    v = transpose8(v);
+	    for (p = depth - 1; p >= 0; p--, plane += plane_size)
+		if ((pm >> p) & 1)
+		    set_plane_byte(plane, byte, swap, msb, v >> (p << 3));
+	}
+	return;
+    }
+    for (i = 0; i < width; i += 32, byte += 4) {
+	uint8_t *  plane = row;
+	uint32_t   a[32];
+	int        p;
+
+	memcpy(a, pixels + i, sizeof(a));
+	transpose32(a);
+	for (p = depth - 1; p >= 0; p--, plane += plane_size)
+	    if ((pm >> p) & 1) {
+		set_plane_byte(plane, byte, swap, msb, a[p]);
+		set_plane_byte(plane, byte + 1, swap, msb, a[p] >> 8);
+		set_plane_byte(plane, byte + 2, swap, msb, a[p] >> 16);
+		set_plane_byte(plane, byte + 3, swap, msb, a[p] >> 24);
+	    }
+    }
+}
+
+#ifdef XCB_KERNELS_X86
+
+/* Planes to pixels: each plane byte is broadcast, tested
+   against a one-bit-per-lane selector and shifted into the
+   pixel accumulators, most significant plane first. */
+__attribute__((target("avx2")))
+static void
+unpack_xy_blocks_avx2 (xcb_image_t *image, uint32_t byte, uint32_t y,
+		       uint32_t width, uint32_t *pixels)
+{
+    uint32_t   swap = xy_byte_swap(image);
+    int        msb = image->bit_order == XCB_IMAGE_ORDER_MSB_FIRST;
+    uint32_t   plane_size = image->stride * image->height;
+    uint8_t *  row = image->data + y * image->stride;
+    int        depth = image->depth;
+    uint32_t   pm = image->plane_mask;
+    __m256i    sel = _mm256_setr_epi32(1, 2, 4, 8, 16, 32, 64, 128);
+    uint32_t   i;
+
+    for (i = 0; i < width; i += 32, byte += 4) {
+	uint8_t *  plane = row;
+	__m256i    acc[4];
+	int        p, k;
+
+	for (k = 0; k < 4; k++)
+	    acc[k] = _mm256_setzero_si256();
+	for (p = depth - 1; p >= 0; p--, plane += plane_size) {
+	    int  on = (pm >> p) & 1;
+	    for (k = 0; k < 4; k++) {
+		acc[k] = _mm256_add_epi32(acc[k], acc[k]);
+		if (on) {
+		    __m256i  b = _mm256_set1_epi32(
+			plane_byte(plane, byte + k, swap, msb));
+		    /* a set bit compares to -1: subtract it */
+		    acc[k] = _mm256_sub_epi32(acc[k],
+			_mm256_cmpeq_epi32(_mm256_and_si256(b, sel), sel));
+		}
+	    }
+	}
+	for (k = 0; k < 4; k++)
+	    _mm256_storeu_si256((__m256i *) (pixels + i + 8 * k), acc[k]);
+    }
+}
+
+/* Pixels to planes: with the pixels shifted so the current
+   plane is in the sign bit, movemask collects one plane
+   byte per eight pixels. */
+__attribute__((target("avx2")))
+static void
+pack_xy_blocks_avx2 (xcb_image_t *image, uint32_t byte, uint32_t y,
+		     uint32_t width, const uint32_t *pixels)
+{
+    uint32_t   swap = xy_byte_swap(image);
+    int        msb = image->bit_order == XCB_IMAGE_ORDER_MSB_FIRST;
+    uint32_t   plane_size = image->stride * image->height;
+    uint8_t *  row = image->data + y * image->stride;
+    int        depth = image->depth;
+    uint32_t   pm = image->plane_mask;
+    __m128i    align = _mm_cvtsi32_si128(32 - depth);
+    uint32_t   i;
+
+    for (i = 0; i < width; i += 32, byte += 4) {
+	uint8_t *  plane = row;
+	__m256i    v[4];
+	int        p, k;
+
+	for (k = 0; k < 4; k++)
+	    v[k] = _mm256_sll_epi32(
+		_mm256_loadu_si256((const __m256i *) (pixels + i + 8 * k)),
+		align);
+	for (p = depth - 1; p >= 0; p--, plane += plane_size) {
+	    for (k = 0; k < 4; k++) {
+		if ((pm >> p) & 1)
+		    set_plane_byte(plane, byte + k, swap, msb,
+			_mm256_movemask_ps(_mm256_castsi256_ps(v[k])));
+		v[k] = _mm256_add_epi32(v[k], v[k]);
+	    }
+	}
+    }
+}
+
+#endif /* XCB_KERNELS_X86 */
+
+static void
+unpack_xy (xcb_image_t *image, uint32_t x, uint32_t y,
+	   uint32_t width, uint32_t *pixels)
+{
+    uint32_t  block = image->depth <= 8 ? 8 : 32;
+    uint32_t  lead;
+    uint32_t  n;
+
+    x += image->x_offset;
+    lead = (8 - (x & 7)) & 7;
+    if (lead > width)
+	lead = width;
+    if (lead) {
+	unpack_xy_planes(image, x, y, lead, pixels);
+	x += lead;
+	pixels += lead;
+	width -= lead;
+    }
+#ifdef XCB_KERNELS_X86
+    n = xcb_rounddown_2(width, 32);
+    if (n && cpu_level() >= LEVEL_AVX2) {
+	unpack_xy_blocks_avx2(image, x >> 3, y, n, pixels);
+	x += n;
+	pixels += n;
+	width -= n;
+    }
+#endif
+    n = xcb_rounddown_2(width, block);
+    if (n)
+	unpack_xy_blocks(image, x >> 3, y, n, pixels);
+    if (width > n)
+	unpack_xy_planes(image, x + n, y, width - n, pixels + n);
+}
+
+static void
+pack_xy (xcb_image_t *image, uint32_t x, uint32_t y,
+	 uint32_t width, const uint32_t *pixels)
+{
+    uint32_t  block = image->depth <= 8 ? 8 : 32;
+    uint32_t  lead;
+    uint32_t  n;
+
+    x += image->x_offset;
+    lead = (8 - (x & 7)) & 7;
+    if (lead > width)
+	lead = width;
+    if (lead) {
+	pack_xy_planes(image, x, y, lead, pixels);
+	x += lead;
+	pixels += lead;
+	width -= lead;
+    }
+#ifdef XCB_KERNELS_X86
+    n = xcb_rounddown_2(width, 32);
+    if (n && cpu_level() >= LEVEL_AVX2) {
+	pack_xy_blocks_avx2(image, x >> 3, y, n, pixels);
+	x += n;
+	pixels += n;
+	width -= n;
+    }
+#endif
+    n = xcb_rounddown_2(width, block);
+    if (n)
+	pack_xy_blocks(image, x >> 3, y, n, pixels);
+    if (width > n)
+	pack_xy_planes(image, x + n, y, width - n, pixels + n);
+}
+
+static void
+unpack_z4 (xcb_image_t *image, uint32_t x, uint32_t y,
+	   uint32_t width, uint32_t *pixels)
+{
+    uint8_t *  row = image->data + y * image->stride;
+    uint32_t   hi = image->byte_order == XCB_IMAGE_ORDER_MSB_FIRST;
+    uint32_t   i;
+
+    x += image->x_offset;
+    for (i = 0; i < width; i++) {
+	uint32_t  xx = x + i;
+	uint8_t   b = row[xx >> 1];
+	pixels[i] = (xx & 1) == hi ? b >> 4 : b & 0xf;
+    }
+}
+
+static void
+pack_z4 (xcb_image_t *image, uint32_t x, uint32_t y,
+	 uint32_t width, const uint32_t *pixels)
+{
+    uint8_t *  row = image->data + y * image->stride;
+    uint32_t   hi = image->byte_order == XCB_IMAGE_ORDER_MSB_FIRST;
+    uint32_t   i = 0;
+
+    x += image->x_offset;
+    /* Whole bytes at a time once x is even. */
+    if (x & 1) {
+	uint8_t *  bp = row + (x >> 1);
+	uint8_t    v = pixels[0] & 0xf;
+	*bp = hi ? (*bp & 0x0f) | (v << 4) : (*bp & 0xf0) | v;
+	i = 1;
+    }
+    for (; i + 2 <= width; i += 2) {
+	uint8_t  a = pixels[i] & 0xf;
+	uint8_t  b = pixels[i + 1] & 0xf;
+	row[(x + i) >> 1] = hi ? a | (b << 4) : (a << 4) | b;
+    }
+    if (i < width) {
+	uint32_t  xx = x + i;
+	uint8_t * bp = row + (xx >> 1);
+	uint8_t   v = pixels[i] & 0xf;
+	if ((xx & 1) == hi)
+	    *bp = (*bp & 0x0f) | (v << 4);
+	else
+	    *bp = (*bp & 0xf0) | v;
+    }
+}
+
+#ifdef XCB_KERNELS_X86
+
+/* Widening is interleaving with zeros; narrowing has to
+   keep the low bits through signed saturating packs, so
+   they are masked (8 bits) or sign extended (16 bits)
+   first.  Pixels wider than the format are truncated, as
+   xcb_image_put_pixel() does. */
+
+__attribute__((target("sse2")))
+static uint32_t
+unpack_z8_sse2 (const uint8_t *row, uint32_t *pixels, uint32_t width)
+{
+    __m128i   zero = _mm_setzero_si128();
+    uint32_t  i;
+
+    for (i = 0; i + 16 <= width; i += 16) {
+	__m128i  v = _mm_loadu_si128((const __m128i *) (row + i));
+	__m128i  lo = _mm_unpacklo_epi8(v, zero);
+	__m128i  hi = _mm_unpackhi_epi8(v, zero);
+
+	_mm_storeu_si128((__m128i *) (pixels + i), _mm_unpacklo_epi16(lo, zero));
+	_mm_storeu_si128((__m128i *) (pixels + i + 4), _mm_unpackhi_epi16(lo, zero));
+	_mm_storeu_si128((__m128i *) (pixels + i + 8), _mm_unpacklo_epi16(hi, zero));
+	_mm_storeu_si128((__m128i *) (pixels + i + 12), _mm_unpackhi_epi16(hi, zero));
+    }
+    return i;
+}
+
+__attribute__((target("sse2")))
+static uint32_t
+pack_z8_sse2 (const uint32_t *pixels, uint8_t *row, uint32_t width)
+{
+    __m128i   mask = _mm_set1_epi32(0xff);
+    uint32_t  i;
+
+    for (i = 0; i + 16 <= width; i += 16) {
+	__m128i  v[4];
+	int      k;
+
+	for (k = 0; k < 4; k++)
+	    v[k] = _mm_and_si128(mask,
+		_mm_loadu_si128((const __m128i *) (pixels + i + 4 * k)));
+	_mm_storeu_si128((__m128i *) (row + i),
+	    _mm_packus_epi16(_mm_packs_epi32(v[0], v[1]),
+			     _mm_packs_epi32(v[2], v[3])));
+    }
+    return i;
+}
+
+__attribute__((target("sse2")))
+static uint32_t
+unpack_z16_sse2 (const uint8_t *row, uint32_t *pixels, uint32_t width,
+		 int msb)
+{
+    __m128i   zero = _mm_setzero_si128();
+    uint32_t  i;
+
+    for (i = 0; i + 8 <= width; i += 8) {
+	__m128i  v = _mm_loadu_si128((const __m128i *) (row + (i << 1)));
+
+	if (msb)
+	    v = _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+	_mm_storeu_si128((__m128i *) (pixels + i), _mm_unpacklo_epi16(v, zero));
+	_mm_storeu_si128((__m128i *) (pixels + i + 4), _mm_unpackhi_epi16(v, zero));
+    }
+    return i;
+}
+
+__attribute__((target("sse2")))
+static uint32_t
+pack_z16_sse2 (const uint32_t *pixels, uint8_t *row, uint32_t width,
+	       int msb)
+{
+    uint32_t  i;
+
+    for (i = 0; i + 8 <= width; i += 8) {
+	__m128i  a = _mm_loadu_si128((const __m128i *) (pixels + i));
+	__m128i  b = _mm_loadu_si128((const __m128i *) (pixels + i + 4));
+	__m128i  v;
+
+	a = _mm_srai_epi32(_mm_slli_epi32(a, 16), 16);
+	b = _mm_srai_epi32(_mm_slli_epi32(b, 16), 16);
+	v = _mm_packs_epi32(a, b);
+	if (msb)
+	    v = _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+	_mm_storeu_si128((__m128i *) (row + (i << 1)), v);
+    }
+    return i;
+}
+
+#endif /* XCB_KERNELS_X86 */
+
+static void
+unpack_z8 (xcb_image_t *image, uint32_t x, uint32_t y,
+	   uint32_t width, uint32_t *pixels)
+{
+    uint8_t *  row = image->data + y * image->stride + image->x_offset + x;
+    uint32_t   i = 0;
+
+#ifdef XCB_KERNELS_X86
+    if (cpu_level() >= LEVEL_SSE2)
+	i = unpack_z8_sse2(row, pixels, width);
+#endif
+    for (; i < width; i++)
+	pixels[i] = row[i];
+}
+
+static void
+pack_z8 (xcb_image_t *image, uint32_t x, uint32_t y,
+	 uint32_t width, const uint32_t *pixels)
+{
+    uint8_t *  row = image->data + y * image->stride + image->x_offset + x;
+    uint32_t   i = 0;
+
+#ifdef XCB_KERNELS_X86
+    if (cpu_level() >= LEVEL_SSE2)
+	i = pack_z8_sse2(pixels, row, width);
+#endif
+    for (; i < width; i++)
+	row[i] = pixels[i];
+}
+
+static void
+unpack_z16 (xcb_image_t *image, uint32_t x, uint32_t y,
+	    uint32_t width, uint32_t *pixels)
+{
+    uint8_t *  row = image->data + y * image->stride +
+	((image->x_offset + x) << 1);
+    int        msb = image->byte_order == XCB_IMAGE_ORDER_MSB_FIRST;
+    uint32_t   i = 0;
+
+#ifdef XCB_KERNELS_X86
+    if (cpu_level() >= LEVEL_SSE2)
+	i = unpack_z16_sse2(row, pixels, width, msb);
+#endif
+    for (; i < width; i++)
+	pixels[i] = load16(row + (i << 1), msb);
+}
+
+static void
+pack_z16 (xcb_image_t *image, uint32_t x, uint32_t y,
+	  uint32_t width, const uint32_t *pixels)
+{
+    uint8_t *  row = image->data + y * image->stride +
+	((image->x_offset + x) << 1);
+    int        msb = image->byte_order == XCB_IMAGE_ORDER_MSB_FIRST;
+    uint32_t   i = 0;
+
+#ifdef XCB_KERNELS_X86
+    if (cpu_level() >= LEVEL_SSE2)
+	i = pack_z16_sse2(pixels, row, width, msb);
+#endif
+    for (; i < width; i++)
+	store16(row + (i << 1), pixels[i], msb);
+}
+
+/* 32 bpp pixels are the canonical array in either byte
+   order, so these are a copy or a byte swap. */
+static void
+unpack_z32 (xcb_image_t *image, uint32_t x, uint32_t y,
+	    uint32_t width, uint32_t *pixels)
+{
+    uint8_t *  row = image->data + y * image->stride +
+	((image->x_offset + x) << 2);
+
+    if (image->byte_order == xcb_host_byte_order())
+	memcpy(pixels, row, width << 2);
+    else
+	_xcb_image_swap_row(row, (uint8_t *) pixels, width << 2, 3, 0, 0);
+}
+
+static void
+pack_z32 (xcb_image_t *image, uint32_t x, uint32_t y,
+	  uint32_t width, const uint32_t *pixels)
+{
+    uint8_t *  row = image->data + y * image->stride +
+	((image->x_offset + x) << 2);
+
+    if (image->byte_order == xcb_host_byte_order())
+	memcpy(row, pixels, width << 2);
+    else
+	_xcb_image_swap_row((const uint8_t *) pixels, row, width << 2, 3, 0, 0);
+}
+
+/* The 24 bpp cases only differ in byte order; stamp
+   them out. */
+#define Z_UNPACK_PACK(bits, size, order, msb)				\
+static void								\
+unpack_z##bits##order (xcb_image_t *image, uint32_t x, uint32_t y,	\
+		       uint32_t width, uint32_t *pixels)		\
+{									\
+    uint8_t *  row = image->data + y * image->stride +		\
+	(image->x_offset + x) * (size);					\
+    uint32_t   i;							\
+									\
+    for (i = 0; i < width; i++, row += (size))				\
+	pixels[i] = load##bits(row, msb);				\
+}									\
+									\
+static void								\
+pack_z##bits##order (xcb_image_t *image, uint32_t x, uint32_t y,	\
+		     uint32_t width, const uint32_t *pixels)		\
+{									\
+    uint8_t *  row = image->data + y * image->stride +		\
+	(image->x_offset + x) * (size);					\
+    uint32_t   i;							\
+									\
+    for (i = 0; i < width; i++, row += (size))				\
+	store##bits(row, pixels[i], msb);				\
+}
+
+Z_UNPACK_PACK(24, 3, L, 0)
+Z_UNPACK_PACK(24, 3, M, 1)
+
+#undef Z_UNPACK_PACK
+
+xcb_image_unpack_func_t
+_xcb_image_unpacker (xcb_image_t *image)
+{
+    int  msb = image->byte_order == XCB_IMAGE_ORDER_MSB_FIRST;
+
+    if (image->format != XCB_IMAGE_FORMAT_Z_PIXMAP || image->bpp == 1)
+	return unpack_xy;
+    switch (image->bpp) {
+    case 4:
+	return unpack_z4;
+    case 8:
+	return unpack_z8;
+    case 16:
+	return unpack_z16;
+    case 24:
+	return msb ? unpack_z24M : unpack_z24L;
+    case 32:
+	return unpack_z32;
+    }
+    return 0;
+}
+
+xcb_image_pack_func_t
+_xcb_image_packer (xcb_image_t *image)
+{
+    int  msb = image->byte_order == XCB_IMAGE_ORDER_MSB_FIRST;
+
+    if (image->format != XCB_IMAGE_FORMAT_Z_PIXMAP || image->bpp == 1)
+	return pack_xy;
+    switch (image->bpp) {
+    case 4:
+	return pack_z4;
+    case 8:
+	return pack_z8;
+    case 16:
+	return pack_z16;
+    case 24:
+	return msb ? pack_z24M : pack_z24L;
+    case 32:
+	return pack_z32;
+    }
+    return 0;
+}
+
+/*
+ * Scanline fills
+ */
+
+static void
+fill_z8 (xcb_image_t *image, uint32_t x, uint32_t y,
+	 uint32_t width, uint32_t pixel)
+{
+    memset(image->data + y * image->stride + image->x_offset + x,
+	   pixel, width);
+}
+
+/* The pixel is stored once in the image's byte order, then
+   copied out eight bytes at a time. */
+static void
+fill_z16 (xcb_image_t *image, uint32_t x, uint32_t y,
+	  uint32_t width, uint32_t pixel)
+{
+    uint8_t *  row = image->data + y * image->stride +
+	((image->x_offset + x) << 1);
+    uint8_t    p[8];
+    uint32_t   i;
+
+    for (i = 0; i < 8; i += 2)
+	store16(p + i, pixel, image->byte_order == XCB_IMAGE_ORDER_MSB_FIRST);
+    for (i = 0; i + 4 <= width; i += 4)
+	memcpy(row + (i << 1), p, 8);
+    for (; i < width; i++)
+	memcpy(row + (i << 1), p, 2);
+}
+
+static void
+fill_z32 (xcb_image_t *image, uint32_t x, uint32_t y,
+	  uint32_t width, uint32_t pixel)
+{
+    uint8_t *  row = image->data + y * image->stride +
+	((image->x_offset + x) << 2);
+    uint8_t    p[8];
+    uint32_t   i;
+
+    for (i = 0; i < 8; i += 4)
+	store32(p + i, pixel, image->byte_order == XCB_IMAGE_ORDER_MSB_FIRST);
+    for (i = 0; i + 2 <= width; i += 2)
+	memcpy(row + (i << 2), p, 8);
+    if (i < width)
+	memcpy(row + (i << 2), p, 4);
+}
+
+/* Anything else is packed from a run of the pixel. */
+static void
+fill_packed (xcb_image_t *image, uint32_t x, uint32_t y,
+	     uint32_t width, uint32_t pixel)
+{
+    xcb_image_pack_func_t  pack = _xcb_image_packer(image);
+    uint32_t               run[64];
+    uint32_t               i, n;
+
+    for (i = 0; i < 64; i++)
+	run[i] = pixel;
+    for (i = 0; i < width; i += n) {
+	n = width - i < 64 ? width - i : 64;
+	pack(image, x + i, y, n, run);
+    }
+}
+
+xcb_image_fill_func_t
+_xcb_image_filler (xcb_image_t *image)
+{
+    if (image->format != XCB_IMAGE_FORMAT_Z_PIXMAP || image->bpp == 1)
+	return fill_packed;
+    switch (image->bpp) {
+    case 8:
+	return fill_z8;
+    case 16:
+	return fill_z16;
+    case 32:
+	return fill_z32;
+    }
+    return fill_packed;
+}
+
+
+void
+xcb_bit_reverse_bytes (const uint8_t *  src,
+		       uint8_t *        dst,
+		       uint32_t         bytes)
+{
+    uint32_t  i = 0;
+
+#ifdef XCB_KERNELS_X86
+    switch (cpu_level()) {
+    case LEVEL_AVX512:
+	i = swap_row_avx512(src, dst, bytes, 0, 1, 0);
+	break;
+    case LEVEL_AVX2:
+	i = swap_row_avx2(src, dst, bytes, 0, 1, 0);
+	break;
+    case LEVEL_SSSE3:
+	i = swap_row_ssse3(src, dst, bytes, 0, 1, 0);
+	break;
+    }
+#endif
+    for (; i < bytes; i++)
+	dst[i] = _xcb_image_bit_reverse_table[src[i]];
+}
+
+
+/*
+ * Truecolor channel remapping
+ *
+ * Every channel is the same handful of shifts and masks with
+ * counts that are uniform across the scanline, which maps
+ * directly onto the SSE2/AVX2/AVX-512 shift-by-register forms.
+ */
+
+static void
+mask_shift_width (uint32_t mask, uint32_t *shift, uint32_t *width)
+{
+    uint32_t  s = 0;
+
+    if (!mask) {
+	*shift = *width = 0;
+	return;
+    }
+    while (!((mask >> s) & 1))
+	s++;
+    *shift = s;
+    *width = xcb_popcount(mask);
+}
+
+void
+_xcb_image_remap_init (xcb_image_remap_t *  remap,
+		       const uint32_t *     src_masks,
+		       const uint32_t *     dst_masks)
+{
+    int  c;
+
+    memset(remap, 0, sizeof(*remap));
+    for (c = 0; c < 4; c++) {
+	uint32_t  ss, sw, ds, dw;
+
+	mask_shift_width(src_masks[c], &ss, &sw);
+	mask_shift_width(dst_masks[c], &ds, &dw);
+	if (!dw)
+	    continue;
+	if (!sw) {
+	    /* only alpha can be missing on the way in */
+	    if (c == 3)
+		remap->fill |= dst_masks[c];
+	    continue;
+	}
+	remap->channel[c].src_shift = ss;
+	remap->channel[c].src_mask = xcb_mask(sw);
+	remap->channel[c].dst_shift = ds;
+	remap->channel[c].dst_mask = xcb_mask(dw);
+	remap->channel[c].repeat = sw;	/* shifts everything out */
+	if (dw > sw) {
+	    remap->channel[c].up = dw - sw;
+	    if (2 * sw >= dw)
+		remap->channel[c].repeat = 2 * sw - dw;
+	} else {
+	    remap->channel[c].down = sw - dw;
+	}
+    }
+    remap->identity = !remap->fill;
+    for (c = 0; c < 4; c++)
+	if (src_masks[c] != dst_masks[c])
+	    remap->identity = 0;
+}
+
+/* Unpremultiplying divides by alpha, rounding to nearest:
+   (c * 255 + a / 2) / a.  The dividend is under 2^16, so
+   adding a half and multiplying by a single precision 1 / a
+   truncates to the exact quotient for every result up to
+   255; the half keeps exact multiples from rounding down. */
+static const float unpremultiply_rcp[256] = {
+    0, 1.f / 1, 1.f / 2, 1.f / 3, 1.f / 4, 1.f / 5, 1.f / 6, 1.f / 7,
+    1.f / 8, 1.f / 9, 1.f / 10, 1.f / 11, 1.f / 12, 1.f / 13, 1.f / 14, 1.f / 15,
+    1.f / 16, 1.f / 17, 1.f / 18, 1.f / 19, 1.f / 20, 1.f / 21, 1.f / 22, 1.f / 23,
+    1.f / 24, 1.f / 25, 1.f / 26, 1.f / 27, 1.f / 28, 1.f / 29, 1.f / 30, 1.f / 31,
+    1.f / 32, 1.f / 33, 1.f / 34, 1.f / 35, 1.f / 36, 1.f / 37, 1.f / 38, 1.f / 39,
+    1.f / 40, 1.f / 41, 1.f / 42, 1.f / 43, 1.f / 44, 1.f / 45, 1.f / 46, 1.f / 47,
+    1.f / 48, 1.f / 49, 1.f / 50, 1.f / 51, 1.f / 52, 1.f / 53, 1.f / 54, 1.f / 55,
+    1.f / 56, 1.f / 57, 1.f / 58, 1.f / 59, 1.f / 60, 1.f / 61, 1.f / 62, 1.f / 63,
+    1.f / 64, 1.f / 65, 1.f / 66, 1.f / 67, 1.f / 68, 1.f / 69, 1.f / 70, 1.f / 71,
+    1.f / 72, 1.f / 73, 1.f / 74, 1.f / 75, 1.f / 76, 1.f / 77, 1.f / 78, 1.f / 79,
+    1.f / 80, 1.f / 81, 1.f / 82, 1.f / 83, 1.f / 84, 1.f / 85, 1.f / 86, 1.f / 87,
+    1.f / 88, 1.f / 89, 1.f / 90, 1.f / 91, 1.f / 92, 1.f / 93, 1.f / 94, 1.f / 95,
+    1.f / 96, 1.f / 97, 1.f / 98, 1.f / 99, 1.f / 100, 1.f / 101, 1.f / 102, 1.f / 103,
+    1.f / 104, 1.f / 105, 1.f / 106, 1.f / 107, 1.f / 108, 1.f / 109, 1.f / 110, 1.f / 111,
+    1.f / 112, 1.f / 113, 1.f / 114, 1.f / 115, 1.f / 116, 1.f / 117, 1.f / 118, 1.f / 119,
+    1.f / 120, 1.f / 121, 1.f / 122, 1.f / 123, 1.f / 124, 1.f / 125, 1.f / 126, 1.f / 127,
+    1.f / 128, 1.f / 129, 1.f / 130, 1.f / 131, 1.f / 132, 1.f / 133, 1.f / 134, 1.f / 135,
+    1.f / 136, 1.f / 137, 1.f / 138, 1.f / 139, 1.f / 140, 1.f / 141, 1.f / 142, 1.f / 143,
+    1.f / 144, 1.f / 145, 1.f / 146, 1.f / 147, 1.f / 148, 1.f / 149, 1.f / 150, 1.f / 151,
+    1.f / 152, 1.f / 153, 1.f / 154, 1.f / 155, 1.f / 156, 1.f / 157, 1.f / 158, 1.f / 159,
+    1.f / 160, 1.f / 161, 1.f / 162, 1.f / 163, 1.f / 164, 1.f / 165, 1.f / 166, 1.f / 167,
+    1.f / 168, 1.f / 169, 1.f / 170, 1.f / 171, 1.f / 172, 1.f / 173, 1.f / 174, 1.f / 175,
+    1.f / 176, 1.f / 177, 1.f / 178, 1.f / 179, 1.f / 180, 1.f / 181, 1.f / 182, 1.f / 183,
+    1.f / 184, 1.f / 185, 1.f / 186, 1.f / 187, 1.f / 188, 1.f / 189, 1.f / 190, 1.f / 191,
+    1.f / 192, 1.f / 193, 1.f / 194, 1.f / 195, 1.f / 196, 1.f / 197, 1.f / 198, 1.f / 199,
+    1.f / 200, 1.f / 201, 1.f / 202, 1.f / 203, 1.f / 204, 1.f / 205, 1.f / 206, 1.f / 207,
+    1.f / 208, 1.f / 209, 1.f / 210, 1.f / 211, 1.f / 212, 1.f / 213, 1.f / 214, 1.f / 215,
+    1.f / 216, 1.f / 217, 1.f / 218, 1.f / 219, 1.f / 220, 1.f / 221, 1.f / 222, 1.f / 223,
+    1.f / 224, 1.f / 225, 1.f / 226, 1.f / 227, 1.f / 228, 1.f / 229, 1.f / 230, 1.f / 231,
+    1.f / 232, 1.f / 233, 1.f / 234, 1.f / 235, 1.f / 236, 1.f / 237, 1.f / 238, 1.f / 239,
+    1.f / 240, 1.f / 241, 1.f / 242, 1.f / 243, 1.f / 244, 1.f / 245, 1.f / 246, 1.f / 247,
+    1.f / 248, 1.f / 249, 1.f / 250, 1.f / 251, 1.f / 252, 1.f / 253, 1.f / 254, 1.f / 255
+};
+
+static inline uint32_t
+premultiply_pixel (uint32_t p)
+{
+    uint32_t  a = p >> 24;
+    uint32_t  out = p & 0xff000000;
+    int       s;
+
+    for (s = 0; s < 24; s += 8) {
+	uint32_t  t = ((p >> s) & 0xff) * a + 128;
+	out |= ((t + (t >> 8)) >> 8) << s;
+    }
+    return out;
+}
+
+static inline uint32_t
+unpremultiply_pixel (uint32_t p)
+{
+    uint32_t  a = p >> 24;
+    float     r = unpremultiply_rcp[a];
+    uint32_t  out = p & 0xff000000;
+    int       s;
+
+    for (s = 0; s < 24; s += 8) {
+	uint32_t  c = ((float) (((p >> s) & 0xff) * 255 + (a >> 1)) + 0.5f) * r;
+	out |= (c > 0xff ? 0xff : c) << s;
+    }
+    return out;
+}
+
+static inline uint32_t
+remap_pixel (uint32_t p, const xcb_image_remap_t *remap)
+{
+    uint32_t  out = remap->fill;
+    int       c;
+
+    if (remap->alpha == XCB_IMAGE_ALPHA_PREMULTIPLY)
+	p = premultiply_pixel(p);
+    else if (remap->alpha == XCB_IMAGE_ALPHA_UNPREMULTIPLY)
+	p = unpremultiply_pixel(p);
+    if (remap->identity)
+	return p;
+
+    for (c = 0; c < 4; c++) {
+	uint32_t  w;
+
+	if (!remap->channel[c].dst_mask)
+	    continue;
+	w = (p >> remap->channel[c].src_shift) & remap->channel[c].src_mask;
+	w = ((w << remap->channel[c].up) >> remap->channel[c].down) |
+	    (remap->channel[c].repeat < 32 ? w >> remap->channel[c].repeat : 0);
+	out |= (w & remap->channel[c].dst_mask) << remap->channel[c].dst_shift;
+    }
+    return out;
+}
+
+#ifdef XCB_KERNELS_X86
+
+/* Shift counts beyond 31 give 0 here, as they should. */
+
+#define COUNT(n)  _mm_cvtsi32_si128(n)
+
+/* Every product of two bytes fits the 16-bit multiply. */
+__attribute__((target("sse2")))
+static inline __m128i
+premultiply_m128 (__m128i p)
+{
+    __m128i  a = _mm_srli_epi32(p, 24);
+    __m128i  out = _mm_andnot_si128(_mm_set1_epi32(0xffffff), p);
+    __m128i  byte = _mm_set1_epi32(0xff);
+    __m128i  half = _mm_set1_epi32(128);
+    __m128i  t;
+
+    t = _mm_add_epi32(_mm_mullo_epi16(_mm_and_si128(p, byte), a), half);
+    out = _mm_or_si128(out, _mm_srli_epi32(
+	_mm_add_epi32(t, _mm_srli_epi32(t, 8)), 8));
+    t = _mm_add_epi32(_mm_mullo_epi16(
+	_mm_and_si128(_mm_srli_epi32(p, 8), byte), a), half);
+    out = _mm_or_si128(out, _mm_and_si128(
+	_mm_add_epi32(t, _mm_srli_epi32(t, 8)), _mm_set1_epi32(0xff00)));
+    t = _mm_add_epi32(_mm_mullo_epi16(
+	_mm_and_si128(_mm_srli_epi32(p, 16), byte), a), half);
+    out = _mm_or_si128(out, _mm_slli_epi32(_mm_srli_epi32(
+	_mm_add_epi32(t, _mm_srli_epi32(t, 8)), 8), 16));
+    return out;
+}
+
+__attribute__((target("avx2")))
+static inline __m256i
+premultiply_m256 (__m256i p)
+{
+    __m256i  a = _mm256_srli_epi32(p, 24);
+    __m256i  out = _mm256_andnot_si256(_mm256_set1_epi32(0xffffff), p);
+    __m256i  byte = _mm256_set1_epi32(0xff);
+    __m256i  half = _mm256_set1_epi32(128);
+    __m256i  t;
+
+    t = _mm256_add_epi32(_mm256_mullo_epi16(_mm256_and_si256(p, byte), a),
+			 half);
+    out = _mm256_or_si256(out, _mm256_srli_epi32(
+	_mm256_add_epi32(t, _mm256_srli_epi32(t, 8)), 8));
+    t = _mm256_add_epi32(_mm256_mullo_epi16(
+	_mm256_and_si256(_mm256_srli_epi32(p, 8), byte), a), half);
+    out = _mm256_or_si256(out, _mm256_and_si256(
+	_mm256_add_epi32(t, _mm256_srli_epi32(t, 8)),
+	_mm256_set1_epi32(0xff00)));
+    t = _mm256_add_epi32(_mm256_mullo_epi16(
+	_mm256_and_si256(_mm256_srli_epi32(p, 16), byte), a), half);
+    out = _mm256_or_si256(out, _mm256_slli_epi32(_mm256_srli_epi32(
+	_mm256_add_epi32(t, _mm256_srli_epi32(t, 8)), 8), 16));
+    return out;
+}
+
+/* Needs a gather, so AVX2 and up. */
+__attribute__((target("avx2")))
+static inline __m256i
+unpremultiply_m256 (__m256i p)
+{
+    __m256i  a = _mm256_srli_epi32(p, 24);
+    __m256   r = _mm256_i32gather_ps(unpremultiply_rcp, a, 4);
+    __m256i  half = _mm256_srli_epi32(a, 1);
+    __m256i  out = _mm256_andnot_si256(_mm256_set1_epi32(0xffffff), p);
+    __m256i  byte = _mm256_set1_epi32(0xff);
+    int      s;
+
+    for (s = 0; s < 24; s += 8) {
+	__m256i  c = _mm256_and_si256(
+	    _mm256_srl_epi32(p, _mm_cvtsi32_si128(s)), byte);
+
+	c = _mm256_add_epi32(_mm256_mullo_epi16(c, byte), half);
+	c = _mm256_cvttps_epi32(_mm256_mul_ps(
+	    _mm256_add_ps(_mm256_cvtepi32_ps(c), _mm256_set1_ps(0.5f)), r));
+	out = _mm256_or_si256(out, _mm256_sll_epi32(_mm256_min_epu32(c, byte),
+						    _mm_cvtsi32_si128(s)));
+    }
+    return out;
+}
+
+__attribute__((target("avx512f,avx512bw")))
+static inline __m512i
+premultiply_m512 (__m512i p)
+{
+    __m512i  a = _mm512_srli_epi32(p, 24);
+    __m512i  out = _mm512_andnot_si512(_mm512_set1_epi32(0xffffff), p);
+    __m512i  byte = _mm512_set1_epi32(0xff);
+    __m512i  half = _mm512_set1_epi32(128);
+    int      s;
+
+    for (s = 0; s < 24; s += 8) {
+	__m512i  t = _mm512_add_epi32(_mm512_mullo_epi16(
+	    _mm512_and_si512(_mm512_srl_epi32(p, _mm_cvtsi32_si128(s)), byte),
+	    a), half);
+
+	t = _mm512_srli_epi32(_mm512_add_epi32(t, _mm512_srli_epi32(t, 8)), 8);
+	out = _mm512_or_si512(out, _mm512_sll_epi32(t, _mm_cvtsi32_si128(s)));
+    }
+    return out;
+}
+
+__attribute__((target("avx512f,avx512bw")))
+static inline __m512i
+unpremultiply_m512 (__m512i p)
+{
+    __m512i  a = _mm512_srli_epi32(p, 24);
+    __m512   r = _mm512_i32gather_ps(a, unpremultiply_rcp, 4);
+    __m512i  half = _mm512_srli_epi32(a, 1);
+    __m512i  out = _mm512_andnot_si512(_mm512_set1_epi32(0xffffff), p);
+    __m512i  byte = _mm512_set1_epi32(0xff);
+    int      s;
+
+    for (s = 0; s < 24; s += 8) {
+	__m512i  c = _mm512_and_si512(
+	    _mm512_srl_epi32(p, _mm_cvtsi32_si128(s)), byte);
+
+	c = _mm512_add_epi32(_mm512_mullo_epi16(c, byte), half);
+	c = _mm512_cvttps_epi32(_mm512_mul_ps(
+	    _mm512_add_ps(_mm512_cvtepi32_ps(c), _mm512_set1_ps(0.5f)), r));
+	out = _mm512_or_si512(out, _mm512_sll_epi32(_mm512_min_epu32(c, byte),
+						    _mm_cvtsi32_si128(s)));
+    }
+    return out;
+}
+
+__attribute__((target("sse2")))
+static inline __m128i
+remap_m128 (__m128i p, const xcb_image_remap_t *remap)
+{
+    __m128i  out = _mm_set1_epi32(remap->fill);
+    int      c;
+
+    /* Callers leave unpremultiplying to the scalar code. */
+    if (remap->alpha == XCB_IMAGE_ALPHA_PREMULTIPLY)
+	p = premultiply_m128(p);
+    if (remap->identity)
+	return p;
+
+    for (c = 0; c < 4; c++) {
+	__m128i  w;
+
+	if (!remap->channel[c].dst_mask)
+	    continue;
+	w = _mm_and_si128(_mm_srl_epi32(p, COUNT(remap->channel[c].src_shift)),
+			  _mm_set1_epi32(remap->channel[c].src_mask));
+	w = _mm_or_si128(
+	    _mm_srl_epi32(_mm_sll_epi32(w, COUNT(remap->channel[c].up)),
+			  COUNT(remap->channel[c].down)),
+	    _mm_srl_epi32(w, COUNT(remap->channel[c].repeat)));
+	w = _mm_and_si128(w, _mm_set1_epi32(remap->channel[c].dst_mask));
+	out = _mm_or_si128(out,
+	    _mm_sll_epi32(w, COUNT(remap->channel[c].dst_shift)));
+    }
+    return out;
+}
+
+__attribute__((target("avx2")))
+static inline __m256i
+remap_m256 (__m256i p, const xcb_image_remap_t *remap)
+{
+    __m256i  out = _mm256_set1_epi32(remap->fill);
+    int      c;
+
+    if (remap->alpha == XCB_IMAGE_ALPHA_PREMULTIPLY)
+	p = premultiply_m256(p);
+    else if (remap->alpha == XCB_IMAGE_ALPHA_UNPREMULTIPLY)
+	p = unpremultiply_m256(p);
+    if (remap->identity)
+	return p;
+
+    for (c = 0; c < 4; c++) {
+	__m256i  w;
+
+	if (!remap->channel[c].dst_mask)
+	    continue;
+	w = _mm256_and_si256(
+	    _mm256_srl_epi32(p, COUNT(remap->channel[c].src_shift)),
+	    _mm256_set1_epi32(remap->channel[c].src_mask));
+	w = _mm256_or_si256(
+	    _mm256_srl_epi32(_mm256_sll_epi32(w, COUNT(remap->channel[c].up)),
+			     COUNT(remap->channel[c].down)),
+	    _mm256_srl_epi32(w, COUNT(remap->channel[c].repeat)));
+	w = _mm256_and_si256(w, _mm256_set1_epi32(remap->channel[c].dst_mask));
+	out = _mm256_or_si256(out,
+	    _mm256_sll_epi32(w, COUNT(remap->channel[c].dst_shift)));
+    }
+    return out;
+}
+
+__attribute__((target("avx512f,avx512bw")))
+static inline __m512i
+remap_m512 (__m512i p, const xcb_image_remap_t *remap)
+{
+    __m512i  out = _mm512_set1_epi32(remap->fill);
+    int      c;
+
+    if (remap->alpha == XCB_IMAGE_ALPHA_PREMULTIPLY)
+	p = premultiply_m512(p);
+    else if (remap->alpha == XCB_IMAGE_ALPHA_UNPREMULTIPLY)
+	p = unpremultiply_m512(p);
+    if (remap->identity)
+	return p;
+
+    for (c = 0; c < 4; c++) {
+	__m512i  w;
+
+	if (!remap->channel[c].dst_mask)
+	    continue;
+	w = _mm512_and_si512(
+	    _mm512_srl_epi32(p, COUNT(remap->channel[c].src_shift)),
+	    _mm512_set1_epi32(remap->channel[c].src_mask));
+	w = _mm512_or_si512(
+	    _mm512_srl_epi32(_mm512_sll_epi32(w, COUNT(remap->channel[c].up)),
+			     COUNT(remap->channel[c].down)),
+	    _mm512_srl_epi32(w, COUNT(remap->channel[c].repeat)));
+	w = _mm512_and_si512(w, _mm512_set1_epi32(remap->channel[c].dst_mask));
+	out = _mm512_or_si512(out,
+	    _mm512_sll_epi32(w, COUNT(remap->channel[c].dst_shift)));
+    }
+    return out;
+}
+
+#undef COUNT
+
+__attribute__((target("sse2")))
+static uint32_t
+remap_row_sse2 (uint32_t *pixels, uint32_t width,
+		const xcb_image_remap_t *remap)
+{
+    uint32_t  i = 0;
+
+    if (remap->alpha == XCB_IMAGE_ALPHA_UNPREMULTIPLY)
+	return 0;
+
+    for (; i + 4 <= width; i += 4) {
+	__m128i *  p = (__m128i *) (pixels + i);
+	_mm_storeu_si128(p, remap_m128(_mm_loadu_si128(p), remap));
+    }
+    return i;
+}
+
+__attribute__((target("avx2")))
+static uint32_t
+remap_row_avx2 (uint32_t *pixels, uint32_t width,
+		const xcb_image_remap_t *remap)
+{
+    uint32_t  i = 0;
+
+    for (; i + 8 <= width; i += 8) {
+	__m256i *  p = (__m256i *) (pixels + i);
+	_mm256_storeu_si256(p, remap_m256(_mm256_loadu_si256(p), remap));
+    }
+    return i;
+}
+
+/* Z32 to Z32 with the remap fused in; x86 is little endian,
+   so MSB first data is byte swapped on the way in or out. */
+__attribute__((target("ssse3")))
+static uint32_t
+remap_z32_ssse3 (const uint8_t *src, int src_msb, uint8_t *dst, int dst_msb,
+		 uint32_t width, const xcb_image_remap_t *remap)
+{
+    __m128i   bswap = _mm_load_si128((const __m128i *) byteswap_shuffle[3]);
+    uint32_t  i = 0;
+
+    if (remap->alpha == XCB_IMAGE_ALPHA_UNPREMULTIPLY)
+	return 0;
+
+    for (; i + 4 <= width; i += 4) {
+	__m128i  p = _mm_loadu_si128((const __m128i *) (src + (i << 2)));
+
+	if (src_msb)
+	    p = _mm_shuffle_epi8(p, bswap);
+	p = remap_m128(p, remap);
+	if (dst_msb)
+	    p = _mm_shuffle_epi8(p, bswap);
+	_mm_storeu_si128((__m128i *) (dst + (i << 2)), p);
+    }
+    return i;
+}
+
+__attribute__((target("avx2")))
+static uint32_t
+remap_z32_avx2 (const uint8_t *src, int src_msb, uint8_t *dst, int dst_msb,
+		uint32_t width, const xcb_image_remap_t *remap)
+{
+    __m256i   bswap = _mm256_broadcastsi128_si256(
+	_mm_load_si128((const __m128i *) byteswap_shuffle[3]));
+    uint32_t  i = 0;
+
+    for (; i + 8 <= width; i += 8) {
+	__m256i  p = _mm256_loadu_si256((const __m256i *) (src + (i << 2)));
+
+	if (src_msb)
+	    p = _mm256_shuffle_epi8(p, bswap);
+	p = remap_m256(p, remap);
+	if (dst_msb)
+	    p = _mm256_shuffle_epi8(p, bswap);
+	_mm256_storeu_si256((__m256i *) (dst + (i << 2)), p);
+    }
+    return i;
+}
+
+__attribute__((target("avx512f,avx512bw")))
+static uint32_t
+remap_row_avx512 (uint32_t *pixels, uint32_t width,
+		  const xcb_image_remap_t *remap)
+{
+    uint32_t  i;
+
+    for (i = 0; i < width; i += 16) {
+	__mmask16  k = width - i < 16 ? (1u << (width - i)) - 1 : 0xffff;
+	__m512i    p = _mm512_maskz_loadu_epi32(k, pixels + i);
+
+	_mm512_mask_storeu_epi32(pixels + i, k, remap_m512(p, remap));
+    }
+    return width;
+}
+
+__attribute__((target("avx512f,avx512bw")))
+static uint32_t
+remap_z32_avx512 (const uint8_t *src, int src_msb, uint8_t *dst, int dst_msb,
+		  uint32_t width, const xcb_image_remap_t *remap)
+{
+    __m512i   bswap = _mm512_broadcast_i32x4(
+	_mm_load_si128((const __m128i *) byteswap_shuffle[3]));
+    uint32_t  i;
+
+    for (i = 0; i < width; i += 16) {
+	__mmask16  k = width - i < 16 ? (1u << (width - i)) - 1 : 0xffff;
+	__m512i    p = _mm512_maskz_loadu_epi32(k, src + (i << 2));
+
+	if (src_msb)
+	    p = _mm512_shuffle_epi8(p, bswap);
+	p = remap_m512(p, remap);
+	if (dst_msb)
+	    p = _mm512_shuffle_epi8(p, bswap);
+	_mm512_mask_storeu_epi32(dst + (i << 2), k, p);
+    }
+    return width;
+}
+
+#endif /* XCB_KERNELS_X86 */
+
+void
+_xcb_image_remap_z32 (const uint8_t *            src,
+		      xcb_image_order_t          src_order,
+		      uint8_t *                  dst,
+		      xcb_image_order_t          dst_order,
+		      uint32_t                   width,
+		      const xcb_image_remap_t *  remap)
+{
+    int       src_msb = src_order == XCB_IMAGE_ORDER_MSB_FIRST;
+    int       dst_msb = dst_order == XCB_IMAGE_ORDER_MSB_FIRST;
+    uint32_t  i = 0;
+
+#ifdef XCB_KERNELS_X86
+    switch (cpu_level()) {
+    case LEVEL_AVX512:
+	i = remap_z32_avx512(src, src_msb, dst, dst_msb, width, remap);
+	break;
+    case LEVEL_AVX2:
+	i = remap_z32_avx2(src, src_msb, dst, dst_msb, width, remap);
+	break;
+    case LEVEL_SSSE3:
+	i = remap_z32_ssse3(src, src_msb, dst, dst_msb, width, remap);
+	break;
+    }
+#endif
+    for (; i < width; i++)
+	store32(dst + (i << 2),
+		remap_pixel(load32(src + (i << 2), src_msb), remap),
+		dst_msb);
+}
+
+void
+_xcb_image_remap_row (uint32_t *                 pixels,
+		      uint32_t                   width,
+		      const xcb_image_remap_t *  remap)
+{
+    uint32_t  i = 0;
+
+#ifdef XCB_KERNELS_X86
+    switch (cpu_level()) {
+    case LEVEL_AVX512:
+	i = remap_row_avx512(pixels, width, remap);
+	break;
+    case LEVEL_AVX2:
+	i = remap_row_avx2(pixels, width, remap);
+	break;
+    case LEVEL_SSSE3:
+    case LEVEL_SSE2:
+	i = remap_row_sse2(pixels, width, remap);
+	break;
+    }
+#endif
+    for (; i < width; i++)
+	pixels[i] = remap_pixel(pixels[i], remap);
+}
+
+
+/*
+ * Ordered dithering
+ *
+ * Each channel v in 0..255 goes to (v * top + t) >> 8, where
+ * top is the largest value of the target channel and t a
+ * threshold from the Bayer matrix for the pixel's position.
+ * Every product fits in 16 bits, so the vector versions
+ * can use the 16-bit multiply on 32-bit lanes.
+ */
+
+static const uint8_t bayer8[8][8] = {
+    {  0, 32,  8, 40,  2, 34, 10, 42 },
+    { 48, 16, 56, 24, 50, 18, 58, 26 },
+    { 12, 44,  4, 36, 14, 46,  6, 38 },
+    { 60, 28, 52, 20, 62, 30, 54, 22 },
+    {  3, 35, 11, 43,  1, 33,  9, 41 },
+    { 51, 19, 59, 27, 49, 17, 57, 25 },
+    { 15, 47,  7, 39, 13, 45,  5, 37 },
+    { 63, 31, 55, 23, 61, 29, 53, 21 }
+};
+
+#define THRESHOLD(y, x)  (bayer8[(y) & 7][(x) & 7] * 4 + 2)
+
+/* Luminance weights, summing to 256. */
+#define LUMA_R  77
+#define LUMA_G  150
+#define LUMA_B  29
+
+void
+_xcb_image_dither_init (xcb_image_dither_t *  dither,
+			const uint32_t *      masks,
+			uint8_t               depth)
+{
+    int  c;
+
+    memset(dither, 0, sizeof(*dither));
+    if (!masks) {
+	dither->gray = 1;
+	dither->levels[0] = xcb_mask(depth);
+	return;
+    }
+    for (c = 0; c < 3; c++) {
+	uint32_t  shift, width;
+
+	mask_shift_width(masks[c], &shift, &width);
+	dither->levels[c] = xcb_mask(width);
+	dither->shift[c] = shift;
+    }
+}
+
+static inline uint32_t
+dither_pixel (uint32_t p, uint32_t t, const xcb_image_dither_t *dither)
+{
+    uint32_t  r = (p >> 16) & 0xff;
+    uint32_t  g = (p >> 8) & 0xff;
+    uint32_t  b = p & 0xff;
+
+    if (dither->gray)
+	return ((((LUMA_R * r + LUMA_G * g + LUMA_B * b) >> 8) *
+		 dither->levels[0] + t) >> 8);
+    return (((r * dither->levels[0] + t) >> 8) << dither->shift[0]) |
+	(((g * dither->levels[1] + t) >> 8) << dither->shift[1]) |
+	(((b * dither->levels[2] + t) >> 8) << dither->shift[2]);
+}
+
+#ifdef XCB_KERNELS_X86
+
+#define COUNT(n)  _mm_cvtsi32_si128(n)
+
+__attribute__((target("sse2")))
+static inline __m128i
+dither_m128 (__m128i p, __m128i t, const xcb_image_dither_t *dither)
+{
+    __m128i  byte = _mm_set1_epi32(0xff);
+    __m128i  r = _mm_and_si128(_mm_srli_epi32(p, 16), byte);
+    __m128i  g = _mm_and_si128(_mm_srli_epi32(p, 8), byte);
+    __m128i  b = _mm_and_si128(p, byte);
+
+    if (dither->gray) {
+	__m128i  y = _mm_add_epi32(
+	    _mm_add_epi32(_mm_mullo_epi16(r, _mm_set1_epi32(LUMA_R)),
+			  _mm_mullo_epi16(g, _mm_set1_epi32(LUMA_G))),
+	    _mm_mullo_epi16(b, _mm_set1_epi32(LUMA_B)));
+
+	y = _mm_mullo_epi16(_mm_srli_epi32(y, 8),
+			    _mm_set1_epi32(dither->levels[0]));
+	return _mm_srli_epi32(_mm_add_epi32(y, t), 8);
+    }
+    r = _mm_srli_epi32(_mm_add_epi32(
+	_mm_mullo_epi16(r, _mm_set1_epi32(dither->levels[0])), t), 8);
+    g = _mm_srli_epi32(_mm_add_epi32(
+	_mm_mullo_epi16(g, _mm_set1_epi32(dither->levels[1])), t), 8);
+    b = _mm_srli_epi32(_mm_add_epi32(
+	_mm_mullo_epi16(b, _mm_set1_epi32(dither->levels[2])), t), 8);
+    return _mm_or_si128(_mm_or_si128(
+	_mm_sll_epi32(r, COUNT(dither->shift[0])),
+	_mm_sll_epi32(g, COUNT(dither->shift[1]))),
+	_mm_sll_epi32(b, COUNT(dither->shift[2])));
+}
+
+__attribute__((target("avx2")))
+static inline __m256i
+dither_m256 (__m256i p, __m256i t, const xcb_image_dither_t *dither)
+{
+    __m256i  byte = _mm256_set1_epi32(0xff);
+    __m256i  r = _mm256_and_si256(_mm256_srli_epi32(p, 16), byte);
+    __m256i  g = _mm256_and_si256(_mm256_srli_epi32(p, 8), byte);
+    __m256i  b = _mm256_and_si256(p, byte);
+
+    if (dither->gray) {
+	__m256i  y = _mm256_add_epi32(
+	    _mm256_add_epi32(_mm256_mullo_epi16(r, _mm256_set1_epi32(LUMA_R)),
+			     _mm256_mullo_epi16(g, _mm256_set1_epi32(LUMA_G))),
+	    _mm256_mullo_epi16(b, _mm256_set1_epi32(LUMA_B)));
+
+	y = _mm256_mullo_epi16(_mm256_srli_epi32(y, 8),
+			       _mm256_set1_epi32(dither->levels[0]));
+	return _mm256_srli_epi32(_mm256_add_epi32(y, t), 8);
+    }
+    r = _mm256_srli_epi32(_mm256_add_epi32(
+	_mm256_mullo_epi16(r, _mm256_set1_epi32(dither->levels[0])), t), 8);
+    g = _mm256_srli_epi32(_mm256_add_epi32(
+	_mm256_mullo_epi16(g, _mm256_set1_epi32(dither->levels[1])), t), 8);
+    b = _mm256_srli_epi32(_mm256_add_epi32(
+	_mm256_mullo_epi16(b, _mm256_set1_epi32(dither->levels[2])), t), 8);
+    return _mm256_or_si256(_mm256_or_si256(
+	_mm256_sll_epi32(r, COUNT(dither->shift[0])),
+	_mm256_sll_epi32(g, COUNT(dither->shift[1]))),
+	_mm256_sll_epi32(b, COUNT(dither->shift[2])));
+}
+
+#undef COUNT
+
+/* The threshold pattern repeats every 8 pixels: two SSE2
+   vectors, or one AVX2 vector. */
+__attribute__((target("sse2")))
+static uint32_t
+dither_row_sse2 (uint32_t *pixels, uint32_t width, uint32_t y,
+		 const xcb_image_dither_t *dither)
+{
+    const uint8_t *  m = bayer8[y & 7];
+    __m128i          t0 = _mm_setr_epi32(m[0] * 4 + 2, m[1] * 4 + 2,
+					 m[2] * 4 + 2, m[3] * 4 + 2);
+    __m128i          t1 = _mm_setr_epi32(m[4] * 4 + 2, m[5] * 4 + 2,
+					 m[6] * 4 + 2, m[7] * 4 + 2);
+    uint32_t         i = 0;
+
+    for (; i + 8 <= width; i += 8) {
+	__m128i *  p = (__m128i *) (pixels + i);
+	_mm_storeu_si128(p, dither_m128(_mm_loadu_si128(p), t0, dither));
+	_mm_storeu_si128(p + 1, dither_m128(_mm_loadu_si128(p + 1), t1, dither));
+    }
+    return i;
+}
+
+__attribute__((target("avx2")))
+static uint32_t
+dither_row_avx2 (uint32_t *pixels, uint32_t width, uint32_t y,
+		 const xcb_image_dither_t *dither)
+{
+    __m256i   t = _mm256_cvtepu8_epi32(
+	_mm_loadl_epi64((const __m128i *) bayer8[y & 7]));
+    uint32_t  i = 0;
+
+    t = _mm256_add_epi32(_mm256_slli_epi32(t, 2), _mm256_set1_epi32(2));
+    for (; i + 8 <= width; i += 8) {
+	__m256i *  p = (__m256i *) (pixels + i);
+	_mm256_storeu_si256(p, dither_m256(_mm256_loadu_si256(p), t, dither));
+    }
+    return i;
+}
+
+#endif /* XCB_KERNELS_X86 */
+
+void
+_xcb_image_dither_row (uint32_t *                  pixels,
+		       uint32_t                    width,
+		       uint32_t                    y,
+		       const xcb_image_dither_t *  dither)
+{
+    uint32_t  i = 0;
+
+#ifdef XCB_KERNELS_X86
+    switch (cpu_level()) {
+    case LEVEL_AVX512:
+    case LEVEL_AVX2:
+	i = dither_row_avx2(pixels, width, y, dither);
+	break;
+    case LEVEL_SSSE3:
+    case LEVEL_SSE2:
+	i = dither_row_sse2(pixels, width, y, dither);
+	break;
+    }
+#endif
+    for (; i < width; i++)
+	pixels[i] = dither_pixel(pixels[i], THRESHOLD(y, i), dither);
+}
+
+#undef THRESHOLD
+#undef LUMA_R
+#undef LUMA_G
+#undef LUMA_B
+
+#if defined(XCB_KERNELS_X86) && defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
@@ -0,0 +1,197 @@
+#ifndef __XCB_KERNELS_H__
+#define __XCB_KERNELS_H__
+
+/* Copyright © 2026 The xcb-util-image developers
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ * 
+ * Except as contained in this notice, the names of the authors or their
+ * institutions shall not be used in advertising or otherwise to promote the
+ * sale, use or other dealings in this Software without prior written
+ * authorization from the authors.
+ */
+
+/*
+ * Private scanline kernels used by the conversion routines
+ * in xcb_image.c.  Nothing in here is installed; the
+ * functions are hidden from the library's exported ABI.
+ *
+ * Each kernel converts one scanline of @p width pixels.
+ * The byte orders are passed as XCB_IMAGE_ORDER_* values.
+ * SIMD variants are chosen at run time when the host CPU
+ * supports them, so the library can still be built for a
+ * baseline target.
+ */
+
+#include <inttypes.h>
+#include <X11/Xfuncproto.h>
+#include <xcb/xcb.h>
+#include "xcb_image.h"
+
+/* Packed 24 bpp to 32 bpp; the pad byte is zeroed. */
+_X_HIDDEN void
+_xcb_image_z24_to_z32 (const uint8_t *     src,
+		       xcb_image_order_t   src_order,
+		       uint8_t *           dst,
+		       xcb_image_order_t   dst_order,
+		       uint32_t            width);
+
+/* 32 bpp to packed 24 bpp; the high byte is dropped. */
+_X_HIDDEN void
+_xcb_image_z32_to_z24 (const uint8_t *     src,
+		       xcb_image_order_t   src_order,
+		       uint8_t *           dst,
+		       xcb_image_order_t   dst_order,
+		       uint32_t            width);
+
+/* Packed 24 bpp with the byte order of each pixel reversed. */
+_X_HIDDEN void
+_xcb_image_z24_swap (const uint8_t *  src,
+		     uint8_t *        dst,
+		     uint32_t         width);
+
+/* Bit reversal of every byte value. */
+extern _X_HIDDEN const uint8_t _xcb_image_bit_reverse_table[256];
+
+/*
+ * Same-layout reordering for swap_image(): byte index i of
+ * the output comes from byte i ^ @p byteswap of the input,
+ * then has its bits reversed if @p bitswap and its nibbles
+ * exchanged if @p nibbleswap.  @p bytes must be a multiple
+ * of the swap group (4 bytes when @p byteswap > 1).
+ */
+_X_HIDDEN void
+_xcb_image_swap_row (const uint8_t *  src,
+		     uint8_t *        dst,
+		     uint32_t         bytes,
+		     uint32_t         byteswap,
+		     int              bitswap,
+		     int              nibbleswap);
+
+/*
+ * Copy @p bits bits of a scanline, starting @p src_offset
+ * bits in, to another starting @p dst_offset bits in,
+ * leaving the destination bits around them alone.  Bits run
+ * from the top of each byte down when @p msb_first, and byte
+ * k of either scanline is at k ^ @p swap, for xy units whose
+ * byte order differs from their bit order.
+ */
+_X_HIDDEN void
+_xcb_image_copy_bits (const uint8_t *  src,
+		      uint32_t         src_offset,
+		      uint8_t *        dst,
+		      uint32_t         dst_offset,
+		      uint32_t         bits,
+		      int              msb_first,
+		      uint32_t         swap);
+
+/*
+ * Scanline unpack/pack.
+ *
+ * An unpacker reads @p width pixels of row @p y, starting at
+ * column @p x of the image (past any x_offset), into a
+ * canonical array of uint32_t pixel values; a packer writes
+ * such an array back.  The values are exactly those of
+ * xcb_image_get_pixel() and xcb_image_put_pixel(), including
+ * the plane mask handling of xy-pixmaps, but the layout is
+ * looked up once per image rather than once per pixel.
+ * These are also the row routines xcb_image_annotate()
+ * stores in the image.
+ */
+typedef xcb_image_get_row_func_t   xcb_image_unpack_func_t;
+typedef xcb_image_put_row_func_t   xcb_image_pack_func_t;
+typedef xcb_image_fill_row_func_t  xcb_image_fill_func_t;
+
+_X_HIDDEN xcb_image_unpack_func_t
+_xcb_image_unpacker (xcb_image_t *image);
+
+_X_HIDDEN xcb_image_pack_func_t
+_xcb_image_packer (xcb_image_t *image);
+
+/* Set @p width pixels of a row to one value, the way the
+   packer would. */
+_X_HIDDEN xcb_image_fill_func_t
+_xcb_image_filler (xcb_image_t *image);
+
+/*
+ * Truecolor channel remapping of a scanline of pixel values,
+ * in place.  Channels are red, green, blue and alpha, each
+ * described by a contiguous mask; a zero mask means the
+ * channel is absent.  Channels are rescaled by truncation
+ * or by bit replication.  A destination alpha with no source
+ * alpha is filled as opaque.  Source pixels can also be
+ * premultiplied or unpremultiplied first, in which case
+ * they must be ARGB 8888.
+ */
+typedef struct xcb_image_remap_t {
+    struct {
+	uint32_t  src_shift;
+	uint32_t  src_mask;	/* of the channel, right justified */
+	uint32_t  up;		/* widen by shifting left ... */
+	uint32_t  down;		/* ... or narrow by shifting right */
+	uint32_t  repeat;	/* shift for the replicated low bits */
+	uint32_t  dst_mask;
+	uint32_t  dst_shift;
+    } channel[4];
+    uint32_t  fill;
+    int       identity;		/* channels stay where they are */
+    xcb_image_alpha_op_t  alpha;
+} xcb_image_remap_t;
+
+_X_HIDDEN void
+_xcb_image_remap_init (xcb_image_remap_t *  remap,
+		       const uint32_t *     src_masks,
+		       const uint32_t *     dst_masks);
+
+_X_HIDDEN void
+_xcb_image_remap_row (uint32_t *                 pixels,
+		      uint32_t                   width,
+		      const xcb_image_remap_t *  remap);
+
+/* The same for a scanline of Z32 data, in one pass. */
+_X_HIDDEN void
+_xcb_image_remap_z32 (const uint8_t *            src,
+		      xcb_image_order_t          src_order,
+		      uint8_t *                  dst,
+		      xcb_image_order_t          dst_order,
+		      uint32_t                   width,
+		      const xcb_image_remap_t *  remap);
+
+/* Ordered (8x8 Bayer) dithering of 0x00rrggbb pixel values
+   to a few bits per channel, or to a gray ramp. */
+typedef struct xcb_image_dither_t {
+    int       gray;		/* one luminance channel */
+    uint32_t  levels[3];	/* top value of each channel */
+    uint32_t  shift[3];		/* where each channel goes */
+} xcb_image_dither_t;
+
+/* Set up for the channel masks of a visual, or for a gray
+   ramp of @p depth bits if @p masks is null. */
+_X_HIDDEN void
+_xcb_image_dither_init (xcb_image_dither_t *  dither,
+			const uint32_t *      masks,
+			uint8_t               depth);
+
+/* Dither scanline @p y of an image in place. */
+_X_HIDDEN void
+_xcb_image_dither_row (uint32_t *                  pixels,
+		       uint32_t                    width,
+		       uint32_t                    y,
+		       const xcb_image_dither_t *  dither);
+
+#endif /* __XCB_KERNELS_H__ */
@@ -0,0 +1,279 @@
+/* Copyright © 2026 The xcb-util-image developers
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ * 
+ * Except as contained in this notice, the names of the authors or their
+ * institutions shall not be used in advertising or otherwise to promote the
+ * sale, use or other dealings in this Software without prior written
+ * authorization from the authors.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#ifdef HAVE_PTHREAD_H
+#include <pthread.h>
+#include <unistd.h>
+#endif
+
+#include "xcb_image.h"
+#include "xcb_parallel.h"
+
+/* Jobs smaller than this many bytes stay on the calling thread. */
+#define DEFAULT_MIN_BYTES	(1 << 20)
+/* Bands handed out per thread, to even out uneven rows. */
+#define BANDS_PER_THREAD	4
+#define MAX_THREADS		64
+
+#ifdef HAVE_PTHREAD_H
+
+static pthread_mutex_t  pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t   pool_wake = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t   pool_done = PTHREAD_COND_INITIALIZER;
+/* Held by the thread whose job owns the pool. */
+static pthread_mutex_t  job_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static unsigned int     pool_threads = 1;
+static uint32_t         pool_min_bytes = DEFAULT_MIN_BYTES;
+static unsigned int     pool_started;
+static pthread_t        pool_thread[MAX_THREADS];
+static int              pool_stopping;
+static pthread_once_t   pool_once = PTHREAD_ONCE_INIT;
+
+/* The current job; all fields are protected by pool_lock. */
+static struct {
+    xcb_image_band_func_t  func;
+    void *                 closure;
+    uint32_t               rows;
+    uint32_t               band_rows;
+    uint32_t               bands;
+    uint32_t               next;
+    uint32_t               remaining;
+    unsigned int           workers;
+    unsigned int           serial;
+    int                    ok;
+} job;
+
+
+/* Take bands until none are left.  Called, and returns,
+ * with pool_lock held. */
+static void
+run_bands (void)
+{
+    while (job.next < job.bands) {
+	xcb_image_band_func_t  func = job.func;
+	void *                 closure = job.closure;
+	uint32_t               start = job.next++ * job.band_rows;
+	uint32_t               end = start + job.band_rows;
+	int                    ok;
+
+	if (end > job.rows)
+	    end = job.rows;
+	pthread_mutex_unlock(&pool_lock);
+	ok = func(closure, start, end);
+	pthread_mutex_lock(&pool_lock);
+	if (!ok)
+	    job.ok = 0;
+	if (--job.remaining == 0)
+	    pthread_cond_signal(&pool_done);
+    }
+}
+
+static void *
+worker (void *arg)
+{
+    unsigned int  index = (uintptr_t) arg;
+    unsigned int  serial = 0;
+
+    pthread_mutex_lock(&pool_lock);
+    for (;;) {
+	while (job.serial == serial && !pool_stopping)
+	    pthread_cond_wait(&pool_wake, &pool_lock);
+	if (pool_stopping)
+	    break;
+	serial = job.serial;
+	if (index < job.workers)
+	    run_bands();
+    }
+    pthread_mutex_unlock(&pool_lock);
+    return 0;
+}
+
+/* Holding pool_lock keeps the pool's state still across
+ * fork(), but a job may still be running: run_bands() drops
+ * pool_lock while it works, and job_lock isn't taken here.
+ * The child is safe all the same, since it re-initialises
+ * both locks and has none of the workers, so it starts over
+ * with a fresh, serial pool. */
+static void
+fork_prepare (void)
+{
+    pthread_mutex_lock(&pool_lock);
+}
+
+static void
+fork_parent (void)
+{
+    pthread_mutex_unlock(&pool_lock);
+}
+
+static void
+fork_child (void)
+{
+    pthread_mutex_init(&pool_lock, 0);
+    pthread_mutex_init(&job_lock, 0);
+    pthread_cond_init(&pool_wake, 0);
+    pthread_cond_init(&pool_done, 0);
+    pool_threads = 1;
+    pool_started = 0;
+    job.remaining = 0;
+}
+
+static void
+install_fork_handlers (void)
+{
+    pthread_atfork(fork_prepare, fork_parent, fork_child);
+}
+
+/* Make sure @p count workers exist; returns how many do.
+ * Called with pool_lock held. */
+static unsigned int
+start_workers (unsigned int count)
+{
+    pthread_once(&pool_once, install_fork_handlers);
+    while (pool_started < count) {
+	if (pthread_create(&pool_thread[pool_started], 0, worker,
+			   (void *) (uintptr_t) pool_started) != 0)
+	    break;
+	pool_started++;
+    }
+    return pool_started < count ? pool_started : count;
+}
+
+int
+_xcb_image_parallel (uint32_t               rows,
+		     uint32_t               bytes,
+		     xcb_image_band_func_t  func,
+		     void *                 closure)
+{
+    unsigned int  workers;
+    uint32_t      bands;
+    int           ok;
+
+    pthread_mutex_lock(&pool_lock);
+    workers = pool_threads - 1;
+    if (workers == 0 || rows < 2 || bytes < pool_min_bytes) {
+	pthread_mutex_unlock(&pool_lock);
+	return func(closure, 0, rows);
+    }
+    pthread_mutex_unlock(&pool_lock);
+
+    /* Only one job runs on the pool at a time; anyone else
+       does their own work rather than queue behind it. */
+    if (pthread_mutex_trylock(&job_lock) != 0)
+	return func(closure, 0, rows);
+
+    pthread_mutex_lock(&pool_lock);
+    workers = start_workers(workers);
+    bands = (workers + 1) * BANDS_PER_THREAD;
+    if (bands > rows)
+	bands = rows;
+    job.func = func;
+    job.closure = closure;
+    job.rows = rows;
+    job.band_rows = (rows + bands - 1) / bands;
+    job.bands = (rows + job.band_rows - 1) / job.band_rows;
+    job.next = 0;
+    job.remaining = job.bands;
+    job.workers = workers;
+    job.ok = 1;
+    job.serial++;
+    if (workers)
+	pthread_cond_broadcast(&pool_wake);
+    run_bands();
+    while (job.remaining)
+	pthread_cond_wait(&pool_done, &pool_lock);
+    ok = job.ok;
+    pthread_mutex_unlock(&pool_lock);
+    pthread_mutex_unlock(&job_lock);
+    return ok;
+}
+
+void
+xcb_image_set_threads (unsigned int  threads,
+		       uint32_t      min_bytes)
+{
+    if (threads == 0) {
+	long  online = sysconf(_SC_NPROCESSORS_ONLN);
+
+	threads = online > 0 ? online : 1;
+    }
+    if (threads > MAX_THREADS)
+	threads = MAX_THREADS;
+    pthread_mutex_lock(&pool_lock);
+    pool_threads = threads;
+    pool_min_bytes = min_bytes;
+    pthread_mutex_unlock(&pool_lock);
+}
+
+/* Stop and join the workers when the library is unloaded or
+ * the program exits, leaving any later jobs to run serially.
+ * A job still running, perhaps the one calling exit(), keeps
+ * its workers. */
+#if defined(__GNUC__) || defined(__clang__)
+__attribute__((destructor)) static void
+stop_workers (void)
+{
+    unsigned int  i;
+
+    if (pthread_mutex_trylock(&job_lock) != 0)
+	return;
+    pthread_mutex_lock(&pool_lock);
+    pool_threads = 1;
+    pool_stopping = 1;
+    pthread_cond_broadcast(&pool_wake);
+    pthread_mutex_unlock(&pool_lock);
+    for (i = 0; i < pool_started; i++)
+	pthread_join(pool_thread[i], 0);
+    pthread_mutex_lock(&pool_lock);
+    pool_started = 0;
+    pool_stopping = 0;
+    pthread_mutex_unlock(&pool_lock);
+    pthread_mutex_unlock(&job_lock);
+}
+#endif
+
+#else /* !HAVE_PTHREAD_H */
+
+int
+_xcb_image_parallel (uint32_t               rows,
+		     uint32_t               bytes,
+		     xcb_image_band_func_t  func,
+		     void *                 closure)
+{
+    return func(closure, 0, rows);
+}
+
+void
+xcb_image_set_threads (unsigned int  threads,
+		       uint32_t      min_bytes)
+{
+}
+
+#endif /* HAVE_PTHREAD_H */
@@ -0,0 +1,56 @@
+#ifndef __XCB_PARALLEL_H__
+#define __XCB_PARALLEL_H__
+
+/* Copyright © 2026 The xcb-util-image developers
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ * 
+ * Except as contained in this notice, the names of the authors or their
+ * institutions shall not be used in advertising or otherwise to promote the
+ * sale, use or other dealings in this Software without prior written
+ * authorization from the authors.
+ */
+
+/*
+ * Band-parallel execution for the conversion routines in
+ * xcb_image.c.  A job is a range of independent rows which
+ * is cut into bands and run on a small pool of worker
+ * threads, with the calling thread taking bands as well.
+ * Nothing in here is installed.
+ */
+
+#include <inttypes.h>
+#include <X11/Xfuncproto.h>
+
+/* Process rows [start, end); returns 0 on failure. */
+typedef int (*xcb_image_band_func_t) (void *    closure,
+				      uint32_t  start,
+				      uint32_t  end);
+
+/* Run @p func over rows [0, rows).  @p bytes is the amount
+ * of image data touched, which decides whether the job is
+ * worth splitting; small jobs, jobs started while another
+ * is running and builds without threads run serially.
+ * Returns 0 if any band failed. */
+_X_HIDDEN int
+_xcb_image_parallel (uint32_t               rows,
+		     uint32_t               bytes,
+		     xcb_image_band_func_t  func,
+		     void *                 closure);
+
+#endif /* __XCB_PARALLEL_H__ */
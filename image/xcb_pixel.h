@@ -48,6 +48,17 @@
  * Also note that the pixel type is chosen to be appropriate
  * to the unit; bitmaps use int and pixmaps use the appropriate
  * size of unsigned.
+ *
+ * For bitmaps B is the bit order, and the byte order is
+ * taken to be LSB first.  A bitmap whose byte order matches
+ * its bit order has the same layout whatever its unit, so
+ * the XY8 versions serve for those.  For pixmaps B is the
+ * byte order, and the Z4 versions order nibbles as
+ * xcb_image_get_pixel() does.  Z16 and Z32 also have H
+ * versions for images in the host's byte order, as
+ * returned by xcb_host_byte_order(), which load and store
+ * whole pixels; their data must be suitably aligned, as
+ * it is when the library allocates it.
  * @ingroup xcb__image_t
  */
 
@@ -57,9 +68,10 @@ xcb_image_put_pixel_XY32M (xcb_image_t *image,
 			  uint32_t y,
 			  int pixel)
 {
-  uint32_t   unit = (x >> 3) & ~xcb_mask(2);
-  uint32_t   byte = xcb_mask(2) - ((x >> 3) & xcb_mask(2));
-  uint32_t   bit = xcb_mask(3) - (x & xcb_mask(3));
+  uint32_t   xx = x + image->x_offset;
+  uint32_t   unit = (xx >> 3) & ~xcb_mask(2);
+  uint32_t   byte = xcb_mask(2) - ((xx >> 3) & xcb_mask(2));
+  uint32_t   bit = xcb_mask(3) - (xx & xcb_mask(3));
   uint8_t    m = 1 << bit;
   uint8_t    p = pixel << bit;
   uint8_t *  bp = image->data + (y * image->stride) + (unit | byte);
@@ -72,10 +84,11 @@ xcb_image_put_pixel_XY32L (xcb_image_t *image,
 			  uint32_t y,
 			  int pixel)
 {
-  uint32_t   bit = x & xcb_mask(3);
+  uint32_t   xx = x + image->x_offset;
+  uint32_t   bit = xx & xcb_mask(3);
   uint8_t    m = 1 << bit;
   uint8_t    p = pixel << bit;
-  uint8_t *  bp = image->data + (y * image->stride) + (x >> 3);
+  uint8_t *  bp = image->data + (y * image->stride) + (xx >> 3);
   *bp = (*bp & ~m) | p;
 }
 
@@ -84,9 +97,10 @@ xcb_image_get_pixel_XY32M (xcb_image_t *image,
 			  uint32_t x,
 			  uint32_t y)
 {
-  uint32_t   unit = (x >> 3) & ~xcb_mask(2);
-  uint32_t   byte = xcb_mask(2) - ((x >> 3) & xcb_mask(2));
-  uint32_t   bit = xcb_mask(3) - (x & xcb_mask(3));
+  uint32_t   xx = x + image->x_offset;
+  uint32_t   unit = (xx >> 3) & ~xcb_mask(2);
+  uint32_t   byte = xcb_mask(2) - ((xx >> 3) & xcb_mask(2));
+  uint32_t   bit = xcb_mask(3) - (xx & xcb_mask(3));
   uint8_t *  bp = image->data + (y * image->stride) + (unit | byte);
   return (*bp >> bit) & 1;
 }
@@ -96,18 +110,151 @@ xcb_image_get_pixel_XY32L (xcb_image_t *image,
 			  uint32_t x,
 			  uint32_t y)
 {
-  uint32_t   bit = x & xcb_mask(3);
-  uint8_t *  bp = image->data + (y * image->stride) + (x >> 3);
+  uint32_t   xx = x + image->x_offset;
+  uint32_t   bit = xx & xcb_mask(3);
+  uint8_t *  bp = image->data + (y * image->stride) + (xx >> 3);
+  return (*bp >> bit) & 1;
+}
+
+_X_INLINE static void
+xcb_image_put_pixel_XY16M (xcb_image_t *image,
+			  uint32_t x,
+			  uint32_t y,
+			  int pixel)
+{
+  uint32_t   xx = x + image->x_offset;
+  uint32_t   unit = (xx >> 3) & ~xcb_mask(1);
+  uint32_t   byte = xcb_mask(1) - ((xx >> 3) & xcb_mask(1));
+  uint32_t   bit = xcb_mask(3) - (xx & xcb_mask(3));
+  uint8_t    m = 1 << bit;
+  uint8_t    p = pixel << bit;
+  uint8_t *  bp = image->data + (y * image->stride) + (unit | byte);
+  *bp = (*bp & ~m) | p;
+}
+
+_X_INLINE static void
+xcb_image_put_pixel_XY16L (xcb_image_t *image,
+			  uint32_t x,
+			  uint32_t y,
+			  int pixel)
+{
+  xcb_image_put_pixel_XY32L (image, x, y, pixel);
+}
+
+_X_INLINE static int
+xcb_image_get_pixel_XY16M (xcb_image_t *image,
+			  uint32_t x,
+			  uint32_t y)
+{
+  uint32_t   xx = x + image->x_offset;
+  uint32_t   unit = (xx >> 3) & ~xcb_mask(1);
+  uint32_t   byte = xcb_mask(1) - ((xx >> 3) & xcb_mask(1));
+  uint32_t   bit = xcb_mask(3) - (xx & xcb_mask(3));
+  uint8_t *  bp = image->data + (y * image->stride) + (unit | byte);
+  return (*bp >> bit) & 1;
+}
+
+_X_INLINE static int
+xcb_image_get_pixel_XY16L (xcb_image_t *image,
+			  uint32_t x,
+			  uint32_t y)
+{
+  return xcb_image_get_pixel_XY32L (image, x, y);
+}
+
+_X_INLINE static void
+xcb_image_put_pixel_XY8M (xcb_image_t *image,
+			 uint32_t x,
+			 uint32_t y,
+			 int pixel)
+{
+  uint32_t   xx = x + image->x_offset;
+  uint32_t   bit = xcb_mask(3) - (xx & xcb_mask(3));
+  uint8_t    m = 1 << bit;
+  uint8_t    p = pixel << bit;
+  uint8_t *  bp = image->data + (y * image->stride) + (xx >> 3);
+  *bp = (*bp & ~m) | p;
+}
+
+_X_INLINE static void
+xcb_image_put_pixel_XY8L (xcb_image_t *image,
+			 uint32_t x,
+			 uint32_t y,
+			 int pixel)
+{
+  xcb_image_put_pixel_XY32L (image, x, y, pixel);
+}
+
+_X_INLINE static int
+xcb_image_get_pixel_XY8M (xcb_image_t *image,
+			 uint32_t x,
+			 uint32_t y)
+{
+  uint32_t   xx = x + image->x_offset;
+  uint32_t   bit = xcb_mask(3) - (xx & xcb_mask(3));
+  uint8_t *  bp = image->data + (y * image->stride) + (xx >> 3);
   return (*bp >> bit) & 1;
 }
 
+_X_INLINE static int
+xcb_image_get_pixel_XY8L (xcb_image_t *image,
+			 uint32_t x,
+			 uint32_t y)
+{
+  return xcb_image_get_pixel_XY32L (image, x, y);
+}
+
+_X_INLINE static void
+xcb_image_put_pixel_Z4M (xcb_image_t *image,
+			 uint32_t x,
+			 uint32_t y,
+			 uint8_t pixel)
+{
+  uint32_t   xx = x + image->x_offset;
+  uint32_t   shift = (xx & 1) << 2;
+  uint8_t *  bp = image->data + (y * image->stride) + (xx >> 1);
+  *bp = (*bp & ~(0xf << shift)) | ((pixel & 0xf) << shift);
+}
+
+_X_INLINE static void
+xcb_image_put_pixel_Z4L (xcb_image_t *image,
+			 uint32_t x,
+			 uint32_t y,
+			 uint8_t pixel)
+{
+  uint32_t   xx = x + image->x_offset;
+  uint32_t   shift = (~xx & 1) << 2;
+  uint8_t *  bp = image->data + (y * image->stride) + (xx >> 1);
+  *bp = (*bp & ~(0xf << shift)) | ((pixel & 0xf) << shift);
+}
+
+_X_INLINE static uint8_t
+xcb_image_get_pixel_Z4M (xcb_image_t *image,
+			 uint32_t x,
+			 uint32_t y)
+{
+  uint32_t   xx = x + image->x_offset;
+  uint8_t *  bp = image->data + (y * image->stride) + (xx >> 1);
+  return (*bp >> ((xx & 1) << 2)) & 0xf;
+}
+
+_X_INLINE static uint8_t
+xcb_image_get_pixel_Z4L (xcb_image_t *image,
+			 uint32_t x,
+			 uint32_t y)
+{
+  uint32_t   xx = x + image->x_offset;
+  uint8_t *  bp = image->data + (y * image->stride) + (xx >> 1);
+  return (*bp >> ((~xx & 1) << 2)) & 0xf;
+}
+
 _X_INLINE static void
 xcb_image_put_pixel_Z8 (xcb_image_t *image,
 			uint32_t x,
 			uint32_t y,
 			uint8_t pixel)
 {
-  image->data[x + y * image->stride] = pixel;
+  image->data[x + image->x_offset + y * image->stride] = pixel;
 }
 
 _X_INLINE static uint8_t
@@ -115,7 +262,112 @@ xcb_image_get_pixel_Z8 (xcb_image_t *image,
 			uint32_t x,
 			uint32_t y)
 {
-  return image->data[x + y * image->stride];
+  return image->data[x + image->x_offset + y * image->stride];
+}
+
+_X_INLINE static void
+xcb_image_put_pixel_Z16M (xcb_image_t *image,
+			  uint32_t x,
+			  uint32_t y,
+			  uint16_t pixel)
+{
+  uint8_t *  row = image->data + (y * image->stride) + (image->x_offset << 1);
+  row[x << 1] = pixel >> 8;
+  row[(x << 1) + 1] = pixel;
+}
+
+_X_INLINE static void
+xcb_image_put_pixel_Z16L (xcb_image_t *image,
+			  uint32_t x,
+			  uint32_t y,
+			  uint16_t pixel)
+{
+  uint8_t *  row = image->data + (y * image->stride) + (image->x_offset << 1);
+  row[x << 1] = pixel;
+  row[(x << 1) + 1] = pixel >> 8;
+}
+
+_X_INLINE static void
+xcb_image_put_pixel_Z16H (xcb_image_t *image,
+			  uint32_t x,
+			  uint32_t y,
+			  uint16_t pixel)
+{
+  uint8_t *  row = image->data + (y * image->stride) + (image->x_offset << 1);
+  ((uint16_t *) row)[x] = pixel;
+}
+
+_X_INLINE static uint16_t
+xcb_image_get_pixel_Z16M (xcb_image_t *image,
+			  uint32_t x,
+			  uint32_t y)
+{
+  uint8_t *  row = image->data + (y * image->stride) + (image->x_offset << 1);
+  return (row[x << 1] << 8) | row[(x << 1) + 1];
+}
+
+_X_INLINE static uint16_t
+xcb_image_get_pixel_Z16L (xcb_image_t *image,
+			  uint32_t x,
+			  uint32_t y)
+{
+  uint8_t *  row = image->data + (y * image->stride) + (image->x_offset << 1);
+  return row[x << 1] | (row[(x << 1) + 1] << 8);
+}
+
+_X_INLINE static uint16_t
+xcb_image_get_pixel_Z16H (xcb_image_t *image,
+			  uint32_t x,
+			  uint32_t y)
+{
+  uint8_t *  row = image->data + (y * image->stride) + (image->x_offset << 1);
+  return ((uint16_t *) row)[x];
+}
+
+_X_INLINE static void
+xcb_image_put_pixel_Z24M (xcb_image_t *image,
+			  uint32_t x,
+			  uint32_t y,
+			  uint32_t pixel)
+{
+  uint8_t *  row = image->data + (y * image->stride) + image->x_offset * 3;
+  row[x * 3] = pixel >> 16;
+  row[x * 3 + 1] = pixel >> 8;
+  row[x * 3 + 2] = pixel;
+}
+
+_X_INLINE static void
+xcb_image_put_pixel_Z24L (xcb_image_t *image,
+			  uint32_t x,
+			  uint32_t y,
+			  uint32_t pixel)
+{
+  uint8_t *  row = image->data + (y * image->stride) + image->x_offset * 3;
+  row[x * 3] = pixel;
+  row[x * 3 + 1] = pixel >> 8;
+  row[x * 3 + 2] = pixel >> 16;
+}
+
+_X_INLINE static uint32_t
+xcb_image_get_pixel_Z24M (xcb_image_t *image,
+			  uint32_t x,
+			  uint32_t y)
+{
+  uint8_t *  row = image->data + (y * image->stride) + image->x_offset * 3;
+  uint32_t    pixel = row[x * 3] << 16;
+  pixel |= row[x * 3 + 1] << 8;
+  return pixel | row[x * 3 + 2];
+}
+
+_X_INLINE static uint32_t
+xcb_image_get_pixel_Z24L (xcb_image_t *image,
+			  uint32_t x,
+			  uint32_t y)
+{
+  uint8_t *  row = image->data + (y * image->stride) + image->x_offset * 3;
+  uint32_t    pixel = row[x * 3];
+  pixel |= row[x * 3 + 1] << 8;
+  return pixel | row[x * 3 + 2] << 16;
 }
 
 _X_INLINE static void
@@ -124,7 +376,7 @@ xcb_image_put_pixel_Z32M (xcb_image_t *image,
 			  uint32_t y,
 			  uint32_t pixel)
 {
-  uint8_t *  row = image->data + (y * image->stride);
+  uint8_t *  row = image->data + (y * image->stride) + (image->x_offset << 2);
   row[x << 2] = pixel >> 24;
   row[(x << 2) + 1] = pixel >> 16;
   row[(x << 2) + 2] = pixel >> 8;
@@ -137,7 +389,7 @@ xcb_image_put_pixel_Z32L (xcb_image_t *image,
 			  uint32_t y,
 			  uint32_t pixel)
 {
-  uint8_t *  row = image->data + (y * image->stride);
+  uint8_t *  row = image->data + (y * image->stride) + (image->x_offset << 2);
   row[x << 2] = pixel;
   row[(x << 2) + 1] = pixel >> 8;
   row[(x << 2) + 2] = pixel >> 16;
@@ -149,7 +401,7 @@ xcb_image_get_pixel_Z32M (xcb_image_t *image,
 			  uint32_t x,
 			  uint32_t y)
 {
-  uint8_t *  row = image->data + (y * image->stride);
+  uint8_t *  row = image->data + (y * image->stride) + (image->x_offset << 2);
   uint32_t    pixel = row[x << 2] << 24;
   pixel |= row[(x << 2) + 1] << 16;
   pixel |= row[(x << 2) + 2] << 8;
@@ -161,11 +413,92 @@ xcb_image_get_pixel_Z32L (xcb_image_t *image,
 			  uint32_t x,
 			  uint32_t y)
 {
-  uint8_t *  row = image->data + (y * image->stride);
+  uint8_t *  row = image->data + (y * image->stride) + (image->x_offset << 2);
   uint32_t    pixel = row[x << 2];
   pixel |= row[(x << 2) + 1] << 8;
   pixel |= row[(x << 2) + 2] << 16;
   return pixel | row[(x << 2) + 3] << 24;
 }
 
+_X_INLINE static void
+xcb_image_put_pixel_Z32H (xcb_image_t *image,
+			  uint32_t x,
+			  uint32_t y,
+			  uint32_t pixel)
+{
+  uint8_t *  row = image->data + (y * image->stride) + (image->x_offset << 2);
+  ((uint32_t *) row)[x] = pixel;
+}
+
+_X_INLINE static uint32_t
+xcb_image_get_pixel_Z32H (xcb_image_t *image,
+			  uint32_t x,
+			  uint32_t y)
+{
+  uint8_t *  row = image->data + (y * image->stride) + (image->x_offset << 2);
+  return ((uint32_t *) row)[x];
+}
+
+/**
+ * Layout-independent fast pixel ops.
+ *
+ * These call the routines that xcb_image_annotate() picked
+ * for the image's layout: the appropriate one of the
+ * routines above where there is one, and otherwise the
+ * generic ones, with the row routines of
+ * xcb_image_get_row() and friends.  Generic code gets most
+ * of the speed of the specialized routines without knowing
+ * the format at compile time.  As above, no checking is
+ * done on the arguments.  fill_row sets @p width pixels
+ * of row @p y, from @p x on, to @p pixel.
+ * @ingroup xcb__image_t
+ */
+
+_X_INLINE static uint32_t
+xcb_image_get_pixel_fast (xcb_image_t *image,
+			  uint32_t x,
+			  uint32_t y)
+{
+  return image->get_pixel_func(image, x, y);
+}
+
+_X_INLINE static void
+xcb_image_put_pixel_fast (xcb_image_t *image,
+			  uint32_t x,
+			  uint32_t y,
+			  uint32_t pixel)
+{
+  image->put_pixel_func(image, x, y, pixel);
+}
+
+_X_INLINE static void
+xcb_image_get_row_fast (xcb_image_t *image,
+			uint32_t x,
+			uint32_t y,
+			uint32_t width,
+			uint32_t *pixels)
+{
+  image->get_row_func(image, x, y, width, pixels);
+}
+
+_X_INLINE static void
+xcb_image_put_row_fast (xcb_image_t *image,
+			uint32_t x,
+			uint32_t y,
+			uint32_t width,
+			const uint32_t *pixels)
+{
+  image->put_row_func(image, x, y, width, pixels);
+}
+
+_X_INLINE static void
+xcb_image_fill_row_fast (xcb_image_t *image,
+			 uint32_t x,
+			 uint32_t y,
+			 uint32_t width,
+			 uint32_t pixel)
+{
+  image->fill_row_func(image, x, y, width, pixel);
+}
+
 #endif /* __XCB_PIXEL_H__ */
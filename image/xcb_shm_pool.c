@@ -0,0 +1,435 @@
+/* Copyright © 2026 The xcb-util-image developers
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ * 
+ * Except as contained in this notice, the names of the authors or their
+ * institutions shall not be used in advertising or otherwise to promote the
+ * sale, use or other dealings in this Software without prior written
+ * authorization from the authors.
+ */
+
+/*
+ * A pool of MIT-SHM segments attached to one connection.
+ * Segments are created and attached on demand, handed out
+ * under images of the connection's native layout and kept
+ * on a free list when those are released, so that a steady
+ * stream of images of similar sizes makes no system calls
+ * and no requests.
+ *
+ * Servers with MIT-SHM 1.2 on a local socket are given
+ * segments as file descriptors: a sealed memfd of ours if
+ * the system has memfd_create(), else one the server makes
+ * with CreateSegment.  Others get SysV segments.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+/* For memfd_create() and file seals. */
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <xcb/xcb.h>
+#include <xcb/shm.h>
+#include "xcb_image.h"
+
+#ifdef HAVE_SYS_SHM_H
+#include <sys/ipc.h>
+#include <sys/shm.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#ifndef MAP_POPULATE
+#define MAP_POPULATE 0
+#endif
+
+/* Segment sizes are rounded up to this, so that images of
+   nearly the same size share segments. */
+#define SEGMENT_GRAIN (64 * 1024)
+
+typedef struct segment_t segment_t;
+
+struct segment_t {
+  segment_t *              next;
+  uint32_t                 size;
+  int                      mapped;  /* By mmap() rather than shmat(). */
+  xcb_shm_segment_info_t   info;
+};
+
+struct xcb_image_shm_pool_t {
+  xcb_connection_t *  conn;
+  uint32_t            flags;
+  int                 use_fd;  /* Hand the server descriptors. */
+  segment_t *         free;    /* Idle segments. */
+  segment_t *         used;    /* Segments under an image. */
+};
+
+
+#ifdef HAVE_SYS_SHM_H
+
+/* Make a SysV segment for seg and attach it to the server;
+ * this costs a round trip, so that the id can be removed as
+ * soon as both sides hold the segment and it goes away with
+ * the last of them.
+ */
+static int
+segment_attach_sysv (xcb_image_shm_pool_t *  pool,
+		     segment_t *             seg)
+{
+  xcb_generic_error_t *   err;
+  void *                  addr;
+
+  seg->info.shmid = shmget(IPC_PRIVATE, seg->size, IPC_CREAT | 0600);
+  if (seg->info.shmid == (uint32_t) -1)
+      return 0;
+  addr = shmat(seg->info.shmid, 0, 0);
+  if (addr == (void *) -1) {
+      shmctl(seg->info.shmid, IPC_RMID, 0);
+      return 0;
+  }
+  seg->mapped = 0;
+  seg->info.shmaddr = addr;
+  seg->info.shmseg = xcb_generate_id(pool->conn);
+  err = xcb_request_check(pool->conn,
+			  xcb_shm_attach_checked(pool->conn,
+						 seg->info.shmseg,
+						 seg->info.shmid, 0));
+  shmctl(seg->info.shmid, IPC_RMID, 0);
+  if (err) {
+      free(err);
+      shmdt(addr);
+      return 0;
+  }
+  /* shmat() has no MAP_POPULATE; fault the pages in by hand. */
+  if (pool->flags & XCB_IMAGE_SHM_POOL_POPULATE)
+      memset(addr, 0, seg->size);
+  return 1;
+}
+
+
+static int
+segment_map (xcb_image_shm_pool_t *  pool,
+	     segment_t *             seg,
+	     int                     fd)
+{
+  int    flags = MAP_SHARED;
+  void * addr;
+
+  if (pool->flags & XCB_IMAGE_SHM_POOL_POPULATE)
+      flags |= MAP_POPULATE;
+  addr = mmap(0, seg->size, PROT_READ | PROT_WRITE, flags, fd, 0);
+  if (addr == MAP_FAILED)
+      return 0;
+  seg->mapped = 1;
+  seg->info.shmid = (uint32_t) -1;
+  seg->info.shmaddr = addr;
+  return 1;
+}
+
+
+/* Have the server make the segment and send us its
+ * descriptor, for systems without memfd_create().  Only a
+ * reply means the server made it; after an error there is
+ * no segment to detach.
+ */
+static int
+segment_create_by_server (xcb_image_shm_pool_t *  pool,
+			  segment_t *             seg)
+{
+  xcb_shm_create_segment_reply_t *  reply;
+  xcb_generic_error_t *             err = 0;
+  int *                             fds;
+  int                               ok;
+  int                               i;
+
+  seg->info.shmseg = xcb_generate_id(pool->conn);
+  reply = xcb_shm_create_segment_reply(pool->conn,
+				       xcb_shm_create_segment(pool->conn,
+							      seg->info.shmseg,
+							      seg->size, 0),
+				       &err);
+  if (!reply) {
+      free(err);
+      return 0;
+  }
+  fds = xcb_shm_create_segment_reply_fds(pool->conn, reply);
+  ok = reply->nfd == 1 && segment_map(pool, seg, fds[0]);
+  for (i = 0; i < reply->nfd; i++)
+      close(fds[i]);
+  free(reply);
+  /* The server has the segment but we can't use it. */
+  if (!ok)
+      xcb_shm_detach(pool->conn, seg->info.shmseg);
+  return ok;
+}
+
+
+/* Make a memfd segment for seg and pass it to the server.
+ * The server maps the descriptor when it gets it, and
+ * libxcb closes our copy once it is sent; the attach is
+ * checked, which costs a round trip.  Seals keep the size
+ * fixed, so that neither side can be handed a SIGBUS.
+ */
+static int
+segment_attach_fd (xcb_image_shm_pool_t *  pool,
+		   segment_t *             seg)
+{
+  xcb_generic_error_t *  err;
+  int                    fd = -1;
+
+#ifdef HAVE_MEMFD_CREATE
+  fd = memfd_create("xcb-image", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+#endif
+  if (fd < 0)
+      return segment_create_by_server(pool, seg);
+  if (ftruncate(fd, seg->size) < 0) {
+      close(fd);
+      return 0;
+  }
+#ifdef F_ADD_SEALS
+  if (pool->flags & XCB_IMAGE_SHM_POOL_SEAL)
+      fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL);
+#endif
+  if (!segment_map(pool, seg, fd)) {
+      close(fd);
+      return 0;
+  }
+  seg->info.shmseg = xcb_generate_id(pool->conn);
+  err = xcb_request_check(pool->conn,
+			  xcb_shm_attach_fd_checked(pool->conn,
+						    seg->info.shmseg,
+						    fd, 0));
+  if (err) {
+      free(err);
+      munmap(seg->info.shmaddr, seg->size);
+      return 0;
+  }
+  return 1;
+}
+
+
+/* Make a segment of at least size bytes, attached to the
+ * server.
+ */
+static segment_t *
+segment_create (xcb_image_shm_pool_t *  pool,
+		uint32_t                size)
+{
+  segment_t *  seg;
+
+  seg = malloc(sizeof(*seg));
+  if (!seg)
+      return 0;
+  seg->size = (size + SEGMENT_GRAIN - 1) & ~(SEGMENT_GRAIN - 1);
+  if (seg->size == 0)
+      seg->size = SEGMENT_GRAIN;
+  if ((pool->use_fd && segment_attach_fd(pool, seg)) ||
+      segment_attach_sysv(pool, seg))
+      return seg;
+  free(seg);
+  return 0;
+}
+
+
+static void
+segment_destroy (xcb_image_shm_pool_t *  pool,
+		 segment_t *             seg)
+{
+  xcb_shm_detach(pool->conn, seg->info.shmseg);
+  if (seg->mapped)
+      munmap(seg->info.shmaddr, seg->size);
+  else
+      shmdt(seg->info.shmaddr);
+  free(seg);
+}
+
+
+/* Descriptors can only be passed over a local socket. */
+static int
+can_pass_fds (xcb_connection_t *  conn)
+{
+  struct sockaddr  addr;
+  socklen_t        len = sizeof(addr);
+
+  if (getsockname(xcb_get_file_descriptor(conn), &addr, &len) < 0)
+      return 0;
+  return addr.sa_family == AF_UNIX;
+}
+
+
+xcb_image_shm_pool_t *
+xcb_image_shm_pool_create (xcb_connection_t *  conn,
+			   uint32_t            flags)
+{
+  const xcb_query_extension_reply_t *  ext;
+  xcb_shm_query_version_reply_t *      version;
+  xcb_image_shm_pool_t *               pool;
+
+  ext = xcb_get_extension_data(conn, &xcb_shm_id);
+  if (!ext || !ext->present)
+      return 0;
+  pool = malloc(sizeof(*pool));
+  if (!pool)
+      return 0;
+  pool->conn = conn;
+  pool->flags = flags;
+  pool->use_fd = 0;
+  pool->free = 0;
+  pool->used = 0;
+  if (!(flags & XCB_IMAGE_SHM_POOL_SYSV) && can_pass_fds(conn)) {
+      version = xcb_shm_query_version_reply(conn,
+					    xcb_shm_query_version(conn),
+					    0);
+      if (version) {
+	  pool->use_fd = version->major_version > 1 ||
+	      (version->major_version == 1 && version->minor_version >= 2);
+	  free(version);
+      }
+  }
+  return pool;
+}
+
+#else /* !HAVE_SYS_SHM_H */
+
+static segment_t *
+segment_create (xcb_image_shm_pool_t *  pool,
+		uint32_t                size)
+{
+  return 0;
+}
+
+
+static void
+segment_destroy (xcb_image_shm_pool_t *  pool,
+		 segment_t *             seg)
+{
+  free(seg);
+}
+
+
+xcb_image_shm_pool_t *
+xcb_image_shm_pool_create (xcb_connection_t *  conn,
+			   uint32_t            flags)
+{
+  return 0;
+}
+
+#endif /* HAVE_SYS_SHM_H */
+
+
+static void
+segment_list_destroy (xcb_image_shm_pool_t *  pool,
+		      segment_t *             seg)
+{
+  while (seg) {
+      segment_t *  next = seg->next;
+
+      segment_destroy(pool, seg);
+      seg = next;
+  }
+}
+
+
+void
+xcb_image_shm_pool_destroy (xcb_image_shm_pool_t *  pool)
+{
+  if (!pool)
+      return;
+  segment_list_destroy(pool, pool->free);
+  segment_list_destroy(pool, pool->used);
+  free(pool);
+}
+
+
+void
+xcb_image_shm_pool_trim (xcb_image_shm_pool_t *  pool)
+{
+  segment_list_destroy(pool, pool->free);
+  pool->free = 0;
+}
+
+
+xcb_image_t *
+xcb_image_shm_pool_acquire (xcb_image_shm_pool_t *    pool,
+			    uint16_t                  width,
+			    uint16_t                  height,
+			    xcb_image_format_t        format,
+			    uint8_t                   depth,
+			    xcb_shm_segment_info_t *  shminfo)
+{
+  xcb_image_t *  image;
+  segment_t **   best = 0;
+  segment_t **   p;
+  segment_t *    seg;
+
+  image = xcb_image_create_native(pool->conn, width, height, format,
+				  depth, 0, ~0, 0);
+  if (!image)
+      return 0;
+  /* The smallest idle segment that will do. */
+  for (p = &pool->free; *p; p = &(*p)->next)
+      if ((*p)->size >= image->size && (!best || (*p)->size < (*best)->size))
+	  best = p;
+  if (best) {
+      seg = *best;
+      *best = seg->next;
+  } else {
+      seg = segment_create(pool, image->size);
+      if (!seg) {
+	  xcb_image_destroy(image);
+	  return 0;
+      }
+  }
+  seg->next = pool->used;
+  pool->used = seg;
+  image->base = 0;
+  image->data = seg->info.shmaddr;
+  if (shminfo)
+      *shminfo = seg->info;
+  return image;
+}
+
+
+void
+xcb_image_shm_pool_release (xcb_image_shm_pool_t *  pool,
+			    xcb_image_t *           image)
+{
+  segment_t **  p;
+  segment_t *   seg;
+
+  if (!image)
+      return;
+  for (p = &pool->used; *p; p = &(*p)->next) {
+      seg = *p;
+      if (seg->info.shmaddr == image->data) {
+	  *p = seg->next;
+	  seg->next = pool->free;
+	  pool->free = seg;
+	  xcb_image_destroy(image);
+	  return;
+      }
+  }
+}
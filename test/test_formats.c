@@ -156,15 +156,30 @@ int main(int argc, char **argv)
 	assert(visual);
 	if(argc > 1)
 		format = parse_format(argv[1]);
-	if (root->root_depth != 24 ||
+	if ((root->root_depth != 24 && root->root_depth != 30) ||
 	    visual->_class != XCB_VISUAL_CLASS_TRUE_COLOR)
 	{
-		printf("Only 24 bit TrueColor visuals for now\n");
+		printf("Only 24 or 30 bit TrueColor visuals for now\n");
 		exit(1);
 	}
 	depth = format->depth;
 
 	im = create_image(c, depth, format->format);
+	if (im && depth == 24 && root->root_depth == 30)
+	{
+		/* e.g. Xvfb -screen 0 640x480x30: exercise the
+		   8 to 10 bit per channel conversion */
+		xcb_image_t *deep;
+		deep = xcb_image_create_native(c, WIDTH, HEIGHT,
+					       format->format, 30, 0, 0, 0);
+		if (!deep || !xcb_image_convert(im, deep))
+		{
+			printf("Depth 30 conversion failed\n");
+			exit(1);
+		}
+		xcb_image_destroy(im);
+		im = deep;
+	}
         if (format->format == XCB_IMAGE_FORMAT_XY_PIXMAP && format->plane_mask != 0 && depth > 1)
                 im->plane_mask = format->plane_mask;
 	d = create_window(c, root);
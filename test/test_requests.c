@@ -0,0 +1,1174 @@
+/*
+ * Copyright © 2026 The xcb-util-image developers
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF
+ * CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ * Except as contained in this notice, the names of the authors or
+ * their institutions shall not be used in advertising or otherwise to
+ * promote the sale, use or other dealings in this Software without
+ * prior written authorization from the authors.
+ */
+
+/*
+ * Checks the requests the library sends, without an X
+ * server.  The libxcb entry points it uses are replaced by
+ * the definitions below, which stand in for a server: puts
+ * are decoded and drawn onto a canvas, which is then compared
+ * with the image that was put.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+/* For memfd_create() and file seals. */
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <xcb/xcb.h>
+#include <xcb/xcbext.h>
+#ifdef HAVE_SYS_SHM_H
+#include <sys/ipc.h>
+#include <sys/shm.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <xcb/shm.h>
+#endif
+#include "xcb_image.h"
+
+#define CONN ((xcb_connection_t *) 1)
+#define SIZE(a) (sizeof (a) / sizeof (a[0]))
+
+#define CANVAS_WIDTH  2048
+#define CANVAS_HEIGHT 256
+
+static int		failures;
+
+#define CHECK(cond, ...) do {						\
+    if (!(cond)) {							\
+	fprintf (stderr, "%s:%d: ", __FILE__, __LINE__);		\
+	fprintf (stderr, __VA_ARGS__);					\
+	fprintf (stderr, "\n");						\
+	failures++;							\
+    }									\
+} while (0)
+
+
+/*
+ * The connection setup: one screen, with pixmap formats for
+ * the depths used below.
+ */
+
+static union {
+    xcb_setup_t	setup;
+    uint8_t	bytes[1024];
+} setup;
+
+static uint32_t	big_requests_length;
+static int	big_requests_queries;
+
+static void
+setup_init (uint8_t byte_order, uint8_t bit_order, uint16_t max_request)
+{
+    static const struct { uint8_t depth, bpp; } pixmap_formats[] = {
+	{ 1, 1 }, { 4, 8 }, { 8, 8 }, { 16, 16 }, { 24, 32 }, { 32, 32 }
+    };
+    xcb_format_t	*format;
+    xcb_screen_t	*screen;
+    int			i;
+
+    memset (&setup, 0, sizeof (setup));
+    setup.setup.status = 1;
+    setup.setup.protocol_major_version = 11;
+    setup.setup.maximum_request_length = max_request;
+    setup.setup.image_byte_order = byte_order;
+    setup.setup.bitmap_format_bit_order = bit_order;
+    setup.setup.bitmap_format_scanline_unit = 32;
+    setup.setup.bitmap_format_scanline_pad = 32;
+    setup.setup.roots_len = 1;
+    setup.setup.pixmap_formats_len = SIZE (pixmap_formats);
+    format = (xcb_format_t *) (&setup.setup + 1);
+    for (i = 0; i < SIZE (pixmap_formats); i++, format++) {
+	format->depth = pixmap_formats[i].depth;
+	format->bits_per_pixel = pixmap_formats[i].bpp;
+	format->scanline_pad = 32;
+    }
+    screen = (xcb_screen_t *) format;
+    screen->root_depth = 24;
+    setup.setup.length = ((uint8_t *) (screen + 1) - setup.bytes - 8) / 4;
+    big_requests_length = 4 * 1024 * 1024;
+    big_requests_queries = 0;
+}
+
+const xcb_setup_t *
+xcb_get_setup (xcb_connection_t *c)
+{
+    return &setup.setup;
+}
+
+uint32_t
+xcb_get_maximum_request_length (xcb_connection_t *c)
+{
+    big_requests_queries++;
+    return big_requests_length;
+}
+
+
+/*
+ * The drawable: a canvas of pixel values, and a count of
+ * what was sent to it.
+ */
+
+static uint32_t	canvas[CANVAS_HEIGHT][CANVAS_WIDTH];
+static unsigned	sequence;
+static int	requests;
+static uint32_t	largest_request;
+
+static void
+canvas_clear (void)
+{
+    memset (canvas, 0xff, sizeof (canvas));
+    requests = 0;
+    largest_request = 0;
+}
+
+/* Draw a PutImage whose data is laid out like image. */
+static void
+draw_put (xcb_image_t *image, uint8_t format, uint16_t width, uint16_t height,
+	  int16_t dst_x, int16_t dst_y, uint8_t left_pad, uint8_t depth,
+	  const uint8_t *data, uint32_t length)
+{
+    xcb_image_t	*wire;
+    uint32_t	x, y;
+
+    requests++;
+    if (length > largest_request)
+	largest_request = length;
+    CHECK (depth == image->depth, "depth %d", depth);
+    CHECK (format != XCB_IMAGE_FORMAT_Z_PIXMAP || left_pad == 0 ||
+	   depth == 1, "z-pixmap left pad %d", left_pad);
+    wire = xcb_image_create (width + left_pad, height, format,
+			     image->scanline_pad, depth, image->bpp,
+			     image->unit, image->byte_order,
+			     image->bit_order, NULL, ~0, NULL);
+    if (!wire)
+	return;
+    CHECK (length >= wire->size && length - wire->size < 4,
+	   "length %u for %u", length, wire->size);
+    if (length >= wire->size) {
+	wire->data = (uint8_t *) data;
+	for (y = 0; y < height; y++)
+	    for (x = 0; x < width; x++)
+		if (dst_y + y < CANVAS_HEIGHT && dst_x + x < CANVAS_WIDTH)
+		    canvas[dst_y + y][dst_x + x] =
+			xcb_image_get_pixel (wire, left_pad + x, y);
+    }
+    free (wire);
+}
+
+/* The image the puts come from, for their layout. */
+static xcb_image_t	*put_source;
+
+xcb_void_cookie_t
+xcb_put_image (xcb_connection_t *c, uint8_t format, xcb_drawable_t drawable,
+	       xcb_gcontext_t gc, uint16_t width, uint16_t height,
+	       int16_t dst_x, int16_t dst_y, uint8_t left_pad, uint8_t depth,
+	       uint32_t data_len, const uint8_t *data)
+{
+    xcb_void_cookie_t	cookie = { ++sequence };
+
+    draw_put (put_source, format, width, height, dst_x, dst_y, left_pad,
+	      depth, data, data_len);
+    return cookie;
+}
+
+unsigned int
+xcb_send_request (xcb_connection_t *c, int flags, struct iovec *vector,
+		  const xcb_protocol_request_t *request)
+{
+    xcb_put_image_request_t	*put;
+    uint8_t			*buf, *p;
+    size_t			length = 0;
+    size_t			i;
+
+    for (i = 0; i < request->count; i++)
+	length += vector[i].iov_len;
+    CHECK (request->opcode == XCB_PUT_IMAGE, "opcode %d", request->opcode);
+    buf = p = malloc (length);
+    for (i = 0; i < request->count; i++) {
+	if (vector[i].iov_len)
+	    memcpy (p, vector[i].iov_base, vector[i].iov_len);
+	p += vector[i].iov_len;
+    }
+    put = (xcb_put_image_request_t *) buf;
+    CHECK ((length & 3) == 0, "unpadded request of %u", (unsigned) length);
+    draw_put (put_source, put->format, put->width, put->height,
+	      put->dst_x, put->dst_y, put->left_pad, put->depth,
+	      buf + sizeof (*put), length - sizeof (*put));
+    free (buf);
+    return ++sequence;
+}
+
+/*
+ * GetImage: replies are cut from the canvas, standing in for
+ * a drawable of canvas_depth, and laid out as the setup says.
+ */
+
+static uint8_t	canvas_depth;
+static int	gets, replies, discards, gets_after_reply;
+static unsigned	failing_reply;
+
+static struct {
+    unsigned		sequence;
+    uint8_t		format;
+    int16_t		x, y;
+    uint16_t		width, height;
+    uint32_t		plane_mask;
+} get_requests[1024];
+
+/* Fill the canvas with random pixels of canvas_depth. */
+static void
+canvas_randomize (uint8_t depth)
+{
+    uint32_t	x, y;
+
+    canvas_depth = depth;
+    for (y = 0; y < CANVAS_HEIGHT; y++)
+	for (x = 0; x < CANVAS_WIDTH; x++)
+	    canvas[y][x] = (uint32_t) rand () * 0x9e3779b1 &
+		(depth == 32 ? ~0u : (1u << depth) - 1);
+    gets = replies = discards = gets_after_reply = 0;
+    failing_reply = 0;
+}
+
+xcb_get_image_cookie_t
+xcb_get_image (xcb_connection_t *c, uint8_t format, xcb_drawable_t drawable,
+	       int16_t x, int16_t y, uint16_t width, uint16_t height,
+	       uint32_t plane_mask)
+{
+    xcb_get_image_cookie_t	cookie = { ++sequence };
+    int				i = cookie.sequence % SIZE (get_requests);
+
+    gets++;
+    if (replies)
+	gets_after_reply++;
+    get_requests[i].sequence = cookie.sequence;
+    get_requests[i].format = format;
+    get_requests[i].x = x;
+    get_requests[i].y = y;
+    get_requests[i].width = width;
+    get_requests[i].height = height;
+    get_requests[i].plane_mask = plane_mask;
+    return cookie;
+}
+
+/* The reply to a GetImage: for xy-pixmaps, only the planes
+   in the mask, most significant first. */
+static xcb_get_image_reply_t *
+get_image_reply (unsigned seq)
+{
+    xcb_get_image_reply_t	*reply;
+    xcb_image_t			*image;
+    uint32_t			mask, plane_size, length, x, y;
+    uint8_t			*data;
+    int				i = seq % SIZE (get_requests);
+    int				plane;
+
+    CHECK (get_requests[i].sequence == seq, "reply to %u", seq);
+    mask = get_requests[i].plane_mask &
+	(canvas_depth == 32 ? ~0u : (1u << canvas_depth) - 1);
+    image = xcb_image_create_native (CONN, get_requests[i].width,
+				     get_requests[i].height,
+				     get_requests[i].format, canvas_depth,
+				     NULL, 0, NULL);
+    for (y = 0; y < image->height; y++)
+	for (x = 0; x < image->width; x++)
+	    xcb_image_put_pixel (image, x, y,
+				 canvas[get_requests[i].y + y]
+				       [get_requests[i].x + x] & mask);
+    plane_size = image->stride * image->height;
+    length = image->size;
+    if (get_requests[i].format == XCB_IMAGE_FORMAT_XY_PIXMAP)
+	length = plane_size * xcb_popcount (mask);
+    reply = calloc (1, sizeof (*reply) + length);
+    reply->response_type = XCB_GET_IMAGE;
+    reply->sequence = seq;
+    reply->depth = canvas_depth;
+    reply->length = length / 4;
+    data = (uint8_t *) (reply + 1);
+    if (get_requests[i].format == XCB_IMAGE_FORMAT_XY_PIXMAP) {
+	for (plane = canvas_depth - 1; plane >= 0; plane--)
+	    if (mask >> plane & 1) {
+		memcpy (data, image->data +
+			(canvas_depth - 1 - plane) * plane_size, plane_size);
+		data += plane_size;
+	    }
+    } else {
+	memcpy (data, image->data, length);
+    }
+    xcb_image_destroy (image);
+    return reply;
+}
+
+xcb_get_image_reply_t *
+xcb_get_image_reply (xcb_connection_t *c, xcb_get_image_cookie_t cookie,
+		     xcb_generic_error_t **e)
+{
+    replies++;
+    if (e)
+	*e = NULL;
+    if (cookie.sequence == failing_reply)
+	return NULL;
+    return get_image_reply (cookie.sequence);
+}
+
+void
+xcb_discard_reply (xcb_connection_t *c, unsigned int seq)
+{
+    discards++;
+}
+
+/* Replies up to this sequence number have arrived. */
+static unsigned	arrived;
+
+int
+xcb_poll_for_reply (xcb_connection_t *c, unsigned int request, void **reply,
+		    xcb_generic_error_t **error)
+{
+    if (request > arrived)
+	return 0;
+    replies++;
+    if (request == failing_reply) {
+	*reply = NULL;
+	if (error)
+	    *error = calloc (1, sizeof (**error));
+	return 1;
+    }
+    *reply = get_image_reply (request);
+    return 1;
+}
+
+
+#ifdef HAVE_SYS_SHM_H
+/*
+ * MIT-SHM: the server maps every segment attached to it, so
+ * that the client's writes can be looked for on its side.
+ */
+
+static xcb_query_extension_reply_t	shm_extension;
+static uint32_t	next_id;
+static int	attaches, detaches, failing_attach;
+
+static struct {
+    uint8_t	*addr;
+    uint32_t	size;
+    int		mapped;		/* by mmap() rather than shmat() */
+} server_segments[256];
+
+const xcb_query_extension_reply_t *
+xcb_get_extension_data (xcb_connection_t *c, xcb_extension_t *ext)
+{
+    return &shm_extension;
+}
+
+uint32_t
+xcb_generate_id (xcb_connection_t *c)
+{
+    return ++next_id;
+}
+
+xcb_generic_error_t *
+xcb_request_check (xcb_connection_t *c, xcb_void_cookie_t cookie)
+{
+    return cookie.sequence ? NULL : calloc (1, sizeof (xcb_generic_error_t));
+}
+
+xcb_void_cookie_t
+xcb_shm_attach_checked (xcb_connection_t *c, xcb_shm_seg_t shmseg,
+			uint32_t shmid, uint8_t read_only)
+{
+    xcb_void_cookie_t	cookie = { 0 };
+    struct shmid_ds	ds;
+    void		*addr;
+
+    attaches++;
+    if (failing_attach || shmctl (shmid, IPC_STAT, &ds) < 0)
+	return cookie;
+    addr = shmat (shmid, NULL, 0);
+    if (addr == (void *) -1)
+	return cookie;
+    server_segments[shmseg % SIZE (server_segments)].addr = addr;
+    server_segments[shmseg % SIZE (server_segments)].size = ds.shm_segsz;
+    server_segments[shmseg % SIZE (server_segments)].mapped = 0;
+    cookie.sequence = ++sequence;
+    return cookie;
+}
+
+xcb_void_cookie_t
+xcb_shm_detach (xcb_connection_t *c, xcb_shm_seg_t shmseg)
+{
+    xcb_void_cookie_t	cookie = { ++sequence };
+    int			i = shmseg % SIZE (server_segments);
+
+    detaches++;
+    CHECK (server_segments[i].addr, "detach of segment %u", shmseg);
+    if (server_segments[i].mapped)
+	munmap (server_segments[i].addr, server_segments[i].size);
+    else if (server_segments[i].addr)
+	shmdt (server_segments[i].addr);
+    server_segments[i].addr = NULL;
+    return cookie;
+}
+
+/*
+ * Segments passed as descriptors, for MIT-SHM 1.2 on a local
+ * socket: the client's memfds with AttachFd, or, when
+ * memfd_create() is made to fail, the server's own with
+ * CreateSegment.
+ */
+
+static int	shm_minor_version = 2;
+static int	connection_fd = -1, tcp_connection;
+static int	sealed_attaches, creates, create_nfds = 1;
+static int	failing_fd_attach, failing_create;
+static int	memfd_missing;
+
+int
+xcb_get_file_descriptor (xcb_connection_t *c)
+{
+    static int	tcp_fd = -1;
+
+    if (tcp_connection) {
+	if (tcp_fd < 0)
+	    tcp_fd = socket (AF_INET, SOCK_STREAM, 0);
+	return tcp_fd;
+    }
+    if (connection_fd < 0) {
+	int	pair[2];
+
+	if (socketpair (AF_UNIX, SOCK_STREAM, 0, pair) == 0)
+	    connection_fd = pair[0];
+    }
+    return connection_fd;
+}
+
+xcb_shm_query_version_cookie_t
+xcb_shm_query_version (xcb_connection_t *c)
+{
+    xcb_shm_query_version_cookie_t	cookie = { ++sequence };
+
+    return cookie;
+}
+
+xcb_shm_query_version_reply_t *
+xcb_shm_query_version_reply (xcb_connection_t *c,
+			     xcb_shm_query_version_cookie_t cookie,
+			     xcb_generic_error_t **e)
+{
+    xcb_shm_query_version_reply_t	*reply = calloc (1, sizeof (*reply));
+
+    reply->major_version = 1;
+    reply->minor_version = shm_minor_version;
+    return reply;
+}
+
+/* Map fd for the server as shmseg; fd is the server's. */
+static int
+server_map (xcb_shm_seg_t shmseg, int fd)
+{
+    struct stat	st;
+    void	*addr;
+    int		i = shmseg % SIZE (server_segments);
+
+    if (fstat (fd, &st) < 0)
+	return 0;
+    addr = mmap (NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (addr == MAP_FAILED)
+	return 0;
+    server_segments[i].addr = addr;
+    server_segments[i].size = st.st_size;
+    server_segments[i].mapped = 1;
+    return 1;
+}
+
+xcb_void_cookie_t
+xcb_shm_attach_fd_checked (xcb_connection_t *c, xcb_shm_seg_t shmseg,
+			   int32_t shm_fd, uint8_t read_only)
+{
+    xcb_void_cookie_t	cookie = { 0 };
+
+    attaches++;
+#ifdef F_GET_SEALS
+    if (fcntl (shm_fd, F_GET_SEALS) ==
+	(F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL))
+	sealed_attaches++;
+#endif
+    /* libxcb closes the descriptor once it is sent. */
+    if (!failing_fd_attach && server_map (shmseg, shm_fd))
+	cookie.sequence = ++sequence;
+    close (shm_fd);
+    return cookie;
+}
+
+/* The segment made by the last CreateSegment, if it worked. */
+static unsigned	created_sequence;
+static int	created_fd = -1;
+
+xcb_shm_create_segment_cookie_t
+xcb_shm_create_segment (xcb_connection_t *c, xcb_shm_seg_t shmseg,
+			uint32_t size, uint8_t read_only)
+{
+    xcb_shm_create_segment_cookie_t	cookie = { ++sequence };
+    char				name[] = "/tmp/test_requests.XXXXXX";
+
+    creates++;
+    created_sequence = 0;
+    if (failing_create)
+	return cookie;
+    created_fd = mkstemp (name);
+    if (created_fd < 0)
+	return cookie;
+    unlink (name);
+    if (ftruncate (created_fd, size) == 0 && server_map (shmseg, created_fd))
+	created_sequence = cookie.sequence;
+    else
+	close (created_fd);
+    return cookie;
+}
+
+/* The reply carries the descriptor, as libxcb lays it out;
+   create_nfds of 0 makes one that lost it. */
+xcb_shm_create_segment_reply_t *
+xcb_shm_create_segment_reply (xcb_connection_t *c,
+			      xcb_shm_create_segment_cookie_t cookie,
+			      xcb_generic_error_t **e)
+{
+    xcb_shm_create_segment_reply_t	*reply;
+
+    if (created_sequence != cookie.sequence) {
+	if (e)
+	    *e = calloc (1, sizeof (**e));
+	return NULL;
+    }
+    reply = calloc (1, sizeof (*reply) + sizeof (int));
+    reply->nfd = create_nfds;
+    if (create_nfds)
+	*(int *) (reply + 1) = created_fd;
+    else
+	close (created_fd);
+    return reply;
+}
+
+int *
+xcb_shm_create_segment_reply_fds (xcb_connection_t *c,
+				  xcb_shm_create_segment_reply_t *reply)
+{
+    return (int *) (reply + 1);
+}
+
+#ifdef HAVE_MEMFD_CREATE
+/* The library's memfd_create(), which can be made to fail as
+   it would on systems without it. */
+int
+memfd_create (const char *name, unsigned int flags)
+{
+    if (memfd_missing) {
+	errno = ENOSYS;
+	return -1;
+    }
+    return syscall (SYS_memfd_create, name, flags);
+}
+#endif
+
+/* Whether the server sees the data of image in its segment. */
+static int
+server_sees (xcb_image_t *image, const xcb_shm_segment_info_t *info)
+{
+    int	i = info->shmseg % SIZE (server_segments);
+
+    return server_segments[i].addr && server_segments[i].size >= image->size &&
+	memcmp (server_segments[i].addr, image->data, image->size) == 0;
+}
+#endif /* HAVE_SYS_SHM_H */
+
+
+static xcb_image_t *
+random_image (uint16_t width, uint16_t height, xcb_image_format_t format,
+	      uint8_t depth)
+{
+    xcb_image_t	*image;
+    uint32_t	i;
+
+    image = xcb_image_create_native (CONN, width, height, format, depth,
+				     NULL, 0, NULL);
+    if (!image)
+	return NULL;
+    for (i = 0; i < image->size; i++)
+	image->data[i] = rand ();
+    return image;
+}
+
+/* Whether the canvas at dst_x, dst_y holds the width by
+   height rectangle of image at x, y. */
+static int
+canvas_holds (xcb_image_t *image, uint32_t x, uint32_t y,
+	      uint32_t width, uint32_t height, int dst_x, int dst_y)
+{
+    uint32_t	i, j;
+
+    for (j = 0; j < height; j++)
+	for (i = 0; i < width; i++)
+	    if (canvas[dst_y + j][dst_x + i] !=
+		xcb_image_get_pixel (image, x + i, y + j)) {
+		fprintf (stderr, "canvas differs at %u,%u\n", i, j);
+		return 0;
+	    }
+    return 1;
+}
+
+
+/* xcb_image_put(): small images go out in one request sized
+   from the core maximum request length; big ones in bands
+   within the BIG-REQUESTS one; a left pad skips the same
+   pixels either way. */
+static void
+check_put (void)
+{
+    xcb_image_t	*image, view;
+    int		big, left_pad;
+
+    setup_init (XCB_IMAGE_ORDER_LSB_FIRST, XCB_IMAGE_ORDER_LSB_FIRST, 65535);
+    image = random_image (40, 10, XCB_IMAGE_FORMAT_Z_PIXMAP, 24);
+    put_source = image;
+    canvas_clear ();
+    xcb_image_put (CONN, 1, 2, image, 3, 4, 0);
+    CHECK (requests == 1 && big_requests_queries == 0,
+	   "small put: %d requests, %d queries", requests,
+	   big_requests_queries);
+    CHECK (canvas_holds (image, 0, 0, 40, 10, 3, 4), "small put");
+    xcb_image_destroy (image);
+
+    image = random_image (1920, 200, XCB_IMAGE_FORMAT_Z_PIXMAP, 24);
+    put_source = image;
+    canvas_clear ();
+    xcb_image_put (CONN, 1, 2, image, 0, 0, 0);
+    CHECK (requests == 6 && big_requests_queries > 0 &&
+	   largest_request <= 256 * 1024,
+	   "big put: %d requests of up to %u, %d queries", requests,
+	   largest_request, big_requests_queries);
+    CHECK (canvas_holds (image, 0, 0, 1920, 200, 0, 0), "big put");
+
+    /* Without BIG-REQUESTS the core maximum is the limit. */
+    big_requests_length = 65535;
+    canvas_clear ();
+    xcb_image_put (CONN, 1, 2, image, 0, 0, 0);
+    CHECK (largest_request <= 65535 * 4 - sizeof (xcb_put_image_request_t),
+	   "core put: request of %u", largest_request);
+    CHECK (canvas_holds (image, 0, 0, 1920, 200, 0, 0), "core put");
+    xcb_image_destroy (image);
+
+    for (big = 0; big < 2; big++) {
+	for (left_pad = 1; left_pad < 24; left_pad += 11) {
+	    setup_init (XCB_IMAGE_ORDER_MSB_FIRST,
+			XCB_IMAGE_ORDER_LSB_FIRST, 65535);
+	    image = random_image (big ? 2000 : 40, big ? 150 : 10,
+				  XCB_IMAGE_FORMAT_XY_PIXMAP, 8);
+	    put_source = image;
+	    xcb_image_view (image, 0, 0, image->width - left_pad,
+			    image->height, &view);
+	    canvas_clear ();
+	    xcb_image_put (CONN, 1, 2, &view, 5, 6, left_pad);
+	    CHECK (requests >= 1 + big, "left pad %d: %d requests",
+		   left_pad, requests);
+	    CHECK (canvas_holds (image, left_pad, 0, view.width, view.height,
+				 5, 6),
+		   "left pad %d of %s image", left_pad, big ? "big" : "small");
+	    /* too much to skip */
+	    canvas_clear ();
+	    xcb_image_put (CONN, 1, 2, image, 5, 6,
+			   image->stride * 8 - image->width + 1);
+	    CHECK (requests == 0, "left pad past the stride");
+	    xcb_image_destroy (image);
+	}
+    }
+}
+
+
+/* An image of any layout, filled with random bytes. */
+static xcb_image_t *
+random_layout (uint16_t width, uint16_t height, xcb_image_format_t format,
+	       uint8_t pad, uint8_t depth, uint8_t bpp, uint8_t unit,
+	       xcb_image_order_t order)
+{
+    xcb_image_t	*image;
+    uint32_t	i;
+
+    image = xcb_image_create (width, height, format, pad, depth, bpp, unit,
+			      order, order, NULL, 0, NULL);
+    for (i = 0; i < image->size; i++)
+	image->data[i] = rand ();
+    return image;
+}
+
+/* xcb_image_put_rect(): rectangles of every layout, at
+   every alignment, including 4 bpp z-pixmaps starting
+   mid-byte, which are staged; big ones in bands. */
+static void
+check_put_rect (void)
+{
+    static const struct {
+	xcb_image_format_t	format;
+	uint8_t			pad, depth, bpp, unit;
+    } layouts[] = {
+	{ XCB_IMAGE_FORMAT_XY_BITMAP, 8, 1, 1, 8 },
+	{ XCB_IMAGE_FORMAT_XY_BITMAP, 16, 1, 1, 16 },
+	{ XCB_IMAGE_FORMAT_XY_BITMAP, 32, 1, 1, 32 },
+	{ XCB_IMAGE_FORMAT_XY_PIXMAP, 8, 4, 4, 8 },
+	{ XCB_IMAGE_FORMAT_XY_PIXMAP, 32, 8, 8, 32 },
+	{ XCB_IMAGE_FORMAT_XY_PIXMAP, 32, 24, 24, 16 },
+	{ XCB_IMAGE_FORMAT_Z_PIXMAP, 8, 4, 4, 8 },
+	{ XCB_IMAGE_FORMAT_Z_PIXMAP, 32, 4, 4, 8 },
+	{ XCB_IMAGE_FORMAT_Z_PIXMAP, 32, 8, 8, 8 },
+	{ XCB_IMAGE_FORMAT_Z_PIXMAP, 32, 16, 16, 16 },
+	{ XCB_IMAGE_FORMAT_Z_PIXMAP, 32, 24, 24, 24 },
+	{ XCB_IMAGE_FORMAT_Z_PIXMAP, 32, 24, 32, 32 },
+	{ XCB_IMAGE_FORMAT_Z_PIXMAP, 32, 32, 32, 32 },
+    };
+    static const xcb_image_order_t	orders[] = {
+	XCB_IMAGE_ORDER_LSB_FIRST, XCB_IMAGE_ORDER_MSB_FIRST
+    };
+    xcb_image_t		*image;
+    xcb_void_cookie_t	cookie;
+    uint32_t		x, y, width, height;
+    int			l, o, i;
+
+    setup_init (XCB_IMAGE_ORDER_LSB_FIRST, XCB_IMAGE_ORDER_LSB_FIRST, 65535);
+    for (l = 0; l < SIZE (layouts); l++)
+	for (o = 0; o < SIZE (orders); o++)
+	    for (i = 0; i < 20; i++) {
+		image = random_layout (40 + rand () % 60, 3 + rand () % 100,
+				       layouts[l].format, layouts[l].pad,
+				       layouts[l].depth, layouts[l].bpp,
+				       layouts[l].unit, orders[o]);
+		put_source = image;
+		x = i == 0 ? 0 : i == 1 ? 1 : rand () % image->width;
+		y = rand () % image->height;
+		width = i == 0 ? image->width : 1 + rand () % (image->width - x);
+		height = 1 + rand () % (image->height - y);
+		canvas_clear ();
+		cookie = xcb_image_put_rect (CONN, 1, 2, image, x, y,
+					     width, height, 100, 20);
+		CHECK (cookie.sequence == sequence && requests >= 1,
+		       "put_rect: %d requests", requests);
+		CHECK (canvas_holds (image, x, y, width, height, 100, 20),
+		       "put_rect of %u,%u %ux%u, layout %d, order %d",
+		       x, y, width, height, l, o);
+		xcb_image_destroy (image);
+	    }
+
+    /* A 1 MiB rectangle in bands, within either limit. */
+    image = random_layout (1024, 256, XCB_IMAGE_FORMAT_Z_PIXMAP, 32, 32, 32,
+			   32, XCB_IMAGE_ORDER_LSB_FIRST);
+    put_source = image;
+    canvas_clear ();
+    xcb_image_put_rect (CONN, 1, 2, image, 0, 0, 1024, 256, 0, 0);
+    CHECK (requests >= 4 && largest_request <= 256 * 1024,
+	   "banded put_rect: %d requests of up to %u", requests,
+	   largest_request);
+    CHECK (canvas_holds (image, 0, 0, 1024, 256, 0, 0), "banded put_rect");
+    big_requests_length = 65535;
+    canvas_clear ();
+    xcb_image_put_rect (CONN, 1, 2, image, 3, 5, 1021, 251, 0, 0);
+    CHECK (largest_request <= 65535 * 4 - sizeof (xcb_put_image_request_t),
+	   "core put_rect: request of %u", largest_request);
+    CHECK (canvas_holds (image, 3, 5, 1021, 251, 0, 0), "core put_rect");
+
+    /* Rectangles outside the image, even by wrapping. */
+    canvas_clear ();
+    cookie = xcb_image_put_rect (CONN, 1, 2, image, 1020, 0, 5, 1, 0, 0);
+    CHECK (!cookie.sequence && requests == 0, "put_rect past the width");
+    cookie = xcb_image_put_rect (CONN, 1, 2, image, 8, 0, -8, 1, 0, 0);
+    CHECK (!cookie.sequence && requests == 0, "wrapping put_rect");
+    xcb_image_destroy (image);
+}
+
+
+/* Whether image holds the rectangle of the canvas at x, y,
+   with the planes outside plane_mask clear. */
+static int
+image_holds (xcb_image_t *image, uint32_t x, uint32_t y, uint32_t plane_mask)
+{
+    uint32_t	mask = plane_mask &
+	(canvas_depth == 32 ? ~0u : (1u << canvas_depth) - 1);
+    uint32_t	i, j;
+
+    for (j = 0; j < image->height; j++)
+	for (i = 0; i < image->width; i++)
+	    if (xcb_image_get_pixel (image, i, j) !=
+		(canvas[y + j][x + i] & mask)) {
+		fprintf (stderr, "image differs at %u,%u\n", i, j);
+		return 0;
+	    }
+    return 1;
+}
+
+/* xcb_image_get_tiled(): every band is asked for before any
+   reply is read, each band is within band_bytes, and the
+   bands make up the rectangle.  A failed band fails the get,
+   and the replies still to come are discarded. */
+static void
+check_get_tiled (void)
+{
+    static const uint8_t	depths[] = { 1, 4, 8, 16, 24, 32 };
+    xcb_image_t		*image;
+    xcb_image_format_t	format;
+    uint32_t		plane_mask, band_bytes, width, height, limit;
+    int			order, d, i, band;
+
+    for (order = 0; order < 2; order++)
+	for (d = 0; d < SIZE (depths); d++)
+	    for (format = XCB_IMAGE_FORMAT_XY_PIXMAP;
+		 format <= XCB_IMAGE_FORMAT_Z_PIXMAP; format++)
+		for (i = 0; i < 12; i++) {
+		    setup_init (order, order, 65535);
+		    canvas_randomize (depths[d]);
+		    width = 1 + rand () % 200;
+		    height = 1 + rand () % 250;
+		    plane_mask = i & 1 ? rand () : ~0u;
+		    band_bytes = i % 3 ? 1 + rand () % 20000 : 0;
+		    if (i == 5)
+			failing_reply = sequence + 2;
+		    image = xcb_image_get_tiled (CONN, 1, 7, 3, width, height,
+						 plane_mask, format,
+						 band_bytes);
+		    if (i == 5 && gets > 1) {
+			CHECK (!image && replies == 2 &&
+			       discards == gets - 2,
+			       "failed band: %d gets, %d replies, "
+			       "%d discards", gets, replies, discards);
+			if (image)
+			    xcb_image_destroy (image);
+			continue;
+		    }
+		    CHECK (image && gets_after_reply == 0 && replies == gets,
+			   "tiled get: %d gets, %d replies", gets, replies);
+		    if (!image)
+			continue;
+		    limit = band_bytes ? band_bytes : 256 * 1024;
+		    for (band = 0; band < gets; band++) {
+			int	r = (sequence - band) % SIZE (get_requests);
+			uint32_t	row = (get_requests[r].width + 31) / 32 * 4;
+
+			CHECK (gets == 1 || get_requests[r].height == 1 ||
+			       get_requests[r].height * row * 32 <= limit,
+			       "band of %u rows of %u bytes for %u",
+			       get_requests[r].height, row * 32, limit);
+		    }
+		    CHECK (image->width == width && image->height == height &&
+			   image->depth == depths[d] &&
+			   image_holds (image, 7, 3, plane_mask),
+			   "tiled get of %ux%u, depth %d, format %d",
+			   width, height, depths[d], format);
+		    xcb_image_destroy (image);
+		}
+    /* An empty rectangle is a single get, whatever the band. */
+    for (i = 0; i < 2; i++) {
+	setup_init (0, 0, 65535);
+	canvas_randomize (8);
+	width = i ? 40 : 0;
+	height = i ? 0 : 40;
+	image = xcb_image_get_tiled (CONN, 1, 7, 3, width, height, ~0u,
+				     XCB_IMAGE_FORMAT_Z_PIXMAP, 1);
+	CHECK (gets == 1 && image && image->width == width &&
+	       image->height == height,
+	       "tiled get of %ux%u: %d gets", width, height, gets);
+	if (image)
+	    xcb_image_destroy (image);
+    }
+}
+
+
+/* xcb_image_get_start(), then xcb_image_get_poll() or
+   xcb_image_get_finish(): the requests all go out first,
+   polls before the reply is in leave the image alone, and
+   the images are those xcb_image_get() would give, masked
+   planes and all. */
+static void
+check_get_async (void)
+{
+    static const struct {
+	xcb_image_format_t	format;
+	uint32_t		plane_mask;
+    } gets_made[] = {
+	{ XCB_IMAGE_FORMAT_Z_PIXMAP, ~0u },
+	{ XCB_IMAGE_FORMAT_XY_PIXMAP, ~0u },
+	{ XCB_IMAGE_FORMAT_XY_PIXMAP, 0x0f },
+	{ XCB_IMAGE_FORMAT_Z_PIXMAP, 0x5a },
+	{ XCB_IMAGE_FORMAT_XY_PIXMAP, 0xa5 },
+    };
+    static const uint8_t	depths[] = { 1, 8, 24 };
+    xcb_image_get_cookie_t	cookies[SIZE (gets_made)], failing;
+    xcb_image_t			*image, *unset = (xcb_image_t *) &failures;
+    int				d, i;
+
+    setup_init (XCB_IMAGE_ORDER_MSB_FIRST, XCB_IMAGE_ORDER_MSB_FIRST, 65535);
+    for (d = 0; d < SIZE (depths); d++) {
+	canvas_randomize (depths[d]);
+	for (i = 0; i < SIZE (gets_made); i++)
+	    cookies[i] = xcb_image_get_start (CONN, 1, i, 2 * i, 33, 9,
+					      gets_made[i].plane_mask,
+					      gets_made[i].format);
+	failing = xcb_image_get_start (CONN, 1, 0, 0, 8, 8, ~0u,
+				       XCB_IMAGE_FORMAT_Z_PIXMAP);
+	failing_reply = failing.cookie.sequence;
+	CHECK (gets == SIZE (gets_made) + 1 && replies == 0,
+	       "async get: %d gets, %d replies", gets, replies);
+
+	arrived = 0;
+	image = unset;
+	CHECK (!xcb_image_get_poll (CONN, cookies[0], &image) &&
+	       image == unset, "poll before the reply");
+	arrived = sequence;
+	CHECK (xcb_image_get_poll (CONN, failing, &image) && !image,
+	       "poll of a failed get");
+	for (i = 0; i < SIZE (gets_made); i++) {
+	    image = unset;
+	    if (i & 1)
+		image = xcb_image_get_finish (CONN, cookies[i]);
+	    else
+		CHECK (xcb_image_get_poll (CONN, cookies[i], &image),
+		       "poll after the reply");
+	    CHECK (image && image != unset && image->depth == depths[d] &&
+		   image_holds (image, i, 2 * i, gets_made[i].plane_mask),
+		   "async get %d at depth %d", i, depths[d]);
+	    if (image && image != unset)
+		xcb_image_destroy (image);
+	}
+	CHECK (replies == gets, "async get: %d gets, %d replies", gets,
+	       replies);
+    }
+}
+
+
+#ifdef HAVE_SYS_SHM_H
+/* A SysV pool: segments are made only when no idle one will
+   do, reused best fit first, and detached when trimmed or
+   when the pool goes. */
+static void
+check_shm_pool_sysv (void)
+{
+    xcb_image_shm_pool_t	*pool;
+    xcb_shm_segment_info_t	a, b, info;
+    xcb_image_t			*first, *second, *image, foreign;
+    uint8_t			*first_addr;
+    int				i;
+
+    setup_init (XCB_IMAGE_ORDER_LSB_FIRST, XCB_IMAGE_ORDER_LSB_FIRST, 65535);
+    shm_extension.present = 1;
+    attaches = detaches = 0;
+    pool = xcb_image_shm_pool_create (CONN, XCB_IMAGE_SHM_POOL_SYSV);
+    CHECK (pool && attaches == 0, "pool create");
+    if (!pool)
+	return;
+    first = xcb_image_shm_pool_acquire (pool, 640, 480,
+					XCB_IMAGE_FORMAT_Z_PIXMAP, 24, &a);
+    second = xcb_image_shm_pool_acquire (pool, 640, 480,
+					 XCB_IMAGE_FORMAT_Z_PIXMAP, 24, &b);
+    CHECK (first && second && attaches == 2 && a.shmseg != b.shmseg &&
+	   first->data == a.shmaddr && second->data == b.shmaddr &&
+	   a.shmaddr != b.shmaddr, "two segments");
+    if (!first || !second)
+	return;
+    memset (first->data, 1, first->size);
+    memset (second->data, 2, second->size);
+    CHECK (server_sees (first, &a) && server_sees (second, &b),
+	   "shared data");
+
+    /* Similar sizes recycle the first segment. */
+    first_addr = first->data;
+    xcb_image_shm_pool_release (pool, first);
+    for (i = 0; i < 100; i++) {
+	image = xcb_image_shm_pool_acquire (pool, 600 + i % 40, 480,
+					    XCB_IMAGE_FORMAT_Z_PIXMAP, 24,
+					    &info);
+	CHECK (image && image->data == first_addr &&
+	       info.shmaddr == first_addr, "recycled segment %d", i);
+	xcb_image_shm_pool_release (pool, image);
+    }
+    CHECK (attaches == 2, "%d attaches for recycled segments", attaches);
+
+    /* A bigger image needs a new segment; a small one then
+       takes the smallest that fits. */
+    image = xcb_image_shm_pool_acquire (pool, 1920, 1080,
+					XCB_IMAGE_FORMAT_Z_PIXMAP, 24, &info);
+    CHECK (image && attaches == 3 && image->data != first_addr,
+	   "bigger segment");
+    xcb_image_shm_pool_release (pool, image);
+    image = xcb_image_shm_pool_acquire (pool, 64, 64,
+					XCB_IMAGE_FORMAT_XY_BITMAP, 1, &info);
+    CHECK (image && image->data == first_addr && attaches == 3, "best fit");
+
+    /* Images from elsewhere are left alone. */
+    foreign = *image;
+    foreign.data = (uint8_t *) &foreign;
+    xcb_image_shm_pool_release (pool, &foreign);
+
+    xcb_image_shm_pool_trim (pool);
+    CHECK (detaches == 1, "%d detaches on trim", detaches);
+    failing_attach = 1;
+    CHECK (!xcb_image_shm_pool_acquire (pool, 4000, 4000,
+					XCB_IMAGE_FORMAT_Z_PIXMAP, 24, &info),
+	   "failed attach");
+    failing_attach = 0;
+    xcb_image_shm_pool_release (pool, image);
+    xcb_image_shm_pool_destroy (pool);
+    CHECK (detaches == 3, "%d detaches on destroy", detaches);
+    xcb_image_destroy (second);
+
+    shm_extension.present = 0;
+    CHECK (!xcb_image_shm_pool_create (CONN, XCB_IMAGE_SHM_POOL_SYSV),
+	   "pool without MIT-SHM");
+}
+/* Pools on a local socket to an MIT-SHM 1.2 server pass
+   descriptors: memfds, sealed on request, or segments the
+   server makes.  A failed attach or CreateSegment falls back
+   to SysV, detaching only what the server made; older
+   servers and remote connections get SysV directly. */
+static void
+check_shm_pool_fd (void)
+{
+    xcb_image_shm_pool_t	*pool;
+    xcb_shm_segment_info_t	info;
+    xcb_image_t			*image;
+    int				memfd, before;
+
+    setup_init (XCB_IMAGE_ORDER_LSB_FIRST, XCB_IMAGE_ORDER_LSB_FIRST, 65535);
+    shm_extension.present = 1;
+    for (memfd = 0; memfd < 2; memfd++) {
+#ifndef HAVE_MEMFD_CREATE
+	if (memfd)
+	    break;
+#endif
+	memfd_missing = !memfd;
+	attaches = detaches = creates = sealed_attaches = 0;
+	pool = xcb_image_shm_pool_create (CONN, XCB_IMAGE_SHM_POOL_SEAL |
+					  XCB_IMAGE_SHM_POOL_POPULATE);
+	image = xcb_image_shm_pool_acquire (pool, 640, 480,
+					    XCB_IMAGE_FORMAT_Z_PIXMAP, 24,
+					    &info);
+	CHECK (image && info.shmid == (uint32_t) -1 &&
+	       image->data == info.shmaddr &&
+	       attaches == memfd && creates == !memfd,
+	       "%s segment: %d attaches, %d creates",
+	       memfd ? "memfd" : "server", attaches, creates);
+	if (!image)
+	    continue;
+#ifdef F_GET_SEALS
+	CHECK (!memfd || sealed_attaches == 1, "unsealed memfd");
+#endif
+	memset (image->data, 0x5a, image->size);
+	xcb_image_put_pixel (image, 10, 10, 0x123456);
+	CHECK (server_sees (image, &info), "shared descriptor");
+	xcb_image_shm_pool_release (pool, image);
+	image = xcb_image_shm_pool_acquire (pool, 640, 480,
+					    XCB_IMAGE_FORMAT_Z_PIXMAP, 24,
+					    &info);
+	CHECK (image && attaches + creates == 1, "recycled descriptor");
+	xcb_image_shm_pool_release (pool, image);
+
+	/* A refused descriptor or CreateSegment falls back to
+	   SysV, with nothing to detach. */
+	before = detaches;
+	failing_fd_attach = memfd;
+	failing_create = !memfd;
+	image = xcb_image_shm_pool_acquire (pool, 1920, 1080,
+					    XCB_IMAGE_FORMAT_Z_PIXMAP, 24,
+					    &info);
+	failing_fd_attach = failing_create = 0;
+	CHECK (image && info.shmid != (uint32_t) -1 && detaches == before,
+	       "fallback to SysV: %d detaches", detaches - before);
+	xcb_image_shm_pool_release (pool, image);
+	if (!memfd) {
+	    create_nfds = 0;
+	    image = xcb_image_shm_pool_acquire (pool, 4000, 2000,
+						XCB_IMAGE_FORMAT_Z_PIXMAP, 24,
+						&info);
+	    create_nfds = 1;
+	    CHECK (image && info.shmid != (uint32_t) -1 &&
+		   detaches == before + 1,
+		   "segment without a descriptor: %d detaches",
+		   detaches - before);
+	    xcb_image_shm_pool_release (pool, image);
+	}
+	before = detaches;
+	xcb_image_shm_pool_destroy (pool);
+	CHECK (detaches == before + 2 + !memfd, "%d detaches on destroy",
+	       detaches - before);
+    }
+    memfd_missing = 0;
+
+    /* Without descriptor passing: SysV. */
+    shm_minor_version = 1;
+    attaches = 0;
+    pool = xcb_image_shm_pool_create (CONN, 0);
+    image = xcb_image_shm_pool_acquire (pool, 64, 64,
+					XCB_IMAGE_FORMAT_Z_PIXMAP, 24, &info);
+    CHECK (image && info.shmid != (uint32_t) -1 && attaches == 1,
+	   "MIT-SHM 1.1 pool");
+    xcb_image_shm_pool_release (pool, image);
+    xcb_image_shm_pool_destroy (pool);
+    shm_minor_version = 2;
+    tcp_connection = 1;
+    pool = xcb_image_shm_pool_create (CONN, 0);
+    image = xcb_image_shm_pool_acquire (pool, 64, 64,
+					XCB_IMAGE_FORMAT_Z_PIXMAP, 24, &info);
+    CHECK (image && info.shmid != (uint32_t) -1, "remote pool");
+    xcb_image_shm_pool_release (pool, image);
+    xcb_image_shm_pool_destroy (pool);
+    tcp_connection = 0;
+}
+#endif /* HAVE_SYS_SHM_H */
+
+
+int
+main (int argc, char **argv)
+{
+    srand (1);
+    check_put ();
+    check_put_rect ();
+    check_get_tiled ();
+    check_get_async ();
+#ifdef HAVE_SYS_SHM_H
+    check_shm_pool_sysv ();
+    check_shm_pool_fd ();
+#endif
+    if (failures)
+	fprintf (stderr, "%d failures\n", failures);
+    return failures != 0;
+}
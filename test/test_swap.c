@@ -34,9 +34,16 @@
 #include <stdio.h>
 #include <string.h>
 #include <assert.h>
+#ifndef _WIN32
+#include <unistd.h>
+#include <sys/wait.h>
+#endif
 #include <xcb/xcb.h>
 #include <xcb/xcb_aux.h>
 #include "xcb_image.h"
+#include "xcb_bitops.h"
+#define BUILD
+#include "xcb_pixel.h"
 
 xcb_image_format_t  formats[] = {
     XCB_IMAGE_FORMAT_Z_PIXMAP,
@@ -47,12 +54,12 @@ xcb_image_format_t  formats[] = {
 #define NFORMAT SIZE(formats)
 
 int bpps[] = {
-    1, 4, 8, 16, 32
+    1, 4, 8, 16, 24, 32
 };
 #define NBPP SIZE(bpps)
 
 int units[] = {
-    8, 16, 32
+    8, 16, 24, 32
 };
 #define NUNIT SIZE(units)
 
@@ -90,6 +97,30 @@ compare_image(xcb_image_t *a, xcb_image_t *b)
     return 1;
 }
 
+static char *
+order_name (xcb_image_order_t order) {
+  if (order == XCB_IMAGE_ORDER_MSB_FIRST)
+    return "MSB";
+  else
+    return "LSB";
+}
+
+static void
+print_format (xcb_image_t *image)
+{
+  switch (image->format) {
+  case XCB_IMAGE_FORMAT_Z_PIXMAP: fprintf (stderr, "Z pixmap"); break;
+  case XCB_IMAGE_FORMAT_XY_PIXMAP: fprintf (stderr, "XY pixmap"); break;
+  case XCB_IMAGE_FORMAT_XY_BITMAP: fprintf (stderr, "XY bitmap"); break;
+  }
+  fprintf (stderr, " pad: %d bpp: %d depth: %d unit: %d planemask: 0x%08x",
+	   image->scanline_pad, image->bpp, image->depth, image->unit,
+	   image->plane_mask);
+  fprintf (stderr, " byte order: %s bit order: %s stride: %d\n",
+	   order_name (image->byte_order), order_name (image->bit_order),
+	   image->stride);
+}
+
 #define test_width  63
 #define test_height 2
 
@@ -109,10 +140,12 @@ create_test_image (void)
 				  XCB_IMAGE_ORDER_LSB_FIRST,
 				  NULL, 0, NULL);
 
+    /* Spread the pixel values over all four bytes so that
+     * byte order mistakes in wide formats show up. */
     pixel = 0;
     for (y = 0; y < test_height; y++)
 	for (x = 0; x < test_width; x++) {
-	    xcb_image_put_pixel (test_image, x, y, pixel);
+	    xcb_image_put_pixel (test_image, x, y, pixel * 0x9e3779b1);
 	    pixel++;
 	}
     return test_image;
@@ -128,28 +161,1038 @@ convert_test (xcb_image_t *test, xcb_image_t *a)
 	    xcb_image_put_pixel (a, x, y, xcb_image_get_pixel (test, x, y));
 }
 
-static char *
-order_name (xcb_image_order_t order) {
-  if (order == XCB_IMAGE_ORDER_MSB_FIRST)
-    return "MSB";
-  else
-    return "LSB";
+static int
+compare_subimage (xcb_image_t *image, int x0, int y0, int width, int height)
+{
+    xcb_image_t	*sub;
+    int		x, y;
+    int		ok = 1;
+
+    sub = xcb_image_subimage (image, x0, y0, width, height, NULL, 0, NULL);
+    if (!sub)
+	return 0;
+    for (y = 0; ok && y < height; y++)
+	for (x = 0; x < width; x++)
+	    if (xcb_image_get_pixel (sub, x, y) !=
+		xcb_image_get_pixel (image, x0 + x, y0 + y)) {
+		fprintf (stderr, "subimage fail at %d,%d\n", x, y);
+		ok = 0;
+		break;
+	    }
+    xcb_image_destroy (sub);
+    return ok;
+}
+
+static int
+compare_view (xcb_image_t *image, int x0, int width)
+{
+    xcb_image_t	view;
+    xcb_image_t	*copy;
+    int		x, y;
+    int		ok = 1;
+
+    if (!xcb_image_view (image, x0, 0, width, image->height, &view))
+	return 0;
+    /* rectangles whose far edge wraps around are outside */
+    if (x0 && (xcb_image_view (image, x0, 0, -x0, image->height, &view) ||
+	       xcb_image_subimage (image, x0, 0, -x0, 1, NULL, 0, NULL))) {
+	fprintf (stderr, "view accepts wrapped width\n");
+	return 0;
+    }
+    xcb_image_view (image, x0, 0, width, image->height, &view);
+    /* re-annotating a view keeps the parent's stride */
+    xcb_image_annotate (&view);
+    if (view.stride != image->stride || view.x_offset != x0) {
+	fprintf (stderr, "re-annotated view has stride %u for %u\n",
+		 view.stride, image->stride);
+	return 0;
+    }
+    copy = xcb_image_subimage (&view, 0, 0, width, view.height, NULL, 0, NULL);
+    if (!copy)
+	return 0;
+    for (y = 0; ok && y < view.height; y++)
+	for (x = 0; x < width; x++)
+	    if (xcb_image_get_pixel (&view, x, y) !=
+		xcb_image_get_pixel (image, x0 + x, y) ||
+		xcb_image_get_pixel (copy, x, y) !=
+		xcb_image_get_pixel (image, x0 + x, y)) {
+		fprintf (stderr, "view fail at %d,%d\n", x, y);
+		ok = 0;
+		break;
+	    }
+    xcb_image_destroy (copy);
+    return ok;
+}
+
+static int
+compare_rows (xcb_image_t *image, int x0, int width)
+{
+    uint32_t	pixels[test_width * test_height];
+    uint32_t	left[test_height], right[test_height];
+    uint32_t	mask = pixel_mask (image->depth);
+    int		x, y;
+
+    xcb_image_get_rows (image, x0, 0, width, image->height, pixels, width);
+    for (y = 0; y < image->height; y++) {
+	for (x = 0; x < width; x++) {
+	    if (pixels[y * width + x] != xcb_image_get_pixel (image, x0 + x, y)) {
+		fprintf (stderr, "get rows fail at %d,%d\n", x, y);
+		return 0;
+	    }
+	    pixels[y * width + x] = ~pixels[y * width + x] & mask;
+	}
+	left[y] = xcb_image_get_pixel (image, x0 - 1, y);
+	right[y] = xcb_image_get_pixel (image, x0 + width, y);
+    }
+    xcb_image_put_rows (image, x0, 0, width, image->height, pixels, width);
+    for (y = 0; y < image->height; y++) {
+	for (x = 0; x < width; x++)
+	    if (pixels[y * width + x] != xcb_image_get_pixel (image, x0 + x, y)) {
+		fprintf (stderr, "put rows fail at %d,%d\n", x, y);
+		return 0;
+	    }
+	if (left[y] != xcb_image_get_pixel (image, x0 - 1, y) ||
+	    right[y] != xcb_image_get_pixel (image, x0 + width, y)) {
+	    fprintf (stderr, "put rows overrun on row %d\n", y);
+	    return 0;
+	}
+    }
+    return 1;
+}
+
+static int
+compare_fast (xcb_image_t *image)
+{
+    uint32_t	mask = pixel_mask (image->depth);
+    uint32_t	pixel, row[test_width];
+    int		x, y;
+
+    for (y = 0; y < image->height; y++)
+	for (x = 0; x < image->width; x++) {
+	    pixel = xcb_image_get_pixel_fast (image, x, y);
+	    if (pixel != xcb_image_get_pixel (image, x, y)) {
+		fprintf (stderr, "fast get fail at %d,%d\n", x, y);
+		return 0;
+	    }
+	    xcb_image_put_pixel_fast (image, x, y, ~pixel);
+	    if (xcb_image_get_pixel (image, x, y) != (~pixel & mask)) {
+		fprintf (stderr, "fast put fail at %d,%d\n", x, y);
+		return 0;
+	    }
+	}
+    /* a fill of all but the ends of the first row */
+    xcb_image_get_row (image, 0, 0, image->width, row);
+    xcb_image_fill_row_fast (image, 1, 0, image->width - 2, 0x5a5a5a5a);
+    for (x = 0; x < image->width; x++) {
+	pixel = x == 0 || x == image->width - 1 ? row[x] : 0x5a5a5a5a & mask;
+	if (xcb_image_get_pixel (image, x, 0) != pixel) {
+	    fprintf (stderr, "fast fill fail at %d\n", x);
+	    return 0;
+	}
+    }
+    return 1;
+}
+
+/* A plan made for src and dst must convert fresh images of
+   the same layouts just as xcb_image_convert() does, and
+   refuse images laid out otherwise. */
+static int
+compare_plan (xcb_image_t *src, xcb_image_t *dst)
+{
+    xcb_image_convert_plan_t	*plan;
+    xcb_image_t			*out;
+    xcb_image_t			other;
+    int				ok;
+
+    plan = xcb_image_convert_plan_create (src, dst);
+    if (!plan)
+	return 0;
+    out = xcb_image_create (dst->width, dst->height, dst->format,
+			    dst->scanline_pad, dst->depth, dst->bpp,
+			    dst->unit, dst->byte_order, dst->bit_order,
+			    NULL, 0, NULL);
+    ok = xcb_image_convert_plan_run (plan, src, out) == out &&
+	compare_image (dst, out);
+    other = *src;
+    other.plane_mask ^= 1;
+    ok = ok && !xcb_image_convert_plan_run (plan, &other, out);
+    other = *out;
+    other.plane_mask ^= 1;
+    ok = ok && !xcb_image_convert_plan_run (plan, src, &other);
+    other = *out;
+    other.width--;
+    ok = ok && !xcb_image_convert_plan_run (plan, src, &other);
+    xcb_image_destroy (out);
+    xcb_image_convert_plan_destroy (plan);
+    return ok;
+}
+
+/* Uniform wrappers, so that each fast accessor can be checked
+   against xcb_image_get_pixel() and xcb_image_put_pixel(). */
+#define ACCESSORS(F)							\
+static uint32_t								\
+get_##F (xcb_image_t *image, uint32_t x, uint32_t y)			\
+{									\
+    return xcb_image_get_pixel_##F (image, x, y);			\
+}									\
+static void								\
+put_##F (xcb_image_t *image, uint32_t x, uint32_t y, uint32_t pixel)	\
+{									\
+    xcb_image_put_pixel_##F (image, x, y, pixel);			\
+}
+
+ACCESSORS(XY8M) ACCESSORS(XY8L) ACCESSORS(XY16M) ACCESSORS(XY16L)
+ACCESSORS(XY32M) ACCESSORS(XY32L)
+ACCESSORS(Z4M) ACCESSORS(Z4L) ACCESSORS(Z8)
+ACCESSORS(Z16M) ACCESSORS(Z16L) ACCESSORS(Z16H)
+ACCESSORS(Z24M) ACCESSORS(Z24L)
+ACCESSORS(Z32M) ACCESSORS(Z32L) ACCESSORS(Z32H)
+
+#define HOST_ORDER  2
+
+static const struct {
+    const char *	name;
+    uint32_t		(*get) (xcb_image_t *, uint32_t, uint32_t);
+    void		(*put) (xcb_image_t *, uint32_t, uint32_t, uint32_t);
+    xcb_image_format_t	format;
+    int			bpp, unit;
+    int			byte_order, bit_order;
+} accessors[] = {
+#define LSB XCB_IMAGE_ORDER_LSB_FIRST
+#define MSB XCB_IMAGE_ORDER_MSB_FIRST
+#define XY XCB_IMAGE_FORMAT_XY_BITMAP
+#define Z XCB_IMAGE_FORMAT_Z_PIXMAP
+    { "XY8M", get_XY8M, put_XY8M, XY, 1, 8, LSB, MSB },
+    { "XY8M", get_XY8M, put_XY8M, XY, 1, 32, MSB, MSB },
+    { "XY8L", get_XY8L, put_XY8L, XY, 1, 8, MSB, LSB },
+    { "XY16M", get_XY16M, put_XY16M, XY, 1, 16, LSB, MSB },
+    { "XY16L", get_XY16L, put_XY16L, XY, 1, 16, LSB, LSB },
+    { "XY32M", get_XY32M, put_XY32M, XY, 1, 32, LSB, MSB },
+    { "XY32L", get_XY32L, put_XY32L, XY, 1, 32, LSB, LSB },
+    { "Z4M", get_Z4M, put_Z4M, Z, 4, 8, MSB, MSB },
+    { "Z4L", get_Z4L, put_Z4L, Z, 4, 8, LSB, LSB },
+    { "Z8", get_Z8, put_Z8, Z, 8, 8, LSB, LSB },
+    { "Z16M", get_Z16M, put_Z16M, Z, 16, 16, MSB, MSB },
+    { "Z16L", get_Z16L, put_Z16L, Z, 16, 16, LSB, LSB },
+    { "Z16H", get_Z16H, put_Z16H, Z, 16, 16, HOST_ORDER, HOST_ORDER },
+    { "Z24M", get_Z24M, put_Z24M, Z, 24, 24, MSB, MSB },
+    { "Z24L", get_Z24L, put_Z24L, Z, 24, 24, LSB, LSB },
+    { "Z32M", get_Z32M, put_Z32M, Z, 32, 32, MSB, MSB },
+    { "Z32L", get_Z32L, put_Z32L, Z, 32, 32, LSB, LSB },
+    { "Z32H", get_Z32H, put_Z32H, Z, 32, 32, HOST_ORDER, HOST_ORDER },
+#undef LSB
+#undef MSB
+#undef XY
+#undef Z
+};
+
+static int
+check_accessor (int a, xcb_image_t *image)
+{
+    uint32_t	mask = pixel_mask (accessors[a].bpp);
+    uint32_t	pixel;
+    int		x, y;
+
+    for (y = 0; y < image->height; y++)
+	for (x = 0; x < image->width; x++) {
+	    pixel = accessors[a].get (image, x, y);
+	    if (pixel != xcb_image_get_pixel (image, x, y)) {
+		fprintf (stderr, "%s get fail at %d,%d: 0x%x != 0x%x\n",
+			 accessors[a].name, x, y, pixel,
+			 xcb_image_get_pixel (image, x, y));
+		return 0;
+	    }
+	    pixel = ~pixel & mask;
+	    accessors[a].put (image, x, y, pixel);
+	    if (xcb_image_get_pixel (image, x, y) != pixel) {
+		fprintf (stderr, "%s put fail at %d,%d\n",
+			 accessors[a].name, x, y);
+		return 0;
+	    }
+	}
+    return 1;
 }
 
 static void
-print_format (xcb_image_t *image)
+check_accessors (xcb_image_t *test)
 {
-  switch (image->format) {
-  case XCB_IMAGE_FORMAT_Z_PIXMAP: fprintf (stderr, "Z pixmap"); break;
-  case XCB_IMAGE_FORMAT_XY_PIXMAP: fprintf (stderr, "XY pixmap"); break;
-  case XCB_IMAGE_FORMAT_XY_BITMAP: fprintf (stderr, "XY bitmap"); break;
-  }
-  fprintf (stderr, " pad: %d bpp: %d depth: %d unit: %d planemask: 0x%08x",
-	   image->scanline_pad, image->bpp, image->depth, image->unit,
-	   image->plane_mask);
-  fprintf (stderr, " byte order: %s bit order: %s stride: %d\n",
-	   order_name (image->byte_order), order_name (image->bit_order),
-	   image->stride);
+    xcb_image_t	*image;
+    xcb_image_t	view;
+    int		a;
+    int		byte_order, bit_order;
+
+    for (a = 0; a < SIZE(accessors); a++) {
+	byte_order = accessors[a].byte_order;
+	bit_order = accessors[a].bit_order;
+	if (byte_order == HOST_ORDER)
+	    byte_order = bit_order = xcb_host_byte_order ();
+	image = xcb_image_create (test_width, test_height,
+				  accessors[a].format, 32,
+				  accessors[a].bpp, accessors[a].bpp,
+				  accessors[a].unit, byte_order, bit_order,
+				  NULL, 0, NULL);
+	convert_test (test, image);
+	/* and again through a view, for the x offset */
+	if (!check_accessor (a, image) ||
+	    !xcb_image_view (image, 3, 0, test_width - 5, test_height, &view) ||
+	    !check_accessor (a, &view))
+	    exit (1);
+	xcb_image_destroy (image);
+    }
+}
+
+/*
+ * A connection setup, for the functions that look at the
+ * server's pixmap formats and visuals.  xcb_get_setup() is
+ * replaced below, so no server is needed.
+ */
+#define CONN ((xcb_connection_t *) 1)
+
+static union {
+    xcb_setup_t	setup;
+    uint8_t	bytes[512];
+} setup;
+
+static xcb_visualtype_t	*setup_visual;
+
+/* One screen whose root visual is TrueColor with the given
+   depth and masks.  Of the other depths, the server only
+   has pixmap formats for 1, 4 and 8. */
+static void
+setup_init (xcb_image_order_t byte_order, xcb_image_order_t bit_order,
+	    uint8_t depth, uint32_t red, uint32_t green, uint32_t blue)
+{
+    static const uint8_t	low_depths[] = { 1, 4, 8 };
+    xcb_format_t		*format;
+    xcb_screen_t		*screen;
+    xcb_depth_t			*allowed;
+    int				i;
+
+    memset (&setup, 0, sizeof (setup));
+    setup.setup.status = 1;
+    setup.setup.protocol_major_version = 11;
+    setup.setup.image_byte_order = byte_order;
+    setup.setup.bitmap_format_bit_order = bit_order;
+    setup.setup.bitmap_format_scanline_unit = 32;
+    setup.setup.bitmap_format_scanline_pad = 32;
+    setup.setup.roots_len = 1;
+    format = (xcb_format_t *) (&setup.setup + 1);
+    for (i = 0; i < SIZE(low_depths); i++, format++) {
+	format->depth = low_depths[i];
+	format->bits_per_pixel = low_depths[i] == 1 ? 1 : 8;
+	format->scanline_pad = 32;
+    }
+    if (depth > 8) {
+	format->depth = depth;
+	format->bits_per_pixel = depth > 16 ? 32 : 16;
+	format->scanline_pad = 32;
+	format++;
+    }
+    setup.setup.pixmap_formats_len =
+	format - (xcb_format_t *) (&setup.setup + 1);
+    screen = (xcb_screen_t *) format;
+    screen->root_visual = 0x21;
+    screen->root_depth = depth;
+    screen->allowed_depths_len = 1;
+    allowed = (xcb_depth_t *) (screen + 1);
+    allowed->depth = depth;
+    allowed->visuals_len = 1;
+    setup_visual = (xcb_visualtype_t *) (allowed + 1);
+    setup_visual->visual_id = 0x21;
+    setup_visual->_class = XCB_VISUAL_CLASS_TRUE_COLOR;
+    setup_visual->red_mask = red;
+    setup_visual->green_mask = green;
+    setup_visual->blue_mask = blue;
+    setup.setup.length =
+	((uint8_t *) (setup_visual + 1) - setup.bytes - 8) / 4;
+}
+
+const xcb_setup_t *
+xcb_get_setup (xcb_connection_t *c)
+{
+    return &setup.setup;
+}
+
+/* Channel masks, red, green, blue and alpha, of the
+   truecolor depths the library knows. */
+static void
+depth_masks (uint8_t depth, uint32_t *masks)
+{
+    switch (depth) {
+    case 30:
+	masks[0] = 0x3ff00000; masks[1] = 0x000ffc00; masks[2] = 0x3ff;
+	masks[3] = 0;
+	break;
+    case 32:
+    case 24:
+	masks[0] = 0xff0000; masks[1] = 0xff00; masks[2] = 0xff;
+	masks[3] = depth == 32 ? 0xff000000 : 0;
+	break;
+    case 16:
+	masks[0] = 0xf800; masks[1] = 0x07e0; masks[2] = 0x001f;
+	masks[3] = 0;
+	break;
+    case 15:
+	masks[0] = 0x7c00; masks[1] = 0x03e0; masks[2] = 0x001f;
+	masks[3] = 0;
+	break;
+    }
+}
+
+/* The masks of the setup's visual, with the rest of the
+   depth as alpha. */
+static void
+visual_masks (uint8_t depth, uint32_t *masks)
+{
+    masks[0] = setup_visual->red_mask;
+    masks[1] = setup_visual->green_mask;
+    masks[2] = setup_visual->blue_mask;
+    masks[3] = pixel_mask (depth) & ~(masks[0] | masks[1] | masks[2]);
+}
+
+/* A channel value v of src_width bits at dst_width bits:
+   truncated, or widened by repeating its bits. */
+static uint32_t
+scale_channel (uint32_t v, int src_width, int dst_width)
+{
+    uint32_t	wide = 0;
+    int		bits = 0;
+
+    if (dst_width <= src_width)
+	return v >> (src_width - dst_width);
+    for (bits = 0; bits < dst_width; bits += src_width)
+	wide = wide << src_width | v;
+    return wide >> (bits - dst_width);
+}
+
+static uint32_t
+remap_reference (uint32_t pixel, const uint32_t *src_masks,
+		 const uint32_t *dst_masks)
+{
+    uint32_t	out = 0, v;
+    int		c, src_shift, dst_shift;
+
+    for (c = 0; c < 4; c++) {
+	if (!dst_masks[c])
+	    continue;
+	if (!src_masks[c]) {
+	    if (c == 3)
+		out |= dst_masks[c];
+	    continue;
+	}
+	for (src_shift = 0; !(src_masks[c] >> src_shift & 1); src_shift++)
+	    ;
+	for (dst_shift = 0; !(dst_masks[c] >> dst_shift & 1); dst_shift++)
+	    ;
+	v = (pixel & src_masks[c]) >> src_shift;
+	out |= scale_channel (v, xcb_popcount (src_masks[c]),
+			      xcb_popcount (dst_masks[c])) << dst_shift;
+    }
+    return out;
+}
+
+/* A truecolor image of the given depth, filled with a
+   spread of pixel values. */
+static xcb_image_t *
+create_truecolor (uint8_t depth, xcb_image_order_t byte_order)
+{
+    xcb_image_t	*image;
+    uint8_t	bpp = depth > 16 ? 32 : 16;
+    int		x, y;
+
+    image = xcb_image_create (37, 3, XCB_IMAGE_FORMAT_Z_PIXMAP, 32, depth,
+			      bpp, bpp, byte_order, byte_order, NULL, 0, NULL);
+    for (y = 0; y < image->height; y++)
+	for (x = 0; x < image->width; x++)
+	    xcb_image_put_pixel (image, x, y, ((y * image->width + x) *
+					       0x9e3779b1) &
+				 pixel_mask (depth));
+    return image;
+}
+
+/* Each truecolor depth the server lacks goes to its visual. */
+static void
+check_native_depths (void)
+{
+    static const struct {
+	uint8_t		depth;
+	uint32_t	red, green, blue;
+    } visuals[] = {
+	{ 24, 0xff0000, 0x00ff00, 0x0000ff },
+	{ 32, 0xff0000, 0x00ff00, 0x0000ff },
+	{ 16, 0xf800, 0x07e0, 0x001f },
+	{ 24, 0x0000ff, 0x00ff00, 0xff0000 },
+	{ 30, 0x3ff00000, 0x000ffc00, 0x000003ff },
+    };
+    static const uint8_t	depths[] = { 32, 30, 24, 16, 15 };
+    xcb_image_t	*src, *native;
+    uint32_t	src_masks[4], dst_masks[4], want;
+    int		v, d, server, order, x, y;
+
+    for (v = 0; v < SIZE(visuals); v++)
+	for (server = 0; server < NBYTE_ORDER; server++)
+	    for (d = 0; d < SIZE(depths); d++)
+		for (order = 0; order < NBYTE_ORDER; order++) {
+		    if (depths[d] == visuals[v].depth)
+			continue;
+		    setup_init (byte_orders[server], byte_orders[server],
+				visuals[v].depth, visuals[v].red,
+				visuals[v].green, visuals[v].blue);
+		    depth_masks (depths[d], src_masks);
+		    visual_masks (visuals[v].depth, dst_masks);
+		    src = create_truecolor (depths[d], byte_orders[order]);
+		    native = xcb_image_native (CONN, src, 1);
+		    if (xcb_image_native (CONN, src, 0) || !native ||
+			native->depth != visuals[v].depth ||
+			native->byte_order != byte_orders[server]) {
+			fprintf (stderr, "native depth %d to %d failed\n",
+				 depths[d], visuals[v].depth);
+			exit (1);
+		    }
+		    for (y = 0; y < src->height; y++)
+			for (x = 0; x < src->width; x++) {
+			    want = remap_reference (xcb_image_get_pixel (src,
+									 x, y),
+						    src_masks, dst_masks);
+			    if (xcb_image_get_pixel (native, x, y) != want) {
+				fprintf (stderr, "native depth %d to %d fail "
+					 "at %d,%d: 0x%x != 0x%x\n",
+					 depths[d], visuals[v].depth, x, y,
+					 xcb_image_get_pixel (native, x, y),
+					 want);
+				exit (1);
+			    }
+			}
+		    xcb_image_destroy (native);
+		    xcb_image_destroy (src);
+		}
+}
+
+/* Native conversion in place, where the scanlines stay put,
+   and into a new image where they would move. */
+static void
+check_native_inplace (xcb_image_t *test)
+{
+    static const struct {
+	xcb_image_format_t	format;
+	uint8_t			pad, depth, bpp, unit;
+	xcb_image_order_t	byte_order, bit_order;
+	int			inplace;
+    } images[] = {
+#define LSB XCB_IMAGE_ORDER_LSB_FIRST
+#define MSB XCB_IMAGE_ORDER_MSB_FIRST
+	{ XCB_IMAGE_FORMAT_Z_PIXMAP, 32, 24, 32, 32, LSB, LSB, 1 },
+	{ XCB_IMAGE_FORMAT_Z_PIXMAP, 32, 24, 32, 32, MSB, MSB, 1 },
+	{ XCB_IMAGE_FORMAT_Z_PIXMAP, 32, 8, 8, 8, LSB, LSB, 1 },
+	{ XCB_IMAGE_FORMAT_Z_PIXMAP, 32, 4, 8, 8, MSB, MSB, 1 },
+	{ XCB_IMAGE_FORMAT_XY_PIXMAP, 32, 8, 8, 8, LSB, MSB, 1 },
+	{ XCB_IMAGE_FORMAT_XY_PIXMAP, 32, 8, 8, 16, MSB, LSB, 1 },
+	{ XCB_IMAGE_FORMAT_XY_PIXMAP, 32, 4, 4, 32, LSB, LSB, 1 },
+	{ XCB_IMAGE_FORMAT_XY_BITMAP, 32, 1, 1, 8, LSB, LSB, 1 },
+	{ XCB_IMAGE_FORMAT_XY_BITMAP, 32, 1, 1, 32, MSB, MSB, 1 },
+	{ XCB_IMAGE_FORMAT_Z_PIXMAP, 32, 24, 24, 24, LSB, LSB, 0 },
+	{ XCB_IMAGE_FORMAT_Z_PIXMAP, 32, 4, 4, 8, LSB, LSB, 0 },
+	{ XCB_IMAGE_FORMAT_Z_PIXMAP, 8, 8, 8, 8, LSB, LSB, 0 },
+#undef LSB
+#undef MSB
+    };
+    xcb_image_t	*image, *copy, *native;
+    uint8_t	*data;
+    int		i, server;
+
+    for (server = 0; server < NBYTE_ORDER; server++)
+	for (i = 0; i < SIZE(images); i++) {
+	    setup_init (byte_orders[server], byte_orders[server], 24,
+			0xff0000, 0x00ff00, 0x0000ff);
+	    image = xcb_image_create (test_width, test_height,
+				      images[i].format, images[i].pad,
+				      images[i].depth, images[i].bpp,
+				      images[i].unit, images[i].byte_order,
+				      images[i].bit_order, NULL, 0, NULL);
+	    copy = xcb_image_create (test_width, test_height,
+				     XCB_IMAGE_FORMAT_Z_PIXMAP, 32, 32, 32, 32,
+				     XCB_IMAGE_ORDER_LSB_FIRST,
+				     XCB_IMAGE_ORDER_LSB_FIRST, NULL, 0, NULL);
+	    convert_test (test, image);
+	    convert_test (image, copy);
+	    data = image->data;
+	    native = xcb_image_native_inplace (CONN, image);
+	    if (!native || (native == image) != images[i].inplace ||
+		(native->data == data) != images[i].inplace ||
+		!xcb_image_native (CONN, native, 0) ||
+		!compare_image (copy, native) ||
+		(native != image && !compare_image (copy, image))) {
+		fprintf (stderr, "native in place failure:\n");
+		print_format (image);
+		exit (1);
+	    }
+	    if (native != image)
+		xcb_image_destroy (native);
+	    xcb_image_destroy (image);
+	    xcb_image_destroy (copy);
+	}
+}
+
+/* RGBA buffers, in both channel orders and with a stride
+   past the pixels, into visuals of each truecolor depth. */
+static void
+check_create_from_rgba (void)
+{
+    static const struct {
+	uint8_t		depth;
+	uint32_t	red, green, blue;
+    } visuals[] = {
+	{ 24, 0xff0000, 0x00ff00, 0x0000ff },
+	{ 24, 0x0000ff, 0x00ff00, 0xff0000 },
+	{ 32, 0xff0000, 0x00ff00, 0x0000ff },
+	{ 32, 0x3ff00000, 0x000ffc00, 0x000003ff },
+	{ 30, 0x3ff00000, 0x000ffc00, 0x000003ff },
+	{ 16, 0xf800, 0x07e0, 0x001f },
+	{ 15, 0x7c00, 0x03e0, 0x001f },
+    };
+    enum { width = 37, height = 3, stride = width * 4 + 12 };
+    uint8_t	pixels[height * stride];
+    const uint8_t	*p;
+    xcb_image_t	*image;
+    uint32_t	src_masks[4], dst_masks[4], want;
+    int		v, server, order, i, x, y;
+
+    for (i = 0; i < sizeof (pixels); i++)
+	pixels[i] = i * 0x9e3779b1 >> 24;
+    for (v = 0; v < SIZE(visuals); v++)
+	for (server = 0; server < NBYTE_ORDER; server++)
+	    for (order = XCB_IMAGE_RGBA_ORDER_RGBA;
+		 order <= XCB_IMAGE_RGBA_ORDER_BGRA; order++) {
+		setup_init (byte_orders[server], byte_orders[server],
+			    visuals[v].depth, visuals[v].red,
+			    visuals[v].green, visuals[v].blue);
+		src_masks[0] = order == XCB_IMAGE_RGBA_ORDER_RGBA ?
+		    0x000000ff : 0x00ff0000;
+		src_masks[1] = 0x0000ff00;
+		src_masks[2] = order == XCB_IMAGE_RGBA_ORDER_RGBA ?
+		    0x00ff0000 : 0x000000ff;
+		src_masks[3] = 0xff000000;
+		visual_masks (visuals[v].depth, dst_masks);
+		image = xcb_image_create_from_rgba (CONN, setup_visual,
+						    width, height, order,
+						    pixels, stride);
+		if (!image || image->depth != visuals[v].depth ||
+		    !xcb_image_native (CONN, image, 0) ||
+		    xcb_image_create_from_rgba (CONN, setup_visual, width,
+						height, order, pixels,
+						width * 4 - 1)) {
+		    fprintf (stderr, "create from rgba failed for depth %d\n",
+			     visuals[v].depth);
+		    exit (1);
+		}
+		for (y = 0; y < height; y++)
+		    for (x = 0; x < width; x++) {
+			p = pixels + y * stride + x * 4;
+			want = remap_reference (p[0] | p[1] << 8 | p[2] << 16 |
+						(uint32_t) p[3] << 24,
+						src_masks, dst_masks);
+			if (xcb_image_get_pixel (image, x, y) != want) {
+			    fprintf (stderr, "create from rgba fail at %d,%d: "
+				     "0x%x != 0x%x\n", x, y,
+				     xcb_image_get_pixel (image, x, y), want);
+			    print_format (image);
+			    exit (1);
+			}
+		    }
+		xcb_image_destroy (image);
+	    }
+    setup_visual->_class = XCB_VISUAL_CLASS_PSEUDO_COLOR;
+    if (xcb_image_create_from_rgba (CONN, setup_visual, width, height,
+				    XCB_IMAGE_RGBA_ORDER_RGBA, pixels, 0)) {
+	fprintf (stderr, "create from rgba accepted a PseudoColor visual\n");
+	exit (1);
+    }
+}
+
+/* Ordered dithering against the 8x8 Bayer matrix, to gray
+   ramps and to small truecolor visuals, in each low-depth
+   layout. */
+static const uint8_t bayer8[8][8] = {
+    {  0, 32,  8, 40,  2, 34, 10, 42 },
+    { 48, 16, 56, 24, 50, 18, 58, 26 },
+    { 12, 44,  4, 36, 14, 46,  6, 38 },
+    { 60, 28, 52, 20, 62, 30, 54, 22 },
+    {  3, 35, 11, 43,  1, 33,  9, 41 },
+    { 51, 19, 59, 27, 49, 17, 57, 25 },
+    { 15, 47,  7, 39, 13, 45,  5, 37 },
+    { 63, 31, 55, 23, 61, 29, 53, 21 }
+};
+
+static uint32_t
+dither_reference (uint32_t pixel, int x, int y, uint8_t depth,
+		  const xcb_visualtype_t *visual)
+{
+    uint32_t	t = bayer8[y & 7][x & 7] * 4 + 2;
+    uint32_t	rgb[3], masks[3], out = 0;
+    int		c, shift;
+
+    rgb[0] = pixel >> 16 & 0xff;
+    rgb[1] = pixel >> 8 & 0xff;
+    rgb[2] = pixel & 0xff;
+    if (!visual || visual->_class != XCB_VISUAL_CLASS_TRUE_COLOR)
+	return (((77 * rgb[0] + 150 * rgb[1] + 29 * rgb[2]) >> 8) *
+		pixel_mask (depth) + t) >> 8;
+    masks[0] = visual->red_mask;
+    masks[1] = visual->green_mask;
+    masks[2] = visual->blue_mask;
+    for (c = 0; c < 3; c++) {
+	for (shift = 0; !(masks[c] >> shift & 1); shift++)
+	    ;
+	out |= ((rgb[c] * pixel_mask (xcb_popcount (masks[c])) + t) >> 8) <<
+	    shift;
+    }
+    return out;
+}
+
+static void
+check_dither (void)
+{
+    static const struct {
+	xcb_image_format_t	format;
+	uint8_t			depth, bpp, unit;
+	xcb_image_order_t	order;
+	uint32_t		red, green, blue;
+    } dsts[] = {
+#define LSB XCB_IMAGE_ORDER_LSB_FIRST
+#define MSB XCB_IMAGE_ORDER_MSB_FIRST
+	{ XCB_IMAGE_FORMAT_Z_PIXMAP, 8, 8, 8, LSB, 0, 0, 0 },
+	{ XCB_IMAGE_FORMAT_Z_PIXMAP, 8, 8, 8, MSB, 0xe0, 0x1c, 0x03 },
+	{ XCB_IMAGE_FORMAT_Z_PIXMAP, 4, 4, 8, MSB, 0, 0, 0 },
+	{ XCB_IMAGE_FORMAT_Z_PIXMAP, 4, 4, 8, LSB, 0x8, 0x6, 0x1 },
+	{ XCB_IMAGE_FORMAT_XY_BITMAP, 1, 1, 32, LSB, 0, 0, 0 },
+	{ XCB_IMAGE_FORMAT_XY_BITMAP, 1, 1, 8, MSB, 0, 0, 0 },
+	{ XCB_IMAGE_FORMAT_XY_PIXMAP, 8, 8, 16, MSB, 0xe0, 0x1c, 0x03 },
+	{ XCB_IMAGE_FORMAT_XY_PIXMAP, 3, 3, 32, LSB, 0, 0, 0 },
+	{ XCB_IMAGE_FORMAT_XY_PIXMAP, 3, 3, 8, LSB, 0x4, 0x2, 0x1 },
+#undef LSB
+#undef MSB
+    };
+    xcb_visualtype_t	visual;
+    xcb_image_t		*src, *dst;
+    uint32_t		want;
+    int			d, x, y;
+
+    src = xcb_image_create (37, 11, XCB_IMAGE_FORMAT_Z_PIXMAP, 32, 24, 32, 32,
+			    XCB_IMAGE_ORDER_LSB_FIRST,
+			    XCB_IMAGE_ORDER_LSB_FIRST, NULL, 0, NULL);
+    for (y = 0; y < src->height; y++)
+	for (x = 0; x < src->width; x++)
+	    xcb_image_put_pixel (src, x, y, ((y * src->width + x) *
+					     0x9e3779b1) & 0xffffff);
+    for (d = 0; d < SIZE(dsts); d++) {
+	memset (&visual, 0, sizeof (visual));
+	visual._class = dsts[d].red ? XCB_VISUAL_CLASS_TRUE_COLOR :
+	    XCB_VISUAL_CLASS_STATIC_GRAY;
+	visual.red_mask = dsts[d].red;
+	visual.green_mask = dsts[d].green;
+	visual.blue_mask = dsts[d].blue;
+	dst = xcb_image_create (src->width, src->height, dsts[d].format, 32,
+				dsts[d].depth, dsts[d].bpp, dsts[d].unit,
+				dsts[d].order, dsts[d].order, NULL, 0, NULL);
+	if (xcb_image_dither (src, dst, &visual) != dst) {
+	    fprintf (stderr, "dither failed:\n");
+	    print_format (dst);
+	    exit (1);
+	}
+	for (y = 0; y < src->height; y++)
+	    for (x = 0; x < src->width; x++) {
+		want = dither_reference (xcb_image_get_pixel (src, x, y),
+					 x, y, dst->depth, &visual);
+		if (xcb_image_get_pixel (dst, x, y) != want) {
+		    fprintf (stderr, "dither fail at %d,%d: 0x%x != 0x%x\n",
+			     x, y, xcb_image_get_pixel (dst, x, y), want);
+		    print_format (dst);
+		    exit (1);
+		}
+	    }
+	xcb_image_destroy (dst);
+    }
+    xcb_image_destroy (src);
+}
+
+/* Between depth 30 and the 8-bit and 16-bit truecolor
+   depths, xcb_image_convert() rescales channels; through
+   each layout, and both ways. */
+static void
+check_deep_color (void)
+{
+    static const struct {
+	uint8_t			depth, bpp, unit;
+	xcb_image_format_t	format;
+    } layouts[] = {
+	{ 30, 32, 32, XCB_IMAGE_FORMAT_Z_PIXMAP },
+	{ 30, 32, 8, XCB_IMAGE_FORMAT_XY_PIXMAP },
+	{ 32, 32, 32, XCB_IMAGE_FORMAT_Z_PIXMAP },
+	{ 32, 32, 16, XCB_IMAGE_FORMAT_XY_PIXMAP },
+	{ 24, 32, 32, XCB_IMAGE_FORMAT_Z_PIXMAP },
+	{ 24, 24, 24, XCB_IMAGE_FORMAT_Z_PIXMAP },
+	{ 16, 16, 16, XCB_IMAGE_FORMAT_Z_PIXMAP },
+	{ 15, 16, 16, XCB_IMAGE_FORMAT_Z_PIXMAP },
+    };
+    xcb_image_t	*src, *dst;
+    uint32_t	src_masks[4], dst_masks[4], want;
+    int		s, d, s_order, d_order, x, y;
+
+    for (s = 0; s < SIZE(layouts); s++)
+	for (d = 0; d < SIZE(layouts); d++)
+	    for (s_order = 0; s_order < NBYTE_ORDER; s_order++)
+		for (d_order = 0; d_order < NBYTE_ORDER; d_order++) {
+		    if ((layouts[s].depth == 30) == (layouts[d].depth == 30))
+			continue;
+		    src = xcb_image_create (37, 3, layouts[s].format, 32,
+					    layouts[s].depth, layouts[s].bpp,
+					    layouts[s].unit, byte_orders[s_order],
+					    byte_orders[s_order], NULL, 0,
+					    NULL);
+		    dst = xcb_image_create (37, 3, layouts[d].format, 32,
+					    layouts[d].depth, layouts[d].bpp,
+					    layouts[d].unit, byte_orders[d_order],
+					    byte_orders[d_order], NULL, 0,
+					    NULL);
+		    for (y = 0; y < src->height; y++)
+			for (x = 0; x < src->width; x++)
+			    xcb_image_put_pixel (src, x, y,
+						 ((y * src->width + x) *
+						  0x9e3779b1) &
+						 pixel_mask (src->depth));
+		    depth_masks (src->depth, src_masks);
+		    depth_masks (dst->depth, dst_masks);
+		    if (xcb_image_convert (src, dst) != dst) {
+			fprintf (stderr, "deep color conversion failed:\n");
+			print_format (src);
+			print_format (dst);
+			exit (1);
+		    }
+		    for (y = 0; y < src->height; y++)
+			for (x = 0; x < src->width; x++) {
+			    want = remap_reference (xcb_image_get_pixel (src,
+									 x, y),
+						    src_masks, dst_masks);
+			    if (xcb_image_get_pixel (dst, x, y) != want) {
+				fprintf (stderr, "deep color fail at %d,%d: "
+					 "0x%x != 0x%x\n", x, y,
+					 xcb_image_get_pixel (dst, x, y),
+					 want);
+				print_format (src);
+				print_format (dst);
+				exit (1);
+			    }
+			}
+		    xcb_image_destroy (dst);
+		    xcb_image_destroy (src);
+		}
+}
+
+static void
+check_bit_reverse (void)
+{
+    uint8_t	src[300], dst[300];
+    uint32_t	i, len;
+
+    for (i = 0; i < sizeof (src); i++)
+	src[i] = i * 7;
+    /* every length exercises a different vector/tail split */
+    for (len = 0; len <= sizeof (src); len++) {
+	memset (dst, 0, sizeof (dst));
+	xcb_bit_reverse_bytes (src, dst, len);
+	for (i = 0; i < sizeof (dst); i++) {
+	    uint8_t want = i < len ? xcb_bit_reverse (src[i], 8) : 0;
+	    if (dst[i] != want) {
+		fprintf (stderr, "bit reverse fail at %d of %d: 0x%x != 0x%x\n",
+			 i, len, dst[i], want);
+		exit (1);
+	    }
+	}
+    }
+}
+
+/* The color channel c of a pixel with alpha a, premultiplied
+   or unpremultiplied, rounding to nearest. */
+static uint32_t
+alpha_reference (xcb_image_alpha_op_t op, uint32_t c, uint32_t a)
+{
+    switch (op) {
+    case XCB_IMAGE_ALPHA_PREMULTIPLY:
+	return (c * a * 2 + 255) / 510;
+    case XCB_IMAGE_ALPHA_UNPREMULTIPLY:
+	if (a == 0)
+	    return 0;
+	c = (c * 255 + a / 2) / a;
+	return c > 255 ? 255 : c;
+    default:
+	return c;
+    }
+}
+
+/* Every alpha against every channel value, including a zero
+   alpha and channels above alpha, into both byte orders. */
+static void
+check_alpha (void)
+{
+    xcb_image_t	*src, *dst;
+    uint32_t	a, c, s, pixel, want;
+    int		op, order;
+
+    src = xcb_image_create (256, 256, XCB_IMAGE_FORMAT_Z_PIXMAP, 32, 32, 32,
+			    32, XCB_IMAGE_ORDER_LSB_FIRST,
+			    XCB_IMAGE_ORDER_LSB_FIRST, NULL, 0, NULL);
+    for (a = 0; a < 256; a++)
+	for (c = 0; c < 256; c++)
+	    xcb_image_put_pixel (src, c, a,
+				 a << 24 | c << 16 | (255 - c) << 8 |
+				 ((c * 97) & 0xff));
+    for (op = XCB_IMAGE_ALPHA_NONE; op <= XCB_IMAGE_ALPHA_UNPREMULTIPLY; op++)
+	for (order = 0; order < NBYTE_ORDER; order++) {
+	    dst = xcb_image_create (256, 256, XCB_IMAGE_FORMAT_Z_PIXMAP, 32, 32,
+				    32, 32, byte_orders[order],
+				    byte_orders[order], NULL, 0, NULL);
+	    if (xcb_image_convert_alpha (src, dst, op) != dst) {
+		fprintf (stderr, "alpha %d conversion failed\n", op);
+		exit (1);
+	    }
+	    for (a = 0; a < 256; a++)
+		for (c = 0; c < 256; c++) {
+		    pixel = xcb_image_get_pixel (src, c, a);
+		    want = pixel & 0xff000000;
+		    for (s = 0; s < 24; s += 8)
+			want |= alpha_reference (op, (pixel >> s) & 0xff,
+						 a) << s;
+		    if (xcb_image_get_pixel (dst, c, a) != want) {
+			fprintf (stderr, "alpha %d fail at a %d c %d: "
+				 "0x%08x != 0x%08x\n", op, a, c,
+				 xcb_image_get_pixel (dst, c, a), want);
+			exit (1);
+		    }
+		}
+	    xcb_image_destroy (dst);
+	}
+    xcb_image_destroy (src);
+}
+
+/* The kernels for each CPU level are picked once per process,
+   so run the whole test again under each level that
+   XCB_IMAGE_CPU can name; the checks compare against
+   references computed here, so each level is held to the
+   same results.  Levels the CPU lacks run as its best one. */
+static int
+check_cpu_levels (char **argv)
+{
+#ifndef _WIN32
+    static const char * const levels[] = {
+	"scalar", "sse2", "ssse3", "avx2", "avx512"
+    };
+    int		i, status;
+    pid_t	pid;
+
+    if (getenv ("XCB_IMAGE_CPU"))
+	return 0;
+    for (i = 0; i < SIZE(levels); i++) {
+	fflush (stderr);
+	pid = fork ();
+	if (pid == 0) {
+	    setenv ("XCB_IMAGE_CPU", levels[i], 1);
+	    execv (argv[0], argv);
+	    _exit (127);
+	}
+	if (pid < 0 || waitpid (pid, &status, 0) != pid ||
+	    !WIFEXITED (status) || WEXITSTATUS (status) != 0) {
+	    fprintf (stderr, "failure with XCB_IMAGE_CPU=%s\n", levels[i]);
+	    return 1;
+	}
+    }
+#endif
+    return 0;
+}
+
+/* Conversions and subimages split over several threads must
+   match the same work done on one, including after fork(). */
+static void
+check_threads (void)
+{
+    static const struct {
+	xcb_image_format_t  format;
+	uint8_t             bpp, unit;
+	xcb_image_order_t   order;
+    } layouts[] = {
+	{ XCB_IMAGE_FORMAT_Z_PIXMAP, 32, 32, XCB_IMAGE_ORDER_MSB_FIRST },
+	{ XCB_IMAGE_FORMAT_Z_PIXMAP, 24, 24, XCB_IMAGE_ORDER_LSB_FIRST },
+	{ XCB_IMAGE_FORMAT_Z_PIXMAP, 16, 16, XCB_IMAGE_ORDER_MSB_FIRST },
+	{ XCB_IMAGE_FORMAT_Z_PIXMAP, 4, 8, XCB_IMAGE_ORDER_MSB_FIRST },
+	{ XCB_IMAGE_FORMAT_XY_PIXMAP, 8, 32, XCB_IMAGE_ORDER_LSB_FIRST },
+    };
+    xcb_image_t	*src, *one, *many, *sub;
+    int		i, x, y;
+
+    src = xcb_image_create (1001, 67, XCB_IMAGE_FORMAT_Z_PIXMAP, 32, 32, 32,
+			    32, XCB_IMAGE_ORDER_LSB_FIRST,
+			    XCB_IMAGE_ORDER_LSB_FIRST, NULL, 0, NULL);
+    for (y = 0; y < src->height; y++)
+	for (x = 0; x < src->width; x++)
+	    xcb_image_put_pixel (src, x, y, (y * src->width + x) * 0x9e3779b1);
+    for (i = 0; i < SIZE(layouts); i++) {
+	one = xcb_image_create (src->width, src->height, layouts[i].format,
+				32, layouts[i].bpp, layouts[i].bpp,
+				layouts[i].unit, layouts[i].order,
+				layouts[i].order, NULL, 0, NULL);
+	many = xcb_image_create (src->width, src->height, layouts[i].format,
+				 32, layouts[i].bpp, layouts[i].bpp,
+				 layouts[i].unit, layouts[i].order,
+				 layouts[i].order, NULL, 0, NULL);
+	xcb_image_set_threads (1, 0);
+	xcb_image_convert (src, one);
+	xcb_image_set_threads (7, 0);
+	xcb_image_convert (src, many);
+	if (!compare_image (one, many)) {
+	    fprintf (stderr, "threaded conversion failure:\n");
+	    print_format (many);
+	    exit (1);
+	}
+	sub = xcb_image_subimage (one, 3, 1, one->width - 5, one->height - 2,
+				  NULL, 0, NULL);
+	xcb_image_destroy (many);
+	many = xcb_image_subimage (one, 3, 1, one->width - 5,
+				   one->height - 2, NULL, 0, NULL);
+	xcb_image_set_threads (1, 0);
+	if (!sub || !many || !compare_image (sub, many)) {
+	    fprintf (stderr, "threaded subimage failure:\n");
+	    print_format (one);
+	    exit (1);
+	}
+	xcb_image_destroy (sub);
+	xcb_image_destroy (many);
+	xcb_image_destroy (one);
+    }
+#ifndef _WIN32
+    {
+	int	status;
+	pid_t	pid;
+
+	/* The workers stay behind; the child must not wait on them. */
+	xcb_image_set_threads (7, 0);
+	fflush (stderr);
+	pid = fork ();
+	if (pid == 0) {
+	    one = xcb_image_create (src->width, src->height,
+				    XCB_IMAGE_FORMAT_Z_PIXMAP, 32, 16, 16, 16,
+				    XCB_IMAGE_ORDER_MSB_FIRST,
+				    XCB_IMAGE_ORDER_MSB_FIRST, NULL, 0, NULL);
+	    _exit (xcb_image_convert (src, one) && compare_image (src, one) ?
+		   0 : 1);
+	}
+	if (pid < 0 || waitpid (pid, &status, 0) != pid ||
+	    !WIFEXITED (status) || WEXITSTATUS (status) != 0) {
+	    fprintf (stderr, "conversion after fork failure\n");
+	    exit (1);
+	}
+	xcb_image_set_threads (1, 0);
+    }
+#endif
+    xcb_image_destroy (src);
 }
 
 int main (int argc, char **argv) {
@@ -164,7 +1207,16 @@ int main (int argc, char **argv) {
   int		dst_byte_order, src_byte_order;
   int		dst_bit_order, src_bit_order;
 
+  check_bit_reverse ();
+  check_alpha ();
   test_image = create_test_image ();
+  check_accessors (test_image);
+  check_native_depths ();
+  check_deep_color ();
+  check_native_inplace (test_image);
+  check_create_from_rgba ();
+  check_dither ();
+  check_threads ();
 
   for (dst_format_i = 0; dst_format_i < NFORMAT; dst_format_i++) {
     dst_format = formats[dst_format_i];
@@ -176,6 +1228,10 @@ int main (int argc, char **argv) {
 	  src_bpp = bpps[src_bpp_i];
 	  for (dst_unit_i = 0; dst_unit_i < NUNIT; dst_unit_i++) {
 	    dst_unit = units[dst_unit_i];
+	    /* only z-pixmaps of 24 bpp have a 24 bit unit */
+	    if (dst_unit == 24 &&
+	        (dst_format != XCB_IMAGE_FORMAT_Z_PIXMAP || dst_bpp != 24))
+	      continue;
 	    if (dst_format == XCB_IMAGE_FORMAT_Z_PIXMAP) {
 	      if (dst_bpp == 4 && dst_unit != 8)
 		continue;
@@ -186,6 +1242,10 @@ int main (int argc, char **argv) {
 	      continue;
 	    for (src_unit_i = 0; src_unit_i < NUNIT; src_unit_i++) {
 	      src_unit = units[src_unit_i];
+	      /* only z-pixmaps of 24 bpp have a 24 bit unit */
+	      if (src_unit == 24 &&
+	          (src_format != XCB_IMAGE_FORMAT_Z_PIXMAP || src_bpp != 24))
+	        continue;
 	      if (src_format == XCB_IMAGE_FORMAT_Z_PIXMAP) {
 		if (src_bpp == 4 && src_unit != 8)
 		  continue;
@@ -227,6 +1287,33 @@ int main (int argc, char **argv) {
 			fprintf (stderr, "dst format: "); print_format(dst_image);
 			exit (1);
 		      }
+		      if (!compare_plan (src_image, dst_image)) {
+			fprintf (stderr, "Plan failure:\n");
+			fprintf (stderr, "src format: "); print_format(src_image);
+			fprintf (stderr, "dst format: "); print_format(dst_image);
+			exit (1);
+		      }
+		      if (!compare_subimage (dst_image, 5, 1, test_width - 9, 1)) {
+			fprintf (stderr, "Subimage failure:\n");
+			fprintf (stderr, "format: "); print_format(dst_image);
+			exit (1);
+		      }
+		      if (!compare_view (dst_image, 3, test_width - 7) ||
+			  !compare_view (dst_image, 0, test_width - 7)) {
+			fprintf (stderr, "View failure:\n");
+			fprintf (stderr, "format: "); print_format(dst_image);
+			exit (1);
+		      }
+		      if (!compare_rows (dst_image, 3, test_width - 7)) {
+			fprintf (stderr, "Row access failure:\n");
+			fprintf (stderr, "format: "); print_format(dst_image);
+			exit (1);
+		      }
+		      if (!compare_fast (dst_image)) {
+			fprintf (stderr, "Fast access failure:\n");
+			fprintf (stderr, "format: "); print_format(dst_image);
+			exit (1);
+		      }
 		      xcb_image_destroy (src_image);
 		      xcb_image_destroy (dst_image);
 		    }
@@ -239,5 +1326,6 @@ int main (int argc, char **argv) {
       }
     }
   }
-  return 0;
+  xcb_image_destroy (test_image);
+  return check_cpu_levels (argv);
 }
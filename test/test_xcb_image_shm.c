@@ -31,9 +31,6 @@
 #include <stdlib.h>
 #include <stdio.h>
 
-#include <sys/ipc.h>
-#include <sys/shm.h>
-
 #include <xcb/xcb.h>
 #include <xcb/shm.h>
 
@@ -65,6 +62,7 @@ main (int argc, char *argv[])
   xcb_image_t *img;
   xcb_shm_query_version_reply_t *rep;
   xcb_shm_segment_info_t shminfo;
+  xcb_image_shm_pool_t *pool;
   
   /* Open the connexion to the X server and get the first screen */
   c = xcb_connect (NULL, &screen_nbr);
@@ -99,8 +97,9 @@ main (int argc, char *argv[])
 	  exit (0);
       }
   format = rep->pixmap_format;
-  img = xcb_image_create_native (c, W_W, W_H, format, depth,
-				     0, ~0, 0);
+  pool = xcb_image_shm_pool_create (c, XCB_IMAGE_SHM_POOL_SEAL);
+  img = pool ? xcb_image_shm_pool_acquire (pool, W_W, W_H, format, depth,
+					   &shminfo) : 0;
 
   if (!img)
       {
@@ -115,14 +114,6 @@ main (int argc, char *argv[])
   printf (" * bitmap order....: %d\n", img->bit_order);
   printf (" * bitmap pad......: %d\n", img->scanline_pad);
 
-  shminfo.shmid = shmget (IPC_PRIVATE, img->size, IPC_CREAT|0777);
-  shminfo.shmaddr = shmat(shminfo.shmid, 0, 0);
-  img->data = shminfo.shmaddr;
-
-  shminfo.shmseg = xcb_generate_id (c);
-  xcb_shm_attach(c, shminfo.shmseg, shminfo.shmid, 0);
-  shmctl(shminfo.shmid, IPC_RMID, 0);
-
   /* Draw in the image */
   printf ("put the pixel\n");
   xcb_image_put_pixel (img, 20, 20, 65535);